@@ -0,0 +1,351 @@
+#pragma once
+
+// C++20 coroutine layer of DataBus and DataBusClient, built with the USE_COROUTINES option.
+#if defined(USE_COROUTINES) && defined(__cpp_impl_coroutine)
+
+#include <deque>
+#include <coroutine>
+#include <utility>
+#include <exception>
+#include <boost/asio.hpp>
+
+#include "data_bus.h"
+#include "data_bus_client.h"
+
+namespace data_bus {
+
+    // Coroutine started by AsyncBus::spawn, it runs on the io_context of the bus until it returns.
+    class Task {
+    public:
+        struct promise_type {
+            Task get_return_object() {
+                return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+            }
+
+            std::suspend_always initial_suspend() noexcept {
+                return {};
+            }
+
+            std::suspend_never final_suspend() noexcept {
+                return {};
+            }
+
+            void return_void() {
+            }
+
+            void unhandled_exception() {
+                try {
+                    std::rethrow_exception(std::current_exception());
+                } catch (std::exception &e) {
+                    Logger::error("AsyncBus", "Uncaught exception in task, {}.", e.what());
+                } catch (...) {
+                    Logger::error("AsyncBus", "Uncaught exception in task.");
+                }
+            }
+        };
+
+        Task(Task &&other) noexcept: handle_(other.handle_) {
+            other.handle_ = nullptr;
+        }
+
+        Task(const Task &) = delete;
+
+        Task &operator=(const Task &) = delete;
+
+        // a task never spawned is destroyed with its object
+        ~Task() {
+            if (handle_) {
+                handle_.destroy();
+            }
+        }
+
+        std::coroutine_handle<> release() {
+            std::coroutine_handle<> handle = handle_;
+            handle_ = nullptr;
+            return handle;
+        }
+
+    private:
+        explicit Task(std::coroutine_handle<promise_type> handle) : handle_(handle) {
+        }
+
+    private:
+        std::coroutine_handle<promise_type> handle_;
+    };
+
+    // Messages of one topic waiting for AsyncBus::next, and the coroutines waiting for messages.
+    class AsyncChannel {
+    public:
+        struct Waiter {
+            std::coroutine_handle<> handle;
+            ConstPtr<ProtoMessage> message;
+        };
+
+        AsyncChannel(boost::asio::io_context &ioc, std::size_t max_size) : ioc_(ioc), max_size_(max_size) {
+        }
+
+        // drops the oldest message when the buffer is full
+        void push(ConstPtr<ProtoMessage> message) {
+            std::lock_guard<std::mutex> locker(mutex_);
+            if (closed_) {
+                return;
+            }
+            if (!waiters_.empty()) {
+                Waiter *waiter = waiters_.front();
+                waiters_.pop_front();
+                waiter->message = message;
+                resume(waiter->handle);
+                return;
+            }
+            if (buffer_.size() >= max_size_) {
+                buffer_.pop_front();
+                dropped_++;
+            }
+            buffer_.push_back(message);
+        }
+
+        // false if the waiter is queued, otherwise it holds the next message or null if closed
+        bool take(Waiter *waiter) {
+            std::lock_guard<std::mutex> locker(mutex_);
+            if (!buffer_.empty()) {
+                waiter->message = buffer_.front();
+                buffer_.pop_front();
+                return true;
+            }
+            if (closed_) {
+                return true;
+            }
+            waiters_.push_back(waiter);
+            return false;
+        }
+
+        // wakes up the waiters with null, later messages are ignored
+        void close() {
+            std::lock_guard<std::mutex> locker(mutex_);
+            closed_ = true;
+            buffer_.clear();
+            for (Waiter *waiter : waiters_) {
+                resume(waiter->handle);
+            }
+            waiters_.clear();
+        }
+
+        int64_t dropped() {
+            std::lock_guard<std::mutex> locker(mutex_);
+            return dropped_;
+        }
+
+    private:
+        void resume(std::coroutine_handle<> handle) {
+            boost::asio::post(ioc_, [handle]() { handle.resume(); });
+        }
+
+    private:
+        boost::asio::io_context &ioc_;
+        std::size_t max_size_;
+        std::mutex mutex_;
+        std::deque<ConstPtr<ProtoMessage>> buffer_;
+        std::deque<Waiter *> waiters_;
+        bool closed_{false};
+        int64_t dropped_{0};
+    };
+
+    // Awaitable of an operation reporting its result through a callback, such as an ack or a write.
+    class ResultAwaiter {
+    public:
+        using Operation = std::function<void(std::function<void(bool)>)>;
+
+        ResultAwaiter(boost::asio::io_context &ioc, Operation operation)
+                : ioc_(ioc), operation_(std::move(operation)) {
+        }
+
+        bool await_ready() const noexcept {
+            return false;
+        }
+
+        void await_suspend(std::coroutine_handle<> handle) {
+            boost::asio::io_context &ioc = ioc_;
+            // the coroutine may resume on another thread and destroy this awaiter before the operation
+            // returns, so the operation must not be a member while it runs
+            Operation operation = std::move(operation_);
+            operation([this, &ioc, handle](bool result) {
+                result_ = result;
+                boost::asio::post(ioc, [handle]() { handle.resume(); });
+            });
+        }
+
+        bool await_resume() const noexcept {
+            return result_;
+        }
+
+    private:
+        boost::asio::io_context &ioc_;
+        Operation operation_;
+        bool result_{false};
+    };
+
+    template<typename T>
+    class NextAwaiter {
+    public:
+        explicit NextAwaiter(Ptr<AsyncChannel> channel) : channel_(std::move(channel)) {
+        }
+
+        bool await_ready() const noexcept {
+            return false;
+        }
+
+        bool await_suspend(std::coroutine_handle<> handle) {
+            waiter_.handle = handle;
+            return !channel_->take(&waiter_);
+        }
+
+        ConstPtr<T> await_resume() {
+            return std::dynamic_pointer_cast<const T>(waiter_.message);
+        }
+
+    private:
+        Ptr<AsyncChannel> channel_;
+        AsyncChannel::Waiter waiter_;
+    };
+
+    // Coroutine API of the bus. Coroutines are resumed on the given io_context, so the ones of one bus never
+    // run concurrently when a single thread runs it.
+    //
+    //     Task follow(AsyncBus &bus) {
+    //         co_await bus.subscribe<msg::Pose>("pose");
+    //         while (auto pose = co_await bus.next<msg::Pose>("pose")) { ... }
+    //     }
+    //     bus.spawn(follow(bus));
+    class AsyncBus {
+    public:
+        static const int DEFAULT_BUFFER_SIZE = 16;
+
+        explicit AsyncBus(boost::asio::io_context &ioc, int buffer_size = DEFAULT_BUFFER_SIZE)
+                : ioc_(ioc), buffer_size_(buffer_size), name_("AsyncBus@" + std::to_string(
+                reinterpret_cast<std::uintptr_t>(this))) {
+        }
+
+        AsyncBus(const AsyncBus &) = delete;
+
+        AsyncBus &operator=(const AsyncBus &) = delete;
+
+        boost::asio::io_context &context() {
+            return ioc_;
+        }
+
+        void spawn(Task task) {
+            std::coroutine_handle<> handle = task.release();
+            boost::asio::post(ioc_, [handle]() { handle.resume(); });
+        }
+
+        // subscribe the topic on the proxy of DataBusClient, resumes with the result of the ack
+        template<typename T>
+        ResultAwaiter subscribe(const std::string &topic, const SubscribeOptions &options = SubscribeOptions()) {
+            return ResultAwaiter(ioc_, [this, topic, options](std::function<void(bool)> on_ack) {
+                Ptr<AsyncChannel> channel = addChannel(topic, true);
+                if (!channel) {
+                    on_ack(false);
+                    return;
+                }
+                Callback<T> callback = [channel](ConstPtr<T> message) { channel->push(message); };
+                if (!DataBusClient::subscribe<T>(topic, name_, callback, options, on_ack)) {
+                    removeChannel(topic);
+                }
+            });
+        }
+
+        // the next message of the topic, null once it is unsubscribed. Without a remote subscription the
+        // topic is subscribed on the local DataBus at the first call.
+        template<typename T>
+        NextAwaiter<T> next(const std::string &topic) {
+            Ptr<AsyncChannel> channel = findChannel(topic);
+            if (!channel) {
+                channel = addChannel(topic, false);
+                Callback<T> callback = [channel](ConstPtr<T> message) { channel->push(message); };
+                DataBus::subscribe<T>(topic, name_, callback, buffer_size_);
+            }
+            return NextAwaiter<T>(channel);
+        }
+
+        // resumes with the result of the remote ack, or at once for a local subscription
+        ResultAwaiter unsubscribe(const std::string &topic) {
+            return ResultAwaiter(ioc_, [this, topic](std::function<void(bool)> on_ack) {
+                bool remote = false;
+                if (!removeChannel(topic, &remote)) {
+                    on_ack(false);
+                } else if (remote) {
+                    DataBusClient::unsubscribe(topic, name_, on_ack);
+                } else {
+                    on_ack(DataBus::unsubscribe(topic, name_));
+                }
+            });
+        }
+
+        // publish through DataBusClient, resumes once the message is written to the connection
+        template<typename T>
+        ResultAwaiter publish(const std::string &topic, Ptr<T> data, CodecType codec = CodecType::NONE,
+                              int codec_level = 0) {
+            return ResultAwaiter(ioc_, [topic, data, codec, codec_level](std::function<void(bool)> on_sent) {
+                DataBusClient::publish<T>(topic, data, codec, codec_level, on_sent);
+            });
+        }
+
+        // messages dropped because nobody awaited them in time
+        int64_t getDropCount(const std::string &topic) {
+            Ptr<AsyncChannel> channel = findChannel(topic);
+            return channel ? channel->dropped() : 0;
+        }
+
+    private:
+        struct Subscription {
+            Ptr<AsyncChannel> channel;
+            bool remote;
+        };
+
+        Ptr<AsyncChannel> findChannel(const std::string &topic) {
+            std::lock_guard<std::mutex> locker(mutex_);
+            auto it = subscription_map_.find(topic);
+            return it == subscription_map_.end() ? nullptr : it->second.channel;
+        }
+
+        // null if the topic is subscribed already
+        Ptr<AsyncChannel> addChannel(const std::string &topic, bool remote) {
+            std::lock_guard<std::mutex> locker(mutex_);
+            if (subscription_map_.count(topic) > 0) {
+                Logger::error("AsyncBus", "Can not subscribe repeatedly, topic={}.", topic);
+                return nullptr;
+            }
+            Ptr<AsyncChannel> channel = std::make_shared<AsyncChannel>(ioc_, buffer_size_);
+            subscription_map_[topic] = Subscription{channel, remote};
+            return channel;
+        }
+
+        bool removeChannel(const std::string &topic, bool *remote = nullptr) {
+            Ptr<AsyncChannel> channel;
+            {
+                std::lock_guard<std::mutex> locker(mutex_);
+                auto it = subscription_map_.find(topic);
+                if (it == subscription_map_.end()) {
+                    return false;
+                }
+                channel = it->second.channel;
+                if (remote) {
+                    *remote = it->second.remote;
+                }
+                subscription_map_.erase(it);
+            }
+            channel->close();
+            return true;
+        }
+
+    private:
+        boost::asio::io_context &ioc_;
+        int buffer_size_;
+        std::string name_;
+        std::mutex mutex_;
+        std::map<std::string, Subscription> subscription_map_;
+    };
+
+}
+
+#endif
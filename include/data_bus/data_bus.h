@@ -1,6 +1,7 @@
 #pragma once
 
 #include "publisher.h"
+#include "service.h"
 
 namespace data_bus {
 
@@ -65,6 +66,48 @@ namespace data_bus {
             return success;
         }
 
+        // Serve requests of type Req with responses of type Res, on the shared service worker pool. Remote
+        // clients reach the service through DataBusProxy.
+        template<typename Req, typename Res>
+        static bool advertiseService(const std::string &service,
+                                     const std::function<Ptr<Res>(ConstPtr<Req>)> &handler) {
+            return ServiceRegistry::advertise(service, [service, handler](ConstPtr<ProtoMessage> request,
+                                                                          ServiceReply reply) {
+                ServiceRegistry::pool().post([service, handler, request, reply]() {
+                    ConstPtr<Req> req = std::dynamic_pointer_cast<const Req>(request);
+                    if (!req) {
+                        reply(ServiceStatus::FAILED, nullptr, "request type mismatch");
+                        return;
+                    }
+                    try {
+                        reply(ServiceStatus::OK, handler(req), "");
+                    } catch (std::exception &e) {
+                        Logger::error("DataBus", "Service error, service={}, error={}.", service, e.what());
+                        reply(ServiceStatus::FAILED, nullptr, e.what());
+                    }
+                });
+            });
+        }
+
+        static bool unadvertiseService(const std::string &service) {
+            return ServiceRegistry::unadvertise(service);
+        }
+
+        // Call a service of this process, the future fails with TIMEOUT after timeout_ms, 0 waits forever.
+        template<typename Req, typename Res>
+        static ServiceFuture<Res> call(const std::string &service, ConstPtr<Req> request,
+                                       int64_t timeout_ms = ServiceRegistry::DEFAULT_TIMEOUT_MS) {
+            Ptr<std::promise<ConstPtr<Res>>> promise = std::make_shared<std::promise<ConstPtr<Res>>>();
+            CallTable &calls = ServiceRegistry::calls();
+            long id = calls.add(ServiceFuture<Res>::resolve(promise), timeout_ms);
+            ServiceFuture<Res> future(id, promise->get_future(), [&calls](long id) { return calls.cancel(id); });
+            ServiceRegistry::invoke(service, request, [&calls, id](ServiceStatus status, Ptr<ProtoMessage> response,
+                                                                   const std::string &error) {
+                calls.complete(id, status, response, error);
+            });
+            return future;
+        }
+
         static std::list<TopicStat> getTopicStats() {
             std::lock_guard<std::mutex> locker(instance()->mutex_);
             std::list<TopicStat> stats;
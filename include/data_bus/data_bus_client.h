@@ -1,20 +1,31 @@
 #pragma once
 
+#include <set>
 
+#include "data_bus/data_bus.h"
 #include "data_bus/subscriber_worker.h"
+#include "data_bus/subscribe_options.h"
+#include "data_bus/message_codec.h"
+#include "data_bus/wire_format.h"
+#include "data_bus/wire_names.h"
+#include "data_bus/delta_codec.h"
+#include "data_bus/service_message.h"
 #include "tcp_tool/tcp_client.h"
-#include "Protocol.pb.h"
 #include "util/proto_utils.h"
-#include "util/zlib_utils.h"
 
 namespace data_bus {
 
     using namespace tcp_tool;
     using namespace util;
 
+    // result of a SUB or UNSUB acknowledged by the proxy
+    using AckCallback = std::function<void(bool)>;
+
     class DataBusClient {
     public:
         static const int DEFAULT_QUEUE_SIZE = 1;
+        // bytes the proxy may send before it has to wait for more credit
+        static const int64_t DEFAULT_CREDIT_WINDOW = 16 * 1024 * 1024;
 
         DataBusClient() = default;
 
@@ -22,74 +33,172 @@ namespace data_bus {
 
         DataBusClient &operator=(const DataBus &) = delete;
 
-        static void connect(const std::string &host, unsigned short port) {
-            instance()->tcp_client_.encoder([](protocol::Message &t, std::vector<char> &data) {
-                int msg_size = t.ByteSize();
-                data.resize(msg_size);
-                t.SerializeToArray(data.data(), msg_size);
+        static void connect(const std::string &host, unsigned short port,
+                            int64_t credit_window = DEFAULT_CREDIT_WINDOW) {
+            // PUB frames are encoded by WireFormat beforehand, only control messages go through here
+            instance()->tcp_client_.encoder([](WireMessage &t, std::vector<char> &data) {
+                MessageCodec::encode(t.control, data);
             });
 
-            instance()->tcp_client_.decoder([](std::vector<char> &data, protocol::Message &t) -> bool {
-                t.ParseFromArray(data.data(), data.size());
-                data.clear();
-                return true;
+            instance()->tcp_client_.decoder([](std::vector<char> &data, WireMessage &t) -> bool {
+                return WireFormat::decode(data, t);
             });
 
-            instance()->tcp_client_.handler([&](protocol::Message &message, TcpSession<protocol::Message> &session) {
+            instance()->tcp_client_.handler([&](WireMessage &wire, TcpSession<WireMessage> &session) {
+                // the proxy charges credit for PUB frames and their chunks only, control messages are free
+                if (wire.is_pub || wire.is_chunk || wire.control.type() == protocol::Message_Type_PUB) {
+                    returnCredit(wire.frame_size);
+                }
+                if (wire.is_pub) {
+                    handlePub(wire.pub);
+                    return;
+                }
+                if (wire.is_chunk) {
+                    PubView pub;
+                    if (instance()->chunks_.add(wire.chunk, pub)) {
+                        handlePub(pub);
+                    }
+                    return;
+                }
+
+                protocol::Message &message = wire.control;
                 std::vector<char> packed;
-                if (message.compressed()) {
-                    ZlibUtils::decompress(message.payload(), packed);
-                } else {
-                    packed.resize(message.payload().size());
-                    packed.assign(message.payload().begin(), message.payload().end());
+                if (!MessageCodec::getPayload(message, packed)) {
+                    Logger::error("DataBusClient", "Can not decode message payload, type={}.", message.type());
+                    return;
                 }
 
                 if (message.type() == protocol::Message_Type::Message_Type_SUB_ACK) {
                     protocol::SubAckPayload ack;
-                    ack.ParseFromArray(message.payload().data(), message.payload().size());
-                    Logger::info("DataBusClient", "Subscribe successfully, topic={}, subscriber_name={}.", ack.topic(),
-                                 ack.subscriber_name());
+                    ack.ParseFromArray(packed.data(), packed.size());
+                    Logger::info("DataBusClient", "Subscribe successfully, topic={}, subscriber_name={}, codec={}.",
+                                 ack.topic(), ack.subscriber_name(), protocol::Codec_Name(ack.codec()));
+                    completeAck(message.id(), ack.result() == protocol::AckResult::SUCCESS);
                 } else if (message.type() == protocol::Message_Type::Message_Type_UNSUB_ACK) {
                     protocol::UnSubAckPayload ack;
-                    ack.ParseFromArray(message.payload().data(), message.payload().size());
-                    if (instance()->subscriber_map_.count(ack.topic()) == 0) {
-                        Logger::error("DataBusClient",
-                                      "Can not find subscriber by topic, topic={}, subscriber_name={}.", ack.topic(),
-                                      ack.subscriber_name());
-                        return;
+                    ack.ParseFromArray(packed.data(), packed.size());
+                    {
+                        std::lock_guard<std::mutex> locker(instance()->mutex_);
+                        if (instance()->subscriber_map_.erase(ack.topic()) == 0) {
+                            Logger::error("DataBusClient",
+                                          "Can not find subscriber by topic, topic={}, subscriber_name={}.",
+                                          ack.topic(), ack.subscriber_name());
+                        } else {
+                            instance()->delta_map_.erase(ack.topic());
+                            instance()->generation_++;
+                            Logger::info("DataBusClient", "Unsubscribe successfully, topic={}, subscriber_name={}.",
+                                         ack.topic(),
+                                         ack.subscriber_name());
+                        }
                     }
-
-                    instance()->subscriber_map_.erase(ack.topic());
-                    Logger::info("DataBusClient", "Unsubscribe successfully, topic={}, subscriber_name={}.",
-                                 ack.topic(),
-                                 ack.subscriber_name());
+                    completeAck(message.id(), ack.result() == protocol::AckResult::SUCCESS);
                 } else if (message.type() == protocol::Message_Type::Message_Type_PUB) {
+                    // proxies that only know version 1
                     protocol::PubPayload pub;
-                    pub.ParseFromArray(message.payload().data(), message.payload().size());
+                    pub.ParseFromArray(packed.data(), packed.size());
+                    handlePub(WireFormat::viewOf(pub));
+                } else if (message.type() == protocol::Message_Type::Message_Type_NAME) {
+                    protocol::NamePayload name;
+                    name.ParseFromArray(packed.data(), packed.size());
                     std::lock_guard<std::mutex> locker(instance()->mutex_);
-                    if (instance()->subscriber_map_.count(pub.topic()) == 0) {
-                        Logger::error("DataBusClient", "Can not find subscriber by topic, topic={}.", pub.topic());
+                    instance()->names_.define(static_cast<NameKind>(name.kind()), name.id(), name.name());
+                    // an id may be announced again with another name
+                    instance()->generation_++;
+                } else if (message.type() == protocol::Message_Type::Message_Type_HELLO) {
+                    protocol::HelloPayload hello;
+                    hello.ParseFromArray(packed.data(), packed.size());
+                    instance()->version_ = std::min(static_cast<int>(hello.version()),
+                                                    static_cast<int>(WireFormat::VERSION));
+                    Logger::info("DataBusClient", "Wire version {}.", instance()->version_.load());
+                } else if (message.type() == protocol::Message_Type::Message_Type_RESPONSE) {
+                    protocol::ResponsePayload response;
+                    response.ParseFromArray(packed.data(), packed.size());
+                    Ptr<ProtoMessage> res;
+                    if (response.status() == protocol::OK) {
+                        res = ServiceMessage::parse(response.data_type(), response.data());
+                    }
+                    ServiceRegistry::calls().complete(message.id(), static_cast<ServiceStatus>(response.status()),
+                                                      res, response.error());
+                } else if (message.type() == protocol::Message_Type::Message_Type_REQUEST) {
+                    // a call through the proxy to a service advertised by this client
+                    protocol::RequestPayload request;
+                    request.ParseFromArray(packed.data(), packed.size());
+                    int64_t id = message.id();
+                    {
+                        std::lock_guard<std::mutex> locker(instance()->mutex_);
+                        instance()->served_calls_.insert(id);
+                    }
+                    ServiceReply reply = [id](ServiceStatus status, Ptr<ProtoMessage> res, const std::string &error) {
+                        {
+                            // the proxy cancelled the call, it doesn't want the response anymore
+                            std::lock_guard<std::mutex> locker(instance()->mutex_);
+                            if (instance()->served_calls_.erase(id) == 0) {
+                                return;
+                            }
+                        }
+                        protocol::Message response = ServiceMessage::response(id, status, res, error);
+                        instance()->tcp_client_.send(MessageCodec::serialize(response));
+                    };
+                    Ptr<ProtoMessage> req = ServiceMessage::parse(request.data_type(), request.data());
+                    if (!req) {
+                        reply(ServiceStatus::FAILED, nullptr, "unknown request type: " + request.data_type());
                         return;
                     }
-
-                    Ptr<ProtoMessage> msg_ptr(ProtoUtils::createMessage(pub.data_type()));
-                    msg_ptr->ParseFromArray(pub.data().data(), pub.data().size());
-
-                    instance()->subscriber_map_[pub.topic()]->putData(msg_ptr);
+                    ServiceRegistry::invoke(request.service(), req, reply);
+                } else if (message.type() == protocol::Message_Type::Message_Type_CANCEL) {
+                    // a handler that runs already finishes, its response is dropped
+                    std::lock_guard<std::mutex> locker(instance()->mutex_);
+                    instance()->served_calls_.erase(message.id());
                 }
             });
 
             instance()->tcp_client_.connect(host, port);
             instance()->is_connected_ = true;
+
+            // PUB messages use version 1 until the proxy answered
+            protocol::HelloPayload hello;
+            hello.set_version(WireFormat::VERSION);
+            protocol::Message message;
+            message.set_type(protocol::Message_Type_HELLO);
+            message.set_payload(hello.SerializeAsString());
+            instance()->tcp_client_.send(MessageCodec::serialize(message));
+
+            instance()->credit_window_ = credit_window;
+            if (credit_window > 0) {
+                sendCredit(credit_window);
+            }
         };
 
         template<typename T>
         static void publish(const std::string &topic, Ptr<T> data, bool compressed = false) {
+            publish<T>(topic, data, compressed ? CodecType::ZLIB : CodecType::NONE);
+        }
+
+        // on_sent is called once the message is written to the connection, or failed to
+        template<typename T>
+        static void publish(const std::string &topic, Ptr<T> data, CodecType codec, int codec_level = 0,
+                            WriteCallback on_sent = nullptr) {
             if (!instance()->is_connected_) {
                 Logger::error("DataBusClient", "Tcp client is not connected, please call DataBusClient::connect.");
+                if (on_sent) {
+                    on_sent(false);
+                }
                 return;
             }
             Ptr<ProtoMessage> msg = std::static_pointer_cast<ProtoMessage>(data);
+            int version = instance()->version_;
+            if (version >= 2) {
+                Frame frame = encodePub(topic, *msg, codec, codec_level, version);
+                if (!frame) {
+                    if (on_sent) {
+                        on_sent(false);
+                    }
+                    return;
+                }
+                instance()->tcp_client_.send(frame, on_sent);
+                return;
+            }
+
             int size = msg->ByteSize();
             std::vector<char> buf(size);
             msg->SerializeToArray(buf.data(), size);
@@ -103,39 +212,58 @@ namespace data_bus {
             payload.SerializeToArray(payload_buf.data(), payload_size);
 
             protocol::Message message;
-            message.set_compressed(compressed);
             message.set_type(protocol::Message_Type_PUB);
-            if (compressed) {
-                std::vector<char> packed;
-                ZlibUtils::compress(payload_buf, packed);
-                message.set_payload(packed.data(), packed.size());
-            } else {
-                message.set_payload(payload_buf.data(), payload_size);
-            }
+            MessageCodec::setPayload(message, payload_buf.data(), payload_buf.size(), codec, codec_level);
 
-            instance()->tcp_client_.send(message);
+            instance()->tcp_client_.send(MessageCodec::serialize(message), on_sent);
         }
 
         template<typename T>
         static bool subscribe(const std::string &topic, const std::string &subscriber_name,
                               const Callback<T> &callback, int max_queue_size = DEFAULT_QUEUE_SIZE,
                               bool compressed = false, int max_rate = 0) {
+            SubscribeOptions options;
+            options.max_queue_size = max_queue_size;
+            options.max_rate = max_rate;
+            options.codec = compressed ? CodecType::ZLIB : CodecType::NONE;
+            return subscribe<T>(topic, subscriber_name, callback, options);
+        }
+
+        // on_ack is called with the result of the proxy's SUB_ACK, or with false if the subscription failed here
+        template<typename T>
+        static bool subscribe(const std::string &topic, const std::string &subscriber_name,
+                              const Callback<T> &callback, const SubscribeOptions &options,
+                              AckCallback on_ack = nullptr) {
             if (!instance()->is_connected_) {
                 Logger::error("DataBusClient", "Tcp client is not connected, please call DataBusClient::connect.");
+                if (on_ack) {
+                    on_ack(false);
+                }
                 return false;
             }
-            std::lock_guard<std::mutex> locker(instance()->mutex_);
+            std::unique_lock<std::mutex> locker(instance()->mutex_);
             if (instance()->subscriber_map_.count(topic) > 0) {
+                locker.unlock();
                 Logger::error("DataBusClient", "Can not subscribe repeatedly, topic={}, subscriber_name={}.", topic,
                               subscriber_name);
+                if (on_ack) {
+                    on_ack(false);
+                }
                 return false;
             }
 
             protocol::SubPayload msg;
             msg.set_topic(topic);
             msg.set_subscriber_name(subscriber_name);
-            msg.set_max_rate(max_rate);
-            msg.set_compressed(compressed);
+            msg.set_max_rate(options.max_rate);
+            msg.set_compressed(options.codec == CodecType::ZLIB);
+            msg.set_codec(static_cast<protocol::Codec>(options.codec));
+            msg.set_codec_level(options.codec_level);
+            msg.set_min_compress_size(options.min_compress_size);
+            msg.set_delta(options.delta);
+            msg.set_keyframe_interval(options.keyframe_interval);
+            msg.set_drop_policy(static_cast<protocol::DropPolicy>(options.drop_policy));
+            msg.set_priority(options.priority);
             int size = msg.ByteSize();
             std::vector<char> buf(size);
             msg.SerializeToArray(buf.data(), size);
@@ -143,18 +271,28 @@ namespace data_bus {
             protocol::Message message;
             message.set_compressed(false);
             message.set_type(protocol::Message_Type_SUB);
+            message.set_id(addAck(on_ack));
             message.set_payload(buf.data(), size);
-            instance()->tcp_client_.send(message);
+            instance()->tcp_client_.send(MessageCodec::serialize(message));
 
             Ptr<Subscriber> subscriber(new SubscriberT<T>(subscriber_name, callback));
-            Ptr<SubscriberWorker> worker = std::make_shared<SubscriberWorker>(topic, subscriber, max_queue_size);
+            Ptr<SubscriberWorker> worker = std::make_shared<SubscriberWorker>(topic, subscriber,
+                                                                              options.max_queue_size);
             instance()->subscriber_map_[topic] = worker;
+            if (options.delta) {
+                instance()->delta_map_[topic] = std::make_shared<DeltaDecoder>();
+            }
+            instance()->generation_++;
             return true;
         }
 
-        static bool unsubscribe(const std::string &topic, const std::string &subscriber_name) {
+        static bool unsubscribe(const std::string &topic, const std::string &subscriber_name,
+                                AckCallback on_ack = nullptr) {
             if (!instance()->is_connected_) {
                 Logger::error("DataBusClient", "Tcp client is not connected, please call DataBusClient::connect.");
+                if (on_ack) {
+                    on_ack(false);
+                }
                 return false;
             }
 
@@ -167,12 +305,50 @@ namespace data_bus {
 
             protocol::Message message;
             message.set_compressed(false);
-            message.set_type(protocol::Message_Type_SUB);
+            message.set_type(protocol::Message_Type_UNSUB);
+            message.set_id(addAck(on_ack));
             message.set_payload(buf.data(), size);
-            instance()->tcp_client_.send(message);
+            instance()->tcp_client_.send(MessageCodec::serialize(message));
+            return true;
+        }
+
+        // Serve the service in this process and to the callers of all clients of the proxy.
+        template<typename Req, typename Res>
+        static bool advertiseService(const std::string &service,
+                                     const std::function<Ptr<Res>(ConstPtr<Req>)> &handler) {
+            if (!instance()->is_connected_) {
+                Logger::error("DataBusClient", "Tcp client is not connected, please call DataBusClient::connect.");
+                return false;
+            }
+            if (!DataBus::advertiseService<Req, Res>(service, handler)) {
+                return false;
+            }
+            protocol::Message message = ServiceMessage::advertise(service);
+            instance()->tcp_client_.send(MessageCodec::serialize(message));
             return true;
         }
 
+        // Call a service through the proxy, many calls may be in flight at once. The future fails with
+        // TIMEOUT after timeout_ms, 0 waits forever, cancel() also tells the proxy to drop the call.
+        template<typename Req, typename Res>
+        static ServiceFuture<Res> call(const std::string &service, ConstPtr<Req> request,
+                                       int64_t timeout_ms = ServiceRegistry::DEFAULT_TIMEOUT_MS) {
+            Ptr<std::promise<ConstPtr<Res>>> promise = std::make_shared<std::promise<ConstPtr<Res>>>();
+            CallTable &calls = ServiceRegistry::calls();
+            long id = calls.add(ServiceFuture<Res>::resolve(promise), timeout_ms, [](long id) {
+                protocol::Message cancel = ServiceMessage::cancel(id);
+                instance()->tcp_client_.send(MessageCodec::serialize(cancel));
+            });
+            ServiceFuture<Res> future(id, promise->get_future(), [&calls](long id) { return calls.cancel(id); });
+            if (!instance()->is_connected_) {
+                calls.complete(id, ServiceStatus::FAILED, nullptr, "client is not connected");
+                return future;
+            }
+            protocol::Message message = ServiceMessage::request(id, service, *request, timeout_ms);
+            instance()->tcp_client_.send(MessageCodec::serialize(message));
+            return future;
+        }
+
         static std::list<QueueStat> getQueueStats() {
             std::lock_guard<std::mutex> locker(instance()->mutex_);
             std::list<QueueStat> stats;
@@ -183,6 +359,177 @@ namespace data_bus {
         }
 
     private:
+        // a PUB frame of version 2 or later, the message is serialized right into it unless it is compressed.
+        // From version 3 the frame carries ids, announced to the proxy beforehand. Null if it can't be encoded.
+        static Frame encodePub(const std::string &topic, const ProtoMessage &msg, CodecType codec, int codec_level,
+                               int version) {
+            std::string data_type;
+            PubView pub;
+            if (version >= 3) {
+                pub.topic_id = announce(NameKind::TOPIC, instance()->name_registry_.topicId(topic), topic);
+                const google::protobuf::Descriptor *descriptor = msg.GetDescriptor();
+                pub.type_id = announce(NameKind::DATA_TYPE, instance()->name_registry_.typeId(descriptor),
+                                       descriptor->full_name());
+            } else {
+                data_type = msg.GetTypeName();
+                pub.topic = topic;
+                pub.data_type = data_type;
+            }
+            std::size_t size = msg.ByteSizeLong();
+            if (codec == CodecType::NONE || size < static_cast<std::size_t>(CodecFactory::DEFAULT_MIN_COMPRESS_SIZE)) {
+                std::shared_ptr<std::vector<char>> frame = std::make_shared<std::vector<char>>();
+                char *out = WireFormat::preparePub(*frame, pub, size);
+                if (!out) {
+                    return nullptr;
+                }
+                msg.SerializeWithCachedSizesToArray(reinterpret_cast<uint8_t *>(out));
+                return frame;
+            }
+            std::vector<char> buf(size);
+            msg.SerializeWithCachedSizesToArray(reinterpret_cast<uint8_t *>(buf.data()));
+            return WireFormat::encodePub(pub, buf.data(), buf.size(), codec, codec_level, 0);
+        }
+
+        // send the NAME message of the id before its first frame, returns the id
+        static uint32_t announce(NameKind kind, uint32_t id, const std::string &name) {
+            instance()->names_.announce(kind, id, [&]() {
+                instance()->tcp_client_.send(ConnectionNames::encodeName(kind, id, name));
+            });
+            return id;
+        }
+
+        // the subscriber of a topic id, resolved by name again after the subscriptions or names changed
+        struct TopicRoute {
+            uint64_t generation{0};
+            const std::string *topic{nullptr};
+            Ptr<SubscriberWorker> worker;
+            Ptr<DeltaDecoder> delta;
+        };
+
+        // call with mutex_ held, inline_route holds the route of a frame with an inline topic
+        static TopicRoute *findRoute(const PubView &pub, std::string &inline_topic, TopicRoute &inline_route) {
+            DataBusClient *self = instance();
+            TopicRoute *route = &inline_route;
+            if (pub.topic_id == 0) {
+                inline_topic = pub.topic.to_string();
+                route->topic = &inline_topic;
+            } else {
+                const std::string *topic = self->names_.topic(pub.topic_id);
+                if (!topic) {
+                    Logger::error("DataBusClient", "Unknown topic id, topic_id={}.", pub.topic_id);
+                    return nullptr;
+                }
+                if (pub.topic_id >= self->routes_.size()) {
+                    self->routes_.resize(pub.topic_id + 1);
+                }
+                route = &self->routes_[pub.topic_id];
+                if (route->generation == self->generation_) {
+                    return route;
+                }
+                route->generation = self->generation_;
+                route->topic = topic;
+            }
+
+            auto it = self->subscriber_map_.find(*route->topic);
+            route->worker = it != self->subscriber_map_.end() ? it->second : nullptr;
+            auto delta_it = self->delta_map_.find(*route->topic);
+            route->delta = delta_it != self->delta_map_.end() ? delta_it->second : nullptr;
+            return route;
+        }
+
+        static void handlePub(const PubView &pub) {
+            std::lock_guard<std::mutex> locker(instance()->mutex_);
+            std::string inline_topic;
+            TopicRoute inline_route;
+            TopicRoute *route = findRoute(pub, inline_topic, inline_route);
+            if (!route) {
+                return;
+            }
+            const std::string &topic = *route->topic;
+            if (!route->worker) {
+                Logger::error("DataBusClient", "Can not find subscriber by topic, topic={}.", topic);
+                return;
+            }
+
+            const char *data = pub.data.data();
+            std::size_t size = pub.data.size();
+            std::vector<char> unpacked;
+            if (pub.codec != CodecType::NONE) {
+                if (!CodecFactory::decompress(pub.codec, data, size, unpacked)) {
+                    Logger::error("DataBusClient", "Can not decompress message, topic={}.", topic);
+                    return;
+                }
+                data = unpacked.data();
+                size = unpacked.size();
+            }
+
+            const ProtoMessage *prototype = pub.type_id != 0 ? instance()->names_.prototype(pub.type_id)
+                                                             : ProtoUtils::getPrototype(pub.data_type.to_string());
+            if (!prototype) {
+                Logger::error("DataBusClient", "Unknown data type, topic={}, type_id={}.", topic, pub.type_id);
+                return;
+            }
+            Ptr<ProtoMessage> msg_ptr(prototype->New());
+            if (route->delta) {
+                std::vector<char> full;
+                if (!route->delta->decode(pub.delta, pub.seq, pub.base_seq, data, size, full)) {
+                    Logger::warn("DataBusClient", "Drop delta message until next keyframe, topic={}, seq={}.",
+                                 topic, pub.seq);
+                    return;
+                }
+                msg_ptr->ParseFromArray(full.data(), static_cast<int>(full.size()));
+            } else {
+                msg_ptr->ParseFromArray(data, static_cast<int>(size));
+            }
+
+            route->worker->putData(msg_ptr);
+        }
+
+        // id of a SUB or UNSUB message, the proxy echoes it in the ack
+        static int64_t addAck(AckCallback on_ack) {
+            std::lock_guard<std::mutex> locker(instance()->ack_mutex_);
+            int64_t id = ++instance()->last_ack_id_;
+            if (on_ack) {
+                instance()->ack_map_[id] = on_ack;
+            }
+            return id;
+        }
+
+        static void completeAck(int64_t id, bool success) {
+            AckCallback on_ack;
+            {
+                std::lock_guard<std::mutex> locker(instance()->ack_mutex_);
+                auto it = instance()->ack_map_.find(id);
+                if (it == instance()->ack_map_.end()) {
+                    return;
+                }
+                on_ack = it->second;
+                instance()->ack_map_.erase(it);
+            }
+            on_ack(success);
+        }
+
+        // give back the credit of the received bytes, batched to half a window
+        static void returnCredit(std::size_t bytes) {
+            if (instance()->credit_window_ <= 0) {
+                return;
+            }
+            int64_t received = instance()->received_bytes_ += bytes;
+            if (received >= instance()->credit_window_ / 2) {
+                instance()->received_bytes_ -= received;
+                sendCredit(received);
+            }
+        }
+
+        static void sendCredit(int64_t bytes) {
+            protocol::CreditPayload credit;
+            credit.set_bytes(bytes);
+            protocol::Message message;
+            message.set_type(protocol::Message_Type_CREDIT);
+            message.set_payload(credit.SerializeAsString());
+            instance()->tcp_client_.send(MessageCodec::serialize(message));
+        }
+
         static DataBusClient *instance() {
             static DataBusClient instance;
             return &instance;
@@ -190,10 +537,29 @@ namespace data_bus {
 
     private:
         std::atomic_bool is_connected_{false};
-        TcpClient<protocol::Message> tcp_client_;
+        int64_t credit_window_{0};
+        std::atomic<int64_t> received_bytes_{0};
+        TcpClient<WireMessage> tcp_client_;
+        // wire version agreed on with the proxy
+        std::atomic_int version_{1};
 
         std::mutex mutex_;
         std::condition_variable_any wait_cond_;
         std::map<std::string, Ptr<SubscriberWorker>> subscriber_map_;
+        std::map<std::string, Ptr<DeltaDecoder>> delta_map_;
+        // ids of the calls the proxy forwarded to the services of this client, until they are answered
+        std::set<int64_t> served_calls_;
+        // ids of the names sent to the proxy and names of the ids received from it
+        NameRegistry name_registry_;
+        ConnectionNames names_;
+        // used by the io thread only
+        ChunkAssembler chunks_;
+        // routes of topic ids, stale once generation_ changed
+        std::vector<TopicRoute> routes_;
+        uint64_t generation_{1};
+
+        std::mutex ack_mutex_;
+        int64_t last_ack_id_{0};
+        std::map<int64_t, AckCallback> ack_map_;
     };
 }
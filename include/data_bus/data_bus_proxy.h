@@ -1,156 +1,983 @@
 #pragma once
 
-#include <boost/iostreams/filter/gzip.hpp>
-#include <boost/iostreams/filtering_streambuf.hpp>
-#include <boost/iostreams/device/back_inserter.hpp>
-#include <boost/iostreams/copy.hpp>
+#include <unistd.h>
+#include <limits>
 
 #include "data_bus.h"
+#include "message_codec.h"
+#include "wire_format.h"
+#include "wire_names.h"
+#include "delta_codec.h"
+#include "flow_control.h"
+#include "origin_table.h"
+#include "peer_link.h"
+#include "multicast_transport.h"
+#include "service_message.h"
 #include "tcp_tool/tcp_server.h"
-#include "Protocol.pb.h"
+#include "tcp_tool/tcp_client.h"
 #include "util/proto_utils.h"
-#include "util/zlib_utils.h"
 
 namespace data_bus {
 
     using namespace tcp_tool;
     using namespace util;
 
+    using SessionRef = std::weak_ptr<TcpSession<WireMessage>>;
+
+    // Bridges the local DataBus to remote DataBusClients, and to other proxies linked with peer(). Proxies
+    // exchange the topics somebody downstream of them subscribed to, and a topic only crosses a link while
+    // it is wanted on the other side. Every message carries the node id where it entered the federation
+    // and a sequence number there, which suppresses loops and duplicates arriving over several links.
     class DataBusProxy {
     public:
-        DataBusProxy() = default;
+        DataBusProxy() : node_id_(boost::asio::ip::host_name() + "-" + std::to_string(getpid())) {
+        }
 
         DataBusProxy(const DataBusProxy &) = delete;
 
         DataBusProxy &operator=(const DataBusProxy &) = delete;
 
         static void listen(unsigned short port) {
-            instance()->tcp_server_.encoder([](protocol::Message &t, std::vector<char> &data) {
-                int msg_size = t.ByteSize();
-                data.resize(msg_size);
-                t.SerializeToArray(data.data(), msg_size);
+            instance()->tcp_server_.encoder(encode);
+            instance()->tcp_server_.decoder(decode);
+            instance()->tcp_server_.handler(handle);
+            instance()->tcp_server_.onClose(handleClose);
+            instance()->tcp_server_.listen(port);
+        };
+
+        // Link to the proxy at host:port, options are the settings of the traffic in both directions.
+        static bool peer(const std::string &host, unsigned short port, const LinkOptions &options = LinkOptions()) {
+            releaseClosedClients();
+            Ptr<PeerLink> link = std::make_shared<PeerLink>();
+            link->options = options;
+            link->client = std::make_shared<TcpClient<WireMessage>>();
+            link->client->encoder(encode);
+            link->client->decoder(decode);
+            link->client->handler(handle);
+            link->client->onClose(handleClose);
+            try {
+                link->client->connect(host, port);
+            } catch (std::exception &e) {
+                Logger::error("DataBusProxy", "Can not link to peer {}:{}, {}.", host, port, e.what());
+                return false;
+            }
+            link->session = link->client->session().get();
+
+            {
+                std::lock_guard<std::mutex> locker(instance()->mutex_);
+                instance()->peer_map_[link->session->session_id()] = link;
+            }
+            sendHello(*link->session, WireFormat::VERSION, false);
+            sendPeer(*link->session, options, false);
+            Logger::info("DataBusProxy", "Link to peer {}:{}, node_id={}.", host, port, nodeId());
+            return true;
+        }
+
+        // Send the topic to a multicast group instead of a TCP stream per host, best effort. The cost per
+        // message is the same however many hosts joined the group.
+        static bool multicast(const std::string &topic, const std::string &group, unsigned short port,
+                              const MulticastOptions &options = MulticastOptions()) {
+            Ptr<MulticastSender> sender;
+            try {
+                sender = std::make_shared<MulticastSender>(group, port, options);
+            } catch (std::exception &e) {
+                Logger::error("DataBusProxy", "Can not open multicast sender, group={}, port={}, {}.", group, port,
+                              e.what());
+                return false;
+            }
+            CodecType codec = options.codec;
+            int level = options.codec_level;
+            std::string subscriber_name = "multicast:" + group + ":" + std::to_string(port);
+            bool success = DataBus::subscribe<ProtoMessage>(
+                    topic, subscriber_name, [topic, codec, level, sender](ConstPtr<ProtoMessage> msg) {
+                        Origin origin = instance()->origin_table_.get(topic, msg, instance()->node_id_);
+                        // already delivered to the group by its sender
+                        if (origin.from_session == MULTICAST_SESSION) {
+                            return;
+                        }
+                        CodecType applied = msg->ByteSizeLong() >= static_cast<size_t>(
+                                CodecFactory::DEFAULT_MIN_COMPRESS_SIZE) ? codec : CodecType::NONE;
+                        int encoding = encodingOf(MULTICAST_VERSION, applied, level);
+                        Frame frame = instance()->frame_cache_.get(topic, msg, encoding, [&]() {
+                            return encodePub(topic, msg, origin, applied, level, MULTICAST_VERSION);
+                        });
+                        if (frame) {
+                            sender->send(frame);
+                        }
+                    });
+            if (!success) {
+                return false;
+            }
+            std::lock_guard<std::mutex> locker(instance()->mutex_);
+            instance()->multicast_senders_.push_back(sender);
+            return true;
+        }
+
+        // Publish the messages sent to the multicast group on the local bus.
+        static bool joinMulticast(const std::string &group, unsigned short port,
+                                  const std::string &interface = "0.0.0.0") {
+            Ptr<MulticastReceiver> receiver;
+            try {
+                receiver = std::make_shared<MulticastReceiver>(group, port, [](const char *data, std::size_t size) {
+                    // multicast frames carry the names inline
+                    WireMessage message;
+                    if (WireFormat::parse(data, size, message) == 0 || message.frame_size == 0 || !message.is_pub) {
+                        return;
+                    }
+                    handlePub(message.pub, MULTICAST_SESSION, nullptr);
+                }, interface);
+            } catch (std::exception &e) {
+                Logger::error("DataBusProxy", "Can not join multicast group, group={}, port={}, {}.", group, port,
+                              e.what());
+                return false;
+            }
+            std::lock_guard<std::mutex> locker(instance()->mutex_);
+            instance()->multicast_receivers_.push_back(receiver);
+            return true;
+        }
+
+        static std::list<MulticastStat> getMulticastStats() {
+            std::lock_guard<std::mutex> locker(instance()->mutex_);
+            std::list<MulticastStat> stats;
+            for (auto &sender : instance()->multicast_senders_) {
+                stats.push_back(sender->getStat());
+            }
+            for (auto &receiver : instance()->multicast_receivers_) {
+                stats.push_back(receiver->getStat());
+            }
+            return stats;
+        }
+
+        // id of this proxy in the federation, unique per process by default, call before listen and peer
+        static void nodeId(const std::string &node_id) {
+            instance()->node_id_ = node_id;
+        }
+
+        static std::string nodeId() {
+            return instance()->node_id_;
+        }
+
+        // Interest of the subscribers in this process, so that peers forward the topic to the local bus.
+        static void addInterest(const std::string &topic) {
+            addInterest(topic, LOCAL_SESSION);
+        }
+
+        static void removeInterest(const std::string &topic) {
+            removeInterest(topic, LOCAL_SESSION);
+        }
+
+        // upper limit of the write queue of each session, call before listen
+        static void maxQueuedBytes(std::size_t max_queued_bytes) {
+            instance()->max_queued_bytes_ = max_queued_bytes;
+        }
+
+        static std::list<SessionStat> getSessionStats() {
+            std::lock_guard<std::mutex> locker(instance()->mutex_);
+            std::list<SessionStat> stats;
+            for (auto &pair : instance()->flow_map_) {
+                stats.push_back(pair.second->getSessionStat());
+            }
+            return stats;
+        }
+
+        // messages dropped because they already arrived over another link
+        static std::size_t getDuplicateCount() {
+            return instance()->origin_table_.duplicateCount();
+        }
+
+    private:
+        // wire state of a session, kept in its context
+        struct SessionState {
+            ConnectionNames names;
+            ChunkAssembler chunks;
+        };
+
+        static DataBusProxy *instance() {
+            static DataBusProxy instance;
+            return &instance;
+        }
+
+        // PUB frames are encoded by WireFormat beforehand, only control messages go through here
+        static void encode(WireMessage &t, std::vector<char> &data) {
+            MessageCodec::encode(t.control, data);
+        }
+
+        static bool decode(std::vector<char> &data, WireMessage &t) {
+            return WireFormat::decode(data, t);
+        }
+
+        // messages of clients and peer proxies, both accepted and initiated links
+        static void handle(WireMessage &wire, TcpSession<WireMessage> &session) {
+            if (wire.is_pub) {
+                handlePub(wire.pub, session.session_id(), &stateOf(session)->names);
+                return;
+            }
+            if (wire.is_chunk) {
+                Ptr<SessionState> state = stateOf(session);
+                PubView pub;
+                if (state->chunks.add(wire.chunk, pub)) {
+                    handlePub(pub, session.session_id(), &state->names);
+                }
+                return;
+            }
+
+            protocol::Message &message = wire.control;
+            std::vector<char> packed;
+            if (!MessageCodec::getPayload(message, packed)) {
+                Logger::error("DataBusProxy", "Can not decode message payload, type={}.", message.type());
+                return;
+            }
+
+            if (message.type() == protocol::Message_Type::Message_Type_SUB) {
+                protocol::SubPayload payload;
+                payload.ParseFromArray(packed.data(), packed.size());
+                handleSub(message.id(), payload, session);
+            } else if (message.type() == protocol::Message_Type::Message_Type_UNSUB) {
+                protocol::SubPayload payload;
+                payload.ParseFromArray(packed.data(), packed.size());
+                handleUnsub(message.id(), payload, session);
+            } else if (message.type() == protocol::Message_Type::Message_Type_PUB) {
+                protocol::PubPayload pub;
+                pub.ParseFromArray(packed.data(), packed.size());
+                handlePub(WireFormat::viewOf(pub), session.session_id(), nullptr);
+            } else if (message.type() == protocol::Message_Type::Message_Type_CREDIT) {
+                protocol::CreditPayload credit;
+                credit.ParseFromArray(packed.data(), packed.size());
+                flowOf(session)->grant(credit.bytes());
+            } else if (message.type() == protocol::Message_Type::Message_Type_PEER) {
+                protocol::PeerPayload payload;
+                payload.ParseFromArray(packed.data(), packed.size());
+                handlePeer(payload, session);
+            } else if (message.type() == protocol::Message_Type::Message_Type_REQUEST) {
+                protocol::RequestPayload request;
+                request.ParseFromArray(packed.data(), packed.size());
+                handleRequest(message.id(), request, session);
+            } else if (message.type() == protocol::Message_Type::Message_Type_RESPONSE) {
+                // only the provider a call was forwarded to may answer it
+                {
+                    std::lock_guard<std::mutex> locker(instance()->mutex_);
+                    auto it = instance()->provider_calls_.find(session.session_id());
+                    if (it == instance()->provider_calls_.end() || it->second.count(message.id()) == 0) {
+                        Logger::error("DataBusProxy", "Response to a call the session doesn't serve, session_id={}, "
+                                                      "id={}.", session.session_id(), message.id());
+                        return;
+                    }
+                }
+                protocol::ResponsePayload response;
+                response.ParseFromArray(packed.data(), packed.size());
+                Ptr<ProtoMessage> res;
+                if (response.status() == protocol::OK) {
+                    res = ServiceMessage::parse(response.data_type(), response.data());
+                }
+                ServiceRegistry::calls().complete(message.id(), static_cast<ServiceStatus>(response.status()), res,
+                                                  response.error());
+            } else if (message.type() == protocol::Message_Type::Message_Type_ADVERTISE) {
+                protocol::AdvertisePayload payload;
+                payload.ParseFromArray(packed.data(), packed.size());
+                handleAdvertise(payload.service(), session);
+            } else if (message.type() == protocol::Message_Type::Message_Type_NAME) {
+                protocol::NamePayload name;
+                name.ParseFromArray(packed.data(), packed.size());
+                stateOf(session)->names.define(static_cast<NameKind>(name.kind()), name.id(), name.name());
+            } else if (message.type() == protocol::Message_Type::Message_Type_HELLO) {
+                protocol::HelloPayload hello;
+                hello.ParseFromArray(packed.data(), packed.size());
+                handleHello(hello, session);
+            } else if (message.type() == protocol::Message_Type::Message_Type_CANCEL) {
+                long id = 0;
+                {
+                    std::lock_guard<std::mutex> locker(instance()->mutex_);
+                    auto it = instance()->remote_calls_.find(std::make_pair(session.session_id(), message.id()));
+                    if (it != instance()->remote_calls_.end()) {
+                        id = it->second;
+                    }
+                }
+                if (id != 0) {
+                    ServiceRegistry::calls().cancel(id);
+                }
+            }
+        }
+
+        // a call of a remote client, to a service of this process or advertised by another client
+        static void handleRequest(int64_t caller_id, const protocol::RequestPayload &request,
+                                  TcpSession<WireMessage> &session) {
+            long session_id = session.session_id();
+            SessionRef caller = session.shared_from_this();
+            ServiceReply reply = [caller, session_id, caller_id](ServiceStatus status, Ptr<ProtoMessage> response,
+                                                                 const std::string &error) {
+                {
+                    std::lock_guard<std::mutex> locker(instance()->mutex_);
+                    instance()->remote_calls_.erase(std::make_pair(session_id, caller_id));
+                }
+                // the caller may be gone by the time the service replies
+                Ptr<TcpSession<WireMessage>> target = caller.lock();
+                if (target) {
+                    protocol::Message message = ServiceMessage::response(caller_id, status, response, error);
+                    target->send(MessageCodec::serialize(message));
+                }
+            };
+
+            Ptr<ProtoMessage> req = ServiceMessage::parse(request.data_type(), request.data());
+            if (!req) {
+                reply(ServiceStatus::FAILED, nullptr, "unknown request type: " + request.data_type());
+                return;
+            }
+            CallTable &calls = ServiceRegistry::calls();
+            long id = calls.add(reply, request.timeout_ms());
+            {
+                std::lock_guard<std::mutex> locker(instance()->mutex_);
+                instance()->remote_calls_[std::make_pair(session_id, caller_id)] = id;
+            }
+            ServiceRegistry::invoke(request.service(), req, [&calls, id](ServiceStatus status,
+                                                                         Ptr<ProtoMessage> response,
+                                                                         const std::string &error) {
+                calls.complete(id, status, response, error);
             });
+        }
 
-            instance()->tcp_server_.decoder([](std::vector<char> &data, protocol::Message &t) -> bool {
-                t.ParseFromArray(data.data(), data.size());
-                data.clear();
-                return true;
+        // a client serves the service, forward the calls to it
+        static void handleAdvertise(const std::string &service, TcpSession<WireMessage> &session) {
+            long session_id = session.session_id();
+            SessionRef provider = session.shared_from_this();
+            bool success = ServiceRegistry::advertise(service, [service, provider, session_id](
+                    ConstPtr<ProtoMessage> request, ServiceReply reply) {
+                Ptr<long> call_id = std::make_shared<long>(0);
+                // forget the call once it completed, however it did
+                ServiceReply forget = [session_id, call_id, reply](ServiceStatus status, Ptr<ProtoMessage> response,
+                                                                   const std::string &error) {
+                    {
+                        std::lock_guard<std::mutex> locker(instance()->mutex_);
+                        instance()->provider_calls_[session_id].erase(*call_id);
+                    }
+                    reply(status, response, error);
+                };
+                long id = ServiceRegistry::calls().add(forget, ServiceRegistry::DEFAULT_TIMEOUT_MS,
+                                                       [provider](long id) {
+                                                           Ptr<TcpSession<WireMessage>> target = provider.lock();
+                                                           if (target) {
+                                                               protocol::Message cancel = ServiceMessage::cancel(id);
+                                                               target->send(MessageCodec::serialize(cancel));
+                                                           }
+                                                       });
+                *call_id = id;
+                Ptr<TcpSession<WireMessage>> target = provider.lock();
+                {
+                    std::lock_guard<std::mutex> locker(instance()->mutex_);
+                    if (target) {
+                        instance()->provider_calls_[session_id].insert(id);
+                    }
+                }
+                if (!target) {
+                    ServiceRegistry::calls().complete(id, ServiceStatus::FAILED, nullptr,
+                                                      "service provider disconnected");
+                    return;
+                }
+                protocol::Message message = ServiceMessage::request(id, service, *request,
+                                                                    ServiceRegistry::DEFAULT_TIMEOUT_MS);
+                target->send(MessageCodec::serialize(message));
             });
+            if (success) {
+                std::lock_guard<std::mutex> locker(instance()->mutex_);
+                instance()->service_map_[session_id].insert(service);
+            }
+        }
+
+        static void handleSub(int64_t id, const protocol::SubPayload &payload,
+                              TcpSession<WireMessage> &session) {
+            std::string topic = payload.topic();
+            std::string subscriber_name = payload.subscriber_name();
+            CodecType codec = negotiateCodec(payload);
+            int level = payload.codec_level();
+            int min_size = payload.min_compress_size() > 0 ? payload.min_compress_size()
+                                                            : CodecFactory::DEFAULT_MIN_COMPRESS_SIZE;
+            DropPolicy policy = static_cast<DropPolicy>(payload.drop_policy());
+            Ptr<FlowController> flow = flowOf(session);
+            Ptr<DeltaEncoder> delta_encoder;
+            if (payload.delta()) {
+                delta_encoder = std::make_shared<DeltaEncoder>(payload.keyframe_interval());
+            }
+            Ptr<RateLimiter> limiter;
+            if (payload.max_rate() > 0) {
+                limiter = std::make_shared<RateLimiter>(payload.max_rate());
+            }
+            long session_id = session.session_id();
+            Ptr<PeerLink> link = peerOf(session_id);
+            // HELLO comes first on a connection, so the version is settled by now
+            int version = versionOf(session_id);
+            // the topic id numbers the channel of the subscription as well
+            uint32_t topic_id = instance()->name_registry_.topicId(topic);
+            Ptr<FlowChannel> channel = flow->open(topic, topic_id, payload.priority(), version >= 4);
+            Ptr<SessionState> state;
+            if (version >= 3) {
+                state = stateOf(session);
+            }
+
+            bool success = DataBus::subscribe<ProtoMessage>(
+                    topic,
+                    subscriber_name,
+                    [topic, codec, level, min_size, policy, delta_encoder, limiter, flow, link, session_id, version,
+                            state, topic_id, channel](ConstPtr<ProtoMessage> msg) {
+                        Origin origin = instance()->origin_table_.get(topic, msg, instance()->node_id_);
+                        // never send a message back over the link it came from or to the node it came from
+                        if (link && (origin.from_session == session_id || origin.node == link->node_id)) {
+                            return;
+                        }
+                        // only messages which would be sent take a token
+                        if (limiter && !limiter->allow()) {
+                            return;
+                        }
+                        if (state) {
+                            announceNames(state->names, *flow, topic, topic_id, *msg);
+                        }
+
+                        if (delta_encoder) {
+                            // the diff depends on what this session got before, so it can't be shared
+                            Frame frame = encodeDeltaPub(topic, msg, origin, *delta_encoder, codec, level, min_size,
+                                                         version);
+                            if (!frame || flow->send(*channel, frame, policy) != FlowController::SENT) {
+                                // the client may never get this diff, start over from a keyframe
+                                delta_encoder->reset();
+                            }
+                            return;
+                        }
+
+                        // decide on the size here, so that the cached frame only depends on the encoding
+                        CodecType applied = msg->ByteSizeLong() >= static_cast<size_t>(min_size)
+                                            ? codec : CodecType::NONE;
+                        int encoding = encodingOf(version, applied, level);
+                        Frame frame = instance()->frame_cache_.get(topic, msg, encoding, [&]() {
+                            return encodePub(topic, msg, origin, applied, level, version);
+                        });
+                        if (frame) {
+                            flow->send(*channel, frame, policy);
+                        }
+                    });
+            if (success) {
+                addInterest(topic, session_id);
+                std::lock_guard<std::mutex> locker(instance()->mutex_);
+                instance()->subscription_map_[session_id].insert(std::make_pair(topic, subscriber_name));
+            } else {
+                flow->release(topic);
+            }
+
+            protocol::SubAckPayload ack_payload;
+            ack_payload.set_topic(topic);
+            ack_payload.set_subscriber_name(subscriber_name);
+            ack_payload.set_codec(static_cast<protocol::Codec>(codec));
+            if (success) {
+                ack_payload.set_result(protocol::AckResult::SUCCESS);
+            } else {
+                ack_payload.set_result(protocol::AckResult::SUB_REPEATED);
+            }
+            sendAck(session, protocol::Message_Type_SUB_ACK, ack_payload, id);
+        }
+
+        static void handleUnsub(int64_t id, const protocol::SubPayload &payload,
+                                TcpSession<WireMessage> &session) {
+            std::string topic = payload.topic();
+            std::string subscriber_name = payload.subscriber_name();
+            bool success = DataBus::unsubscribe(topic, subscriber_name);
+            if (success) {
+                flowOf(session)->release(topic);
+                removeInterest(topic, session.session_id());
+                std::lock_guard<std::mutex> locker(instance()->mutex_);
+                instance()->subscription_map_[session.session_id()].erase(std::make_pair(topic, subscriber_name));
+            }
+
+            protocol::SubAckPayload ack_payload;
+            ack_payload.set_topic(topic);
+            ack_payload.set_subscriber_name(subscriber_name);
+            if (success) {
+                ack_payload.set_result(protocol::AckResult::SUCCESS);
+            } else {
+                ack_payload.set_result(protocol::AckResult::UNSUB_NOT_FOUND);
+            }
+            sendAck(session, protocol::Message_Type_UNSUB_ACK, ack_payload, id);
+        }
+
+        // names resolves the ids of version 3 frames, null where the names are always inline
+        static void handlePub(const PubView &pub, long from_session, const ConnectionNames *names) {
+            std::string inline_topic;
+            const std::string *topic_ptr = &inline_topic;
+            const ProtoMessage *prototype = nullptr;
+            if (pub.topic_id == 0) {
+                inline_topic = pub.topic.to_string();
+            } else if (!names || !(topic_ptr = names->topic(pub.topic_id))) {
+                Logger::error("DataBusProxy", "Unknown topic id, topic_id={}, session_id={}.", pub.topic_id,
+                              from_session);
+                return;
+            }
+            const std::string &topic = *topic_ptr;
+            if (pub.type_id == 0) {
+                prototype = ProtoUtils::getPrototype(pub.data_type.to_string());
+            } else if (names) {
+                prototype = names->prototype(pub.type_id);
+            }
+            if (!prototype) {
+                Logger::error("DataBusProxy", "Unknown data type, topic={}, type_id={}.", topic, pub.type_id);
+                return;
+            }
+
+            Origin origin;
+            origin.from_session = from_session;
+            if (pub.origin.empty()) {
+                // published by a client, it enters the federation here
+                origin.node = instance()->node_id_;
+                origin.seq = instance()->origin_table_.nextSeq(topic);
+            } else {
+                origin.node = pub.origin.to_string();
+                origin.seq = pub.origin_seq;
+                if (origin.node == instance()->node_id_ ||
+                    instance()->origin_table_.isDuplicate(origin.node, topic, origin.seq)) {
+                    return;
+                }
+            }
+
+            Ptr<ProtoMessage> msg_ptr(prototype->New());
+            if (pub.codec == CodecType::NONE) {
+                msg_ptr->ParseFromArray(pub.data.data(), static_cast<int>(pub.data.size()));
+            } else {
+                std::vector<char> data;
+                if (!CodecFactory::decompress(pub.codec, pub.data.data(), pub.data.size(), data)) {
+                    Logger::error("DataBusProxy", "Can not decompress message, topic={}.", topic);
+                    return;
+                }
+                msg_ptr->ParseFromArray(data.data(), static_cast<int>(data.size()));
+            }
+            instance()->origin_table_.put(msg_ptr, origin);
 
-            instance()->tcp_server_.handler([&](protocol::Message &message, TcpSession<protocol::Message> &session) {
-                std::vector<char> packed;
-                if (message.compressed()) {
-                    ZlibUtils::decompress(message.payload(), packed);
-                } else {
-                    packed.resize(message.payload().size());
-                    packed.assign(message.payload().begin(), message.payload().end());
-                }
-
-                if (message.type() == protocol::Message_Type::Message_Type_SUB) {
-                    protocol::SubPayload payload;
-                    payload.ParseFromArray(packed.data(), packed.size());
-
-                    std::string topic = payload.topic();
-                    std::string subscriber_name = payload.subscriber_name();
-                    bool compressed = payload.compressed();
-                    bool success = DataBus::subscribe<ProtoMessage>(
-                            topic,
-                            subscriber_name,
-                            [topic, subscriber_name, compressed, &session](ConstPtr<ProtoMessage> msg) {
-                                int size = msg->ByteSize();
-                                std::vector<char> buf(size);
-                                msg->SerializeToArray(buf.data(), size);
-
-                                protocol::PubPayload pub;
-                                pub.set_topic(topic);
-                                pub.set_data_type(msg->GetTypeName());
-                                pub.set_data(buf.data(), size);
-                                int pub_size = pub.ByteSize();
-                                std::vector<char> pub_buf(pub_size);
-                                pub.SerializeToArray(pub_buf.data(), pub_size);
-
-                                protocol::Message message;
-                                message.set_compressed(compressed);
-                                message.set_type(protocol::Message_Type_PUB);
-                                if (compressed) {
-                                    std::vector<char> packed;
-                                    ZlibUtils::compress(pub_buf, packed);
-                                    message.set_payload(packed.data(), packed.size());
-                                } else {
-                                    message.set_payload(pub_buf.data(),pub_buf.size());
-                                }
-
-                                session.send(message);
-                            });
-
-                    protocol::SubAckPayload ack_payload;
-                    ack_payload.set_topic(topic);
-                    ack_payload.set_subscriber_name(subscriber_name);
-                    int payload_size = ack_payload.ByteSize();
-                    std::vector<char> payload_buf(payload_size);
-                    if (success) {
-                        ack_payload.set_result(protocol::AckResult::SUCCESS);
-                    } else {
-                        ack_payload.set_result(protocol::AckResult::SUB_REPEATED);
+            DataBus::publish<ProtoMessage>(topic, msg_ptr);
+        }
+
+        // The session closed, drop everything that refers to it: its subscriptions with their interest on the
+        // peer links, flow control, the services it advertised and the calls it made or was serving.
+        static void handleClose(TcpSession<WireMessage> &session) {
+            long session_id = session.session_id();
+            std::set<std::pair<std::string, std::string>> subscriptions;
+            std::set<std::string> services;
+            std::set<long> served_calls;
+            std::vector<long> made_calls;
+            Ptr<FlowController> flow;
+            Ptr<PeerLink> link;
+            {
+                std::lock_guard<std::mutex> locker(instance()->mutex_);
+                auto sub_it = instance()->subscription_map_.find(session_id);
+                if (sub_it != instance()->subscription_map_.end()) {
+                    subscriptions.swap(sub_it->second);
+                    instance()->subscription_map_.erase(sub_it);
+                }
+                auto service_it = instance()->service_map_.find(session_id);
+                if (service_it != instance()->service_map_.end()) {
+                    services.swap(service_it->second);
+                    instance()->service_map_.erase(service_it);
+                }
+                auto call_it = instance()->provider_calls_.find(session_id);
+                if (call_it != instance()->provider_calls_.end()) {
+                    served_calls.swap(call_it->second);
+                    instance()->provider_calls_.erase(call_it);
+                }
+                for (auto it = instance()->remote_calls_.lower_bound(std::make_pair(session_id, std::numeric_limits<int64_t>::min()));
+                     it != instance()->remote_calls_.end() && it->first.first == session_id;) {
+                    made_calls.push_back(it->second);
+                    it = instance()->remote_calls_.erase(it);
+                }
+                auto flow_it = instance()->flow_map_.find(session_id);
+                if (flow_it != instance()->flow_map_.end()) {
+                    flow = flow_it->second;
+                    instance()->flow_map_.erase(flow_it);
+                }
+                auto peer_it = instance()->peer_map_.find(session_id);
+                if (peer_it != instance()->peer_map_.end()) {
+                    link = peer_it->second;
+                    instance()->peer_map_.erase(peer_it);
+                    // a client can't be destroyed on its own io thread, it goes once the thread returned
+                    if (link->client) {
+                        instance()->closed_clients_.push_back(link->client);
                     }
-                    ack_payload.SerializeToArray(payload_buf.data(), payload_size);
-
-                    protocol::Message ack;
-                    ack.set_compressed(false);
-                    ack.set_type(protocol::Message_Type_SUB_ACK);
-                    ack.set_payload(payload_buf.data(), payload_size);
-
-                    session.send(ack);
-                } else if (message.type() == protocol::Message_Type::Message_Type_UNSUB) {
-                    protocol::SubPayload payload;
-                    payload.ParseFromArray(packed.data(), packed.size());
-
-                    std::string topic = payload.topic();
-                    std::string subscriber_name = payload.subscriber_name();
-                    bool compressed = payload.compressed();
-                    bool success = DataBus::unsubscribe(topic, subscriber_name);
-
-                    protocol::SubAckPayload ack_payload;
-                    ack_payload.set_topic(topic);
-                    ack_payload.set_subscriber_name(subscriber_name);
-                    int payload_size = ack_payload.ByteSize();
-                    std::vector<char> payload_buf(payload_size);
-                    if (success) {
-                        ack_payload.set_result(protocol::AckResult::SUCCESS);
-                    } else {
-                        ack_payload.set_result(protocol::AckResult::UNSUB_NOT_FOUND);
+                }
+                instance()->version_map_.erase(session_id);
+            }
+
+            if (flow) {
+                flow->close();
+            }
+            session.onDrain(nullptr);
+            for (auto &subscription : subscriptions) {
+                DataBus::unsubscribe(subscription.first, subscription.second);
+                removeInterest(subscription.first, session_id);
+            }
+            for (auto &service : services) {
+                ServiceRegistry::unadvertise(service);
+            }
+            for (long id : served_calls) {
+                ServiceRegistry::calls().complete(id, ServiceStatus::FAILED, nullptr, "service provider disconnected");
+            }
+            for (long id : made_calls) {
+                ServiceRegistry::calls().cancel(id);
+            }
+            Logger::info("DataBusProxy", "Session closed, session_id={}, subscriptions={}, services={}, peer={}.",
+                         session_id, subscriptions.size(), services.size(), link ? link->node_id : "");
+            releaseClosedClients();
+        }
+
+        // the clients of closed links whose io thread returned, each holds the read buffer of its session
+        static void releaseClosedClients() {
+            std::list<Ptr<TcpClient<WireMessage>>> stopped;
+            {
+                std::lock_guard<std::mutex> locker(instance()->mutex_);
+                auto &clients = instance()->closed_clients_;
+                for (auto it = clients.begin(); it != clients.end();) {
+                    auto next = std::next(it);
+                    if ((*it)->stopped()) {
+                        stopped.splice(stopped.end(), clients, it);
                     }
-                    ack_payload.SerializeToArray(payload_buf.data(), payload_size);
+                    it = next;
+                }
+            }
+        }
+
+        static void handleHello(const protocol::HelloPayload &hello, TcpSession<WireMessage> &session) {
+            int version = std::min(static_cast<int>(hello.version()), static_cast<int>(WireFormat::VERSION));
+            {
+                std::lock_guard<std::mutex> locker(instance()->mutex_);
+                instance()->version_map_[session.session_id()] = version;
+            }
+            if (!hello.reply()) {
+                sendHello(session, version, true);
+            }
+        }
+
+        // tell the session the names of the ids in the frame of the message before it is sent
+        static void announceNames(ConnectionNames &names, FlowController &flow, const std::string &topic,
+                                  uint32_t topic_id, const ProtoMessage &msg) {
+            names.announce(NameKind::TOPIC, topic_id, [&]() {
+                flow.sendControl(ConnectionNames::encodeName(NameKind::TOPIC, topic_id, topic));
+            });
+            const google::protobuf::Descriptor *descriptor = msg.GetDescriptor();
+            uint32_t type_id = instance()->name_registry_.typeId(descriptor);
+            names.announce(NameKind::DATA_TYPE, type_id, [&]() {
+                flow.sendControl(ConnectionNames::encodeName(NameKind::DATA_TYPE, type_id, descriptor->full_name()));
+            });
+        }
 
-                    protocol::Message ack;
-                    ack.set_compressed(false);
-                    ack.set_type(protocol::Message_Type_UNSUB_ACK);
-                    ack.set_payload(payload_buf.data(), payload_size);
+        // created by the io thread of the session at its first message
+        static Ptr<SessionState> stateOf(TcpSession<WireMessage> &session) {
+            Ptr<SessionState> state = std::static_pointer_cast<SessionState>(session.context());
+            if (!state) {
+                state = std::make_shared<SessionState>();
+                session.context(state);
+            }
+            return state;
+        }
+
+        // sessions that never sent HELLO only know version 1
+        static int versionOf(long session_id) {
+            std::lock_guard<std::mutex> locker(instance()->mutex_);
+            auto it = instance()->version_map_.find(session_id);
+            return it != instance()->version_map_.end() ? it->second : 1;
+        }
+
+        static void handlePeer(const protocol::PeerPayload &payload, TcpSession<WireMessage> &session) {
+            Ptr<PeerLink> link;
+            {
+                std::lock_guard<std::mutex> locker(instance()->mutex_);
+                Ptr<PeerLink> &entry = instance()->peer_map_[session.session_id()];
+                if (!entry) {
+                    // accepted link, take over the settings of the connecting proxy
+                    entry = std::make_shared<PeerLink>();
+                    entry->session = &session;
+                    entry->options.codec = static_cast<CodecType>(payload.codec());
+                    entry->options.codec_level = payload.codec_level();
+                    entry->options.max_rate = payload.max_rate();
+                }
+                entry->node_id = payload.node_id();
+                link = entry;
+            }
+            instance()->origin_table_.forget(link->node_id);
+            if (!payload.reply()) {
+                sendPeer(session, link->options, true);
+            }
+            Logger::info("DataBusProxy", "Peer linked, node_id={}, session_id={}.", link->node_id,
+                         session.session_id());
 
-                    session.send(ack);
-                } else if (message.type() == protocol::Message_Type::Message_Type_PUB) {
-                    protocol::PubPayload pub;
-                    pub.ParseFromArray(packed.data(), packed.size());
+            // subscribe to the topics wanted here so far
+            std::lock_guard<std::mutex> locker(instance()->mutex_);
+            for (auto &pair : instance()->interest_map_) {
+                updateLink(*link, pair.first);
+            }
+        }
 
-                    std::string topic = pub.topic();
-                    std::string d(packed.begin(), packed.end());
-                    Ptr<ProtoMessage> msg_ptr(ProtoUtils::createMessage(pub.data_type()));
-                    msg_ptr->ParseFromArray(pub.data().data(), pub.data().size());
+        static void addInterest(const std::string &topic, long session_id) {
+            std::lock_guard<std::mutex> locker(instance()->mutex_);
+            instance()->interest_map_[topic].insert(session_id);
+            updateLinks(topic);
+        }
 
-                    DataBus::publish<ProtoMessage>(topic, msg_ptr);
+        static void removeInterest(const std::string &topic, long session_id) {
+            std::lock_guard<std::mutex> locker(instance()->mutex_);
+            auto it = instance()->interest_map_.find(topic);
+            if (it == instance()->interest_map_.end()) {
+                return;
+            }
+            auto session_it = it->second.find(session_id);
+            if (session_it != it->second.end()) {
+                it->second.erase(session_it);
+            }
+            updateLinks(topic);
+            if (it->second.empty()) {
+                instance()->interest_map_.erase(it);
+                // nobody here forwards the topic anymore, the last frames don't need to stay cached
+                instance()->frame_cache_.remove(topic);
+            }
+        }
+
+        // subscribe or unsubscribe the topic on all links, call with mutex_ held
+        static void updateLinks(const std::string &topic) {
+            for (auto &pair : instance()->peer_map_) {
+                if (!pair.second->node_id.empty()) {
+                    updateLink(*pair.second, topic);
                 }
+            }
+        }
+
+        // the topic is wanted from a link if anybody but the link itself subscribed to it here
+        static void updateLink(PeerLink &link, const std::string &topic) {
+            bool wanted = false;
+            auto it = instance()->interest_map_.find(topic);
+            if (it != instance()->interest_map_.end()) {
+                for (long session_id : it->second) {
+                    if (session_id != link.session->session_id()) {
+                        wanted = true;
+                        break;
+                    }
+                }
+            }
+
+            bool subscribed = link.topics.count(topic) > 0;
+            if (wanted == subscribed) {
+                return;
+            }
+
+            protocol::SubPayload payload;
+            payload.set_topic(topic);
+            payload.set_subscriber_name("peer:" + instance()->node_id_);
+            payload.set_max_rate(link.options.max_rate);
+            payload.set_codec(static_cast<protocol::Codec>(link.options.codec));
+            payload.set_codec_level(link.options.codec_level);
+
+            protocol::Message message;
+            message.set_compressed(false);
+            message.set_payload(payload.SerializeAsString());
+            if (wanted) {
+                message.set_type(protocol::Message_Type_SUB);
+                link.topics.insert(topic);
+            } else {
+                message.set_type(protocol::Message_Type_UNSUB);
+                link.topics.erase(topic);
+            }
+            link.session->send(MessageCodec::serialize(message));
+        }
+
+        static Ptr<PeerLink> peerOf(long session_id) {
+            std::lock_guard<std::mutex> locker(instance()->mutex_);
+            auto it = instance()->peer_map_.find(session_id);
+            return it != instance()->peer_map_.end() ? it->second : nullptr;
+        }
+
+        static void sendHello(TcpSession<WireMessage> &session, int version, bool reply) {
+            protocol::HelloPayload payload;
+            payload.set_version(version);
+            payload.set_reply(reply);
+            sendAck(session, protocol::Message_Type_HELLO, payload);
+        }
+
+        static void sendPeer(TcpSession<WireMessage> &session, const LinkOptions &options, bool reply) {
+            protocol::PeerPayload payload;
+            payload.set_node_id(instance()->node_id_);
+            payload.set_codec(static_cast<protocol::Codec>(options.codec));
+            payload.set_codec_level(options.codec_level);
+            payload.set_max_rate(options.max_rate);
+            payload.set_reply(reply);
+            sendAck(session, protocol::Message_Type_PEER, payload);
+        }
+
+        // id echoes the id of the request, so that clients can match the ack
+        static void sendAck(TcpSession<WireMessage> &session, protocol::Message_Type type,
+                            const ProtoMessage &payload, int64_t id = 0) {
+            protocol::Message message;
+            message.set_compressed(false);
+            message.set_type(type);
+            message.set_id(id);
+            message.set_payload(payload.SerializeAsString());
+
+            session.send(MessageCodec::serialize(message));
+        }
+
+        static Ptr<FlowController> flowOf(TcpSession<WireMessage> &session) {
+            std::lock_guard<std::mutex> locker(instance()->mutex_);
+            Ptr<FlowController> &flow = instance()->flow_map_[session.session_id()];
+            if (!flow) {
+                flow = std::make_shared<FlowController>(session, instance()->max_queued_bytes_);
+                Ptr<FlowController> drained = flow;
+                session.onDrain([drained]() { drained->flush(); });
+            }
+            return flow;
+        }
+
+        // the codec requested by the subscriber, NONE when it is not compiled in
+        static CodecType negotiateCodec(const protocol::SubPayload &payload) {
+            CodecType codec = static_cast<CodecType>(payload.codec());
+            if (codec == CodecType::NONE && payload.compressed()) {
+                codec = CodecType::ZLIB;
+            }
+            if (!CodecFactory::isSupported(codec)) {
+                // acked as NONE, see SubAckPayload.codec
+                Logger::warn("DataBusProxy", "Codec is not supported, send uncompressed, topic={}, codec={}.",
+                             payload.topic(), static_cast<int>(codec));
+                codec = CodecType::NONE;
+            }
+            return codec;
+        }
+
+        // the serialized message, shared by all encodings and delta subscriptions of the topic
+        static Frame serializeData(const std::string &topic, const ConstPtr<ProtoMessage> &msg) {
+            return instance()->frame_cache_.get(topic, msg, RAW_ENCODING, [&]() {
+                std::size_t size = msg->ByteSizeLong();
+                std::shared_ptr<std::vector<char>> data = std::make_shared<std::vector<char>>(size);
+                msg->SerializeToArray(data->data(), static_cast<int>(size));
+                return data;
             });
+        }
 
-            instance()->tcp_server_.listen(port);
-        };
+        // frame cache key of a PUB frame
+        static int encodingOf(int version, CodecType codec, int level) {
+            return (version << 16) | (static_cast<int>(codec) << 8) | (level & 0xff);
+        }
 
-    private:
-        static DataBusProxy *instance() {
-            static DataBusProxy instance;
-            return &instance;
+        // the names of a PUB frame, ids from version 3 on, data_type holds the inline type name
+        static PubView pubOf(const std::string &topic, const ProtoMessage &msg, int version, std::string &data_type) {
+            PubView pub;
+            if (version >= 3) {
+                pub.topic_id = instance()->name_registry_.topicId(topic);
+                pub.type_id = instance()->name_registry_.typeId(msg.GetDescriptor());
+            } else {
+                data_type = msg.GetTypeName();
+                pub.topic = topic;
+                pub.data_type = data_type;
+            }
+            return pub;
+        }
+
+        // serialize the message into a complete wire frame of a PUB message, null if it can't be encoded
+        static Frame encodePub(const std::string &topic, const ConstPtr<ProtoMessage> &msg, const Origin &origin,
+                               CodecType codec, int level, int version) {
+            Frame data = serializeData(topic, msg);
+            if (version >= 2) {
+                std::string data_type;
+                PubView pub = pubOf(topic, *msg, version, data_type);
+                pub.origin = origin.node;
+                pub.origin_seq = origin.seq;
+                return WireFormat::encodePub(pub, data->data(), data->size(), codec, level, 0);
+            }
+
+            protocol::PubPayload pub;
+            pub.set_topic(topic);
+            pub.set_data_type(msg->GetTypeName());
+            pub.set_data(data->data(), data->size());
+            pub.set_origin(origin.node);
+            pub.set_origin_seq(origin.seq);
+            std::string pub_buf = pub.SerializeAsString();
+
+            protocol::Message message;
+            message.set_type(protocol::Message_Type_PUB);
+            MessageCodec::setPayload(message, pub_buf.data(), pub_buf.size(), codec, level, 0);
+            return MessageCodec::serialize(message);
+        }
+
+        // PUB frame holding a diff against the last message sent to the subscriber, or a keyframe
+        static Frame encodeDeltaPub(const std::string &topic, const ConstPtr<ProtoMessage> &msg, const Origin &origin,
+                                    DeltaEncoder &encoder, CodecType codec, int level, int min_size, int version) {
+            Frame data = serializeData(topic, msg);
+
+            std::vector<char> delta;
+            uint64_t seq;
+            uint64_t base_seq;
+            bool is_delta = encoder.encode(data, delta, seq, base_seq);
+            if (version >= 2) {
+                std::string data_type;
+                PubView pub = pubOf(topic, *msg, version, data_type);
+                pub.delta = is_delta;
+                pub.seq = seq;
+                pub.base_seq = base_seq;
+                pub.origin = origin.node;
+                pub.origin_seq = origin.seq;
+                return is_delta ? WireFormat::encodePub(pub, delta.data(), delta.size(), codec, level, min_size)
+                                : WireFormat::encodePub(pub, data->data(), data->size(), codec, level, min_size);
+            }
+
+            protocol::PubPayload pub;
+            pub.set_topic(topic);
+            pub.set_data_type(msg->GetTypeName());
+            if (is_delta) {
+                pub.set_data(delta.data(), delta.size());
+            } else {
+                pub.set_data(data->data(), data->size());
+            }
+            pub.set_delta(is_delta);
+            pub.set_seq(seq);
+            pub.set_base_seq(base_seq);
+            pub.set_origin(origin.node);
+            pub.set_origin_seq(origin.seq);
+            std::string pub_buf = pub.SerializeAsString();
+
+            protocol::Message message;
+            message.set_type(protocol::Message_Type_PUB);
+            MessageCodec::setPayload(message, pub_buf.data(), pub_buf.size(), codec, level, min_size);
+            return MessageCodec::serialize(message);
         }
 
     private:
-        TcpServer<protocol::Message> tcp_server_;
+        // frame cache key of the serialized message without any envelope
+        enum {
+            RAW_ENCODING = -1
+        };
+
+        // multicast frames keep the names inline, there is no connection to announce ids on
+        enum {
+            MULTICAST_VERSION = 2
+        };
+
+        // pseudo sessions: interest of the subscribers in this process, messages received by multicast
+        enum {
+            LOCAL_SESSION = 0,
+            MULTICAST_SESSION = -1
+        };
+
+        static const std::size_t DEFAULT_MAX_QUEUED_BYTES = 64 * 1024 * 1024;
+
+        TcpServer<WireMessage> tcp_server_;
+        FrameCache frame_cache_;
+        OriginTable origin_table_;
+        NameRegistry name_registry_;
+        std::string node_id_;
+
+        std::size_t max_queued_bytes_{DEFAULT_MAX_QUEUED_BYTES};
+        std::mutex mutex_;
+        std::map<long, Ptr<FlowController>> flow_map_;
+        std::map<long, Ptr<PeerLink>> peer_map_;
+        // wire version of each session, agreed on with HELLO
+        std::map<long, int> version_map_;
+        // sessions subscribed to each topic, a session appears once per subscription
+        std::map<std::string, std::multiset<long>> interest_map_;
+        std::list<Ptr<MulticastSender>> multicast_senders_;
+        std::list<Ptr<MulticastReceiver>> multicast_receivers_;
+        // table ids of the calls of remote clients by (session id, caller id), to cancel them
+        std::map<std::pair<long, int64_t>, long> remote_calls_;
+        // what each session set up here, undone when it closes
+        std::map<long, std::set<std::pair<std::string, std::string>>> subscription_map_;
+        std::map<long, std::set<std::string>> service_map_;
+        // table ids of the calls forwarded to each session serving a service
+        std::map<long, std::set<long>> provider_calls_;
+        std::list<Ptr<TcpClient<WireMessage>>> closed_clients_;
     };
 }
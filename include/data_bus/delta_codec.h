@@ -0,0 +1,192 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <algorithm>
+
+#include "frame_cache.h"
+
+namespace data_bus {
+
+    // Binary diff of two byte arrays: the new size followed by records of (zero run, literal length, literal),
+    // where the literals are the XOR of the new bytes with the base. Unchanged ranges cost only their varint
+    // run length, so a grid where a few cells changed encodes into a few bytes.
+    class DeltaCodec {
+    public:
+        static void encode(const char *base, size_t base_size, const char *data, size_t size,
+                           std::vector<char> &out) {
+            out.clear();
+            writeVarint(size, out);
+
+            size_t pos = 0;
+            while (pos < size) {
+                size_t run_start = pos;
+                while (pos < size && xorAt(base, base_size, data, pos) == 0) {
+                    pos++;
+                }
+                if (pos == size) {
+                    break;
+                }
+                size_t zero_run = pos - run_start;
+
+                // extend the literal over short zero runs, a new record would cost more than the zeros
+                size_t literal_start = pos;
+                size_t zeros = 0;
+                while (pos < size && zeros < MIN_ZERO_RUN) {
+                    zeros = xorAt(base, base_size, data, pos) == 0 ? zeros + 1 : 0;
+                    pos++;
+                }
+                size_t literal_end = pos - zeros;
+                pos = literal_end;
+
+                writeVarint(zero_run, out);
+                writeVarint(literal_end - literal_start, out);
+                for (size_t i = literal_start; i < literal_end; i++) {
+                    out.push_back(xorAt(base, base_size, data, i));
+                }
+            }
+        }
+
+        // apply the delta onto base, returns false if the delta is malformed
+        static bool decode(const std::vector<char> &base, const char *delta, size_t delta_size,
+                           std::vector<char> &out) {
+            size_t offset = 0;
+            uint64_t size;
+            // bytes past the base are carried as literals, so a valid delta can't grow the message by more than
+            // its own size
+            if (!readVarint(delta, delta_size, offset, size) || size > base.size() + delta_size) {
+                return false;
+            }
+            out.assign(base.begin(), base.begin() + std::min<size_t>(base.size(), size));
+            out.resize(size, 0);
+
+            size_t pos = 0;
+            while (offset < delta_size) {
+                uint64_t zero_run;
+                uint64_t literal_size;
+                if (!readVarint(delta, delta_size, offset, zero_run) ||
+                    !readVarint(delta, delta_size, offset, literal_size)) {
+                    return false;
+                }
+                pos += zero_run;
+                if (pos + literal_size > size || offset + literal_size > delta_size) {
+                    return false;
+                }
+                for (size_t i = 0; i < literal_size; i++) {
+                    out[pos + i] ^= delta[offset + i];
+                }
+                pos += literal_size;
+                offset += literal_size;
+            }
+            return true;
+        }
+
+    private:
+        enum {
+            MIN_ZERO_RUN = 4
+        };
+
+        static char xorAt(const char *base, size_t base_size, const char *data, size_t pos) {
+            return pos < base_size ? static_cast<char>(base[pos] ^ data[pos]) : data[pos];
+        }
+
+        static void writeVarint(uint64_t value, std::vector<char> &out) {
+            while (value >= 0x80) {
+                out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+                value >>= 7;
+            }
+            out.push_back(static_cast<char>(value));
+        }
+
+        static bool readVarint(const char *in, size_t size, size_t &offset, uint64_t &value) {
+            value = 0;
+            for (int shift = 0; shift < 64 && offset < size; shift += 7) {
+                uint8_t byte = static_cast<uint8_t>(in[offset++]);
+                value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+                if ((byte & 0x80) == 0) {
+                    return true;
+                }
+            }
+            return false;
+        }
+    };
+
+    // Sender side state of one delta subscription, keeps the last sent message bytes.
+    class DeltaEncoder {
+    public:
+        static const int DEFAULT_KEYFRAME_INTERVAL = 30;
+
+        explicit DeltaEncoder(int keyframe_interval) : keyframe_interval_(keyframe_interval) {
+            if (keyframe_interval_ <= 0) {
+                keyframe_interval_ = DEFAULT_KEYFRAME_INTERVAL;
+            }
+        }
+
+        // Encode data as a delta against the last sent message when possible. Returns true if delta holds
+        // a diff based on base_seq, false if the full data has to be sent as a keyframe.
+        bool encode(const Frame &data, std::vector<char> &delta, uint64_t &seq, uint64_t &base_seq) {
+            base_seq = seq_;
+            seq = ++seq_;
+            bool keyframe = !last_ || frames_since_keyframe_ + 1 >= keyframe_interval_;
+            if (!keyframe) {
+                DeltaCodec::encode(last_->data(), last_->size(), data->data(), data->size(), delta);
+                // a big change is cheaper to send in full
+                keyframe = delta.size() * 2 > data->size();
+            }
+            // the frame is immutable and shared, no need to copy it
+            last_ = data;
+            if (keyframe) {
+                frames_since_keyframe_ = 0;
+                delta.clear();
+                return false;
+            }
+            frames_since_keyframe_++;
+            return true;
+        }
+
+        // force a keyframe, e.g. after a frame was dropped
+        void reset() {
+            last_.reset();
+        }
+
+    private:
+        int keyframe_interval_;
+        int frames_since_keyframe_{0};
+        uint64_t seq_{0};
+        Frame last_;
+    };
+
+    // Receiver side state of one delta subscription, rebuilds full messages from keyframes and deltas.
+    class DeltaDecoder {
+    public:
+        // returns false if the delta doesn't apply to the last received message, out is left empty then
+        bool decode(bool delta, uint64_t seq, uint64_t base_seq, const char *data, size_t size,
+                    std::vector<char> &out) {
+            out.clear();
+            if (!delta) {
+                last_.assign(data, data + size);
+                seq_ = seq;
+                has_base_ = true;
+                out = last_;
+                return true;
+            }
+            if (!has_base_ || base_seq != seq_) {
+                return false;
+            }
+            if (!DeltaCodec::decode(last_, data, size, out)) {
+                return false;
+            }
+            last_ = out;
+            seq_ = seq;
+            return true;
+        }
+
+    private:
+        uint64_t seq_{0};
+        // a keyframe arrived, the last message may be empty
+        bool has_base_{false};
+        std::vector<char> last_;
+    };
+
+}
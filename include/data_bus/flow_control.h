@@ -0,0 +1,333 @@
+#pragma once
+
+#include <chrono>
+#include <algorithm>
+#include <map>
+#include <deque>
+#include <vector>
+#include <mutex>
+
+#include "frame_cache.h"
+#include "wire_format.h"
+#include "queue_stat.h"
+#include "subscribe_options.h"
+#include "tcp_tool/tcp_session.h"
+
+namespace data_bus {
+
+    using namespace tcp_tool;
+
+    // The PUB frames of one subscription within a session.
+    struct FlowChannel {
+        std::string topic;
+        // number of the channel in CHUNK frames
+        uint32_t id{0};
+        int priority{1};
+        // the session reads CHUNK frames, so frames larger than a chunk are cut
+        bool chunked{false};
+        // waiting for room, latest wins replaces it
+        Frame pending;
+        // frames accepted for sending, and the bytes of the first one handed to the session so far
+        std::deque<Frame> ready;
+        std::size_t offset{0};
+        // virtual time the channel is due at, grows by the bytes sent divided by the priority
+        double pass{0};
+        // subscriptions of the session sending on the channel, it is removed after the last one
+        int subscriptions{0};
+    };
+
+    // Credit based flow control of the PUB frames sent to one remote session. The client grants credit in
+    // bytes with CREDIT messages and returns it as it reads. Clients which never grant credit are only
+    // limited by max_queued_bytes of the session write queue. Without room the subscription's drop policy
+    // applies instead of queueing without bound.
+    //
+    // Accepted frames don't go to the session write queue at once. A scheduler hands them over a chunk at a
+    // time, picking the channel with the smallest virtual time, so a large frame of one subscription delays
+    // the frames of the others by about a chunk, and backlogged channels share the connection by priority.
+    class FlowController {
+    public:
+        enum Result {
+            SENT,
+            PENDING,
+            DROPPED
+        };
+
+        enum {
+            CHUNK_SIZE = 64 * 1024
+        };
+
+        FlowController(TcpSession<WireMessage> &session, std::size_t max_queued_bytes)
+                : session_(session), max_queued_bytes_(max_queued_bytes) {
+        }
+
+        // the channel of the topic, a subscription of the topic again takes over the channel, every open is
+        // matched by a release
+        Ptr<FlowChannel> open(const std::string &topic, uint32_t id, int priority, bool chunked) {
+            std::lock_guard<std::mutex> locker(mutex_);
+            Ptr<FlowChannel> &channel = channels_[topic];
+            if (!channel) {
+                channel = std::make_shared<FlowChannel>();
+                channel->topic = topic;
+            }
+            channel->id = id;
+            channel->priority = std::max(priority, 1);
+            channel->chunked = chunked;
+            channel->subscriptions++;
+            return channel;
+        }
+
+        // A subscription of the topic ended or never started. With the last one the frames waiting on the
+        // channel are dropped and their credit is given back, only a frame cut into chunks halfway is finished,
+        // so that the client doesn't join the rest of it to the next frame of the channel.
+        void release(const std::string &topic) {
+            std::lock_guard<std::mutex> locker(mutex_);
+            auto it = channels_.find(topic);
+            if (it == channels_.end()) {
+                return;
+            }
+            FlowChannel &channel = *it->second;
+            if (--channel.subscriptions > 0) {
+                return;
+            }
+            if (channel.pending) {
+                drop(channel.pending);
+                channel.pending.reset();
+            }
+            while (channel.ready.size() > (channel.offset > 0 ? 1 : 0)) {
+                const Frame &frame = channel.ready.back();
+                credit_ += frame->size();
+                sent_count_--;
+                sent_bytes_ -= frame->size();
+                ready_bytes_ -= frame->size();
+                drop(frame);
+                channel.ready.pop_back();
+            }
+            if (channel.ready.empty()) {
+                channels_.erase(it);
+            }
+        }
+
+        // SENT means accepted, it may still be waiting for the frames of other channels
+        Result send(FlowChannel &channel, const Frame &frame, DropPolicy policy) {
+            std::lock_guard<std::mutex> locker(mutex_);
+            // the subscriber thread may still deliver a message after the channel was released
+            if (closed_ || channel.subscriptions == 0) {
+                return DROPPED;
+            }
+            if (!channel.pending && hasRoom(frame->size())) {
+                accept(channel, frame);
+                pump();
+                return SENT;
+            }
+
+            if (policy == DropPolicy::DROP_NEWEST) {
+                drop(frame);
+                return DROPPED;
+            }
+            // latest wins, the older pending frame of the topic is replaced
+            if (channel.pending) {
+                drop(channel.pending);
+            }
+            channel.pending = frame;
+            return PENDING;
+        }
+
+        // a control message ahead of the queued frames, outside of flow control
+        void sendControl(const Frame &frame) {
+            std::lock_guard<std::mutex> locker(mutex_);
+            if (!closed_) {
+                session_.send(frame);
+            }
+        }
+
+        // The session closed, later calls don't touch it anymore and the queued frames are released.
+        // Subscriber threads may still hold the controller for a while.
+        void close() {
+            std::lock_guard<std::mutex> locker(mutex_);
+            closed_ = true;
+            channels_.clear();
+            ready_bytes_ = 0;
+        }
+
+        // CREDIT from the client, the first grant is the window and enables credit checks
+        void grant(int64_t bytes) {
+            {
+                std::lock_guard<std::mutex> locker(mutex_);
+                if (!limited_) {
+                    limited_ = true;
+                    window_ = bytes;
+                    credit_ = bytes;
+                } else {
+                    credit_ += bytes;
+                }
+            }
+            flush();
+        }
+
+        // send pending frames while there is room, called on credit and when the write queue drains
+        void flush() {
+            std::lock_guard<std::mutex> locker(mutex_);
+            if (closed_) {
+                return;
+            }
+            // in stride order, and a frame without room doesn't hold back the smaller ones of other channels
+            std::vector<FlowChannel *> pending;
+            for (auto &pair : channels_) {
+                if (pair.second->pending) {
+                    pending.push_back(pair.second.get());
+                }
+            }
+            std::sort(pending.begin(), pending.end(), [](const FlowChannel *a, const FlowChannel *b) {
+                return a->pass < b->pass;
+            });
+            for (FlowChannel *channel : pending) {
+                if (!hasRoom(channel->pending->size())) {
+                    continue;
+                }
+                accept(*channel, channel->pending);
+                channel->pending.reset();
+            }
+            pump();
+        }
+
+        SessionStat getSessionStat() {
+            std::lock_guard<std::mutex> locker(mutex_);
+            SessionStat stat;
+            stat.session_id = session_.session_id();
+            stat.queue_size = static_cast<int>(session_.writeQueueSize());
+            stat.queued_bytes = session_.writeQueueBytes() + ready_bytes_;
+            stat.pending_count = 0;
+            for (auto &pair : channels_) {
+                if (pair.second->pending) {
+                    stat.pending_count++;
+                }
+            }
+            stat.credit = limited_ ? credit_ : -1;
+            stat.sent_count = sent_count_;
+            stat.sent_bytes = sent_bytes_;
+            stat.dropped_count = dropped_count_;
+            stat.dropped_bytes = dropped_bytes_;
+            return stat;
+        }
+
+    private:
+        bool hasRoom(std::size_t size) {
+            std::size_t queued = session_.writeQueueBytes() + ready_bytes_;
+            // a frame larger than the limit still goes out once the queue is empty
+            if (queued > 0 && queued + size > max_queued_bytes_) {
+                return false;
+            }
+            // the client holds back less than half a window of credit, so a frame larger than the credit
+            // goes out once half the window is free, otherwise it could wait forever
+            return !limited_ || credit_ >= static_cast<int64_t>(size) || credit_ > window_ / 2;
+        }
+
+        void accept(FlowChannel &channel, const Frame &frame) {
+            credit_ -= frame->size();
+            sent_count_++;
+            sent_bytes_ += frame->size();
+            // a channel that was idle doesn't get to catch up on the time it had nothing to send
+            if (channel.ready.empty()) {
+                channel.pass = std::max(channel.pass, virtual_time_);
+            }
+            channel.ready.push_back(frame);
+            ready_bytes_ += frame->size();
+        }
+
+        // hand frames or chunks of them to the session while its write queue is shorter than a chunk,
+        // call with mutex_ held
+        void pump() {
+            while (session_.writeQueueBytes() < CHUNK_SIZE) {
+                FlowChannel *next = nullptr;
+                for (auto &pair : channels_) {
+                    FlowChannel *channel = pair.second.get();
+                    if (!channel->ready.empty() && (!next || channel->pass < next->pass)) {
+                        next = channel;
+                    }
+                }
+                if (!next) {
+                    return;
+                }
+                virtual_time_ = next->pass;
+
+                const Frame &frame = next->ready.front();
+                std::size_t size = frame->size() - next->offset;
+                if (!next->chunked || (next->offset == 0 && size <= CHUNK_SIZE)) {
+                    session_.send(frame);
+                } else {
+                    size = std::min<std::size_t>(size, CHUNK_SIZE);
+                    bool last = next->offset + size == frame->size();
+                    session_.send(WireFormat::encodeChunk(next->id, last, frame->data() + next->offset, size));
+                    // the client returns credit for the chunk headers too
+                    credit_ -= WireFormat::LENGTH_SIZE + WireFormat::CHUNK_HEADER_SIZE;
+                }
+                next->offset += size;
+                next->pass += static_cast<double>(size) / next->priority;
+                ready_bytes_ -= size;
+                if (next->offset == frame->size()) {
+                    next->ready.pop_front();
+                    next->offset = 0;
+                    if (next->ready.empty() && next->subscriptions == 0) {
+                        std::string topic = next->topic;
+                        channels_.erase(topic);
+                    }
+                }
+            }
+        }
+
+        void drop(const Frame &frame) {
+            dropped_count_++;
+            dropped_bytes_ += frame->size();
+        }
+
+    private:
+        TcpSession<WireMessage> &session_;
+        std::size_t max_queued_bytes_;
+
+        std::mutex mutex_;
+        bool closed_{false};
+        bool limited_{false};
+        int64_t window_{0};
+        int64_t credit_{0};
+        std::map<std::string, Ptr<FlowChannel>> channels_;
+        // bytes accepted but not handed to the session yet
+        std::size_t ready_bytes_{0};
+        double virtual_time_{0};
+
+        std::size_t sent_count_{0};
+        std::size_t sent_bytes_{0};
+        std::size_t dropped_count_{0};
+        std::size_t dropped_bytes_{0};
+    };
+
+    // Limits the messages of one subscription to max_rate per second on average, with bursts of up to a
+    // second's worth, so that messages of several publishers arriving at once are not thinned out.
+    // Used by a single worker thread.
+    class RateLimiter {
+    public:
+        explicit RateLimiter(int max_rate) : max_rate_(max_rate), tokens_(max_rate) {
+        }
+
+        bool allow() {
+            auto now = std::chrono::steady_clock::now();
+            if (started_) {
+                double elapsed = std::chrono::duration<double>(now - last_).count();
+                tokens_ = std::min<double>(max_rate_, tokens_ + elapsed * max_rate_);
+            }
+            started_ = true;
+            last_ = now;
+            if (tokens_ < 1) {
+                return false;
+            }
+            tokens_ -= 1;
+            return true;
+        }
+
+    private:
+        int max_rate_;
+        double tokens_;
+        bool started_{false};
+        std::chrono::steady_clock::time_point last_{};
+    };
+
+}
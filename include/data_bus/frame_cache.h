@@ -0,0 +1,84 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <vector>
+#include <atomic>
+#include <functional>
+
+#include "subscriber.h"
+
+namespace data_bus {
+
+    // encoded wire bytes, shared by every session that sends the same message
+    using Frame = std::shared_ptr<const std::vector<char>>;
+
+    // Memoizes the last encoded frame of each topic, keyed by encoding. All remote subscribers of a topic
+    // receive the same message pointer from Publisher, so the first one to ask builds the frame and the
+    // others reuse it instead of serializing and compressing again.
+    class FrameCache {
+    public:
+        using Builder = std::function<Frame()>;
+
+        Frame get(const std::string &topic, const ConstPtr<ProtoMessage> &message, int encoding,
+                  const Builder &builder) {
+            Ptr<Entry> entry = getEntry(topic);
+
+            std::lock_guard<std::recursive_mutex> locker(entry->mutex);
+            if (entry->message != message) {
+                // keep the message alive so that its address can't be reused by a newer one
+                entry->message = message;
+                entry->frames.clear();
+            }
+
+            auto it = entry->frames.find(encoding);
+            if (it != entry->frames.end()) {
+                hit_count_++;
+                return it->second;
+            }
+
+            miss_count_++;
+            Frame frame = builder();
+            entry->frames[encoding] = frame;
+            return frame;
+        }
+
+        void remove(const std::string &topic) {
+            std::lock_guard<std::mutex> locker(mutex_);
+            entries_.erase(topic);
+        }
+
+        std::size_t hitCount() const {
+            return static_cast<std::size_t>(hit_count_);
+        }
+
+        std::size_t missCount() const {
+            return static_cast<std::size_t>(miss_count_);
+        }
+
+    private:
+        struct Entry {
+            // builders may ask for another encoding of the same message, e.g. the serialized data
+            std::recursive_mutex mutex;
+            ConstPtr<ProtoMessage> message;
+            std::map<int, Frame> frames;
+        };
+
+        Ptr<Entry> getEntry(const std::string &topic) {
+            std::lock_guard<std::mutex> locker(mutex_);
+            Ptr<Entry> &entry = entries_[topic];
+            if (!entry) {
+                entry = std::make_shared<Entry>();
+            }
+            return entry;
+        }
+
+    private:
+        std::mutex mutex_;
+        std::map<std::string, Ptr<Entry>> entries_;
+
+        std::atomic_long hit_count_{0};
+        std::atomic_long miss_count_{0};
+    };
+
+}
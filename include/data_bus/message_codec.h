@@ -0,0 +1,66 @@
+#pragma once
+
+#include "frame_cache.h"
+#include "Protocol.pb.h"
+#include "util/codec.h"
+#include "util/logger.h"
+
+namespace data_bus {
+
+    using namespace util;
+
+    // Packs payloads into protocol::Message with the codec negotiated for the subscription and back.
+    class MessageCodec {
+    public:
+        static CodecType codecOf(const protocol::Message &message) {
+            if (message.codec() != protocol::NONE) {
+                return static_cast<CodecType>(message.codec());
+            }
+            // older peers only know the compressed flag, which means zlib
+            return message.compressed() ? CodecType::ZLIB : CodecType::NONE;
+        }
+
+        // returns the codec that was actually applied to the payload
+        static CodecType setPayload(protocol::Message &message, const char *data, size_t size, CodecType codec,
+                                    int level = 0, int min_size = CodecFactory::DEFAULT_MIN_COMPRESS_SIZE) {
+            std::vector<char> packed;
+            CodecType applied = CodecFactory::compress(codec, level, data, size, packed, min_size);
+            if (applied == CodecType::NONE) {
+                message.set_payload(data, size);
+            } else {
+                message.set_payload(packed.data(), packed.size());
+            }
+            message.set_codec(static_cast<protocol::Codec>(applied));
+            message.set_compressed(applied == CodecType::ZLIB);
+            return applied;
+        }
+
+        static bool getPayload(const protocol::Message &message, std::vector<char> &out) {
+            return CodecFactory::decompress(codecOf(message), message.payload().data(), message.payload().size(),
+                                            out);
+        }
+
+        // Messages on a stream are prefixed with their size, 4 bytes little endian, so that messages arriving
+        // in one read can be told apart. WireFormat reads them back.
+        static void encode(const protocol::Message &message, std::vector<char> &out) {
+            uint32_t size = static_cast<uint32_t>(message.ByteSizeLong());
+            out.resize(LENGTH_SIZE + size);
+            for (int i = 0; i < LENGTH_SIZE; i++) {
+                out[i] = static_cast<char>((size >> (8 * i)) & 0xff);
+            }
+            message.SerializeToArray(out.data() + LENGTH_SIZE, static_cast<int>(size));
+        }
+
+        static Frame serialize(const protocol::Message &message) {
+            std::shared_ptr<std::vector<char>> frame = std::make_shared<std::vector<char>>();
+            encode(message, *frame);
+            return frame;
+        }
+
+    private:
+        enum {
+            LENGTH_SIZE = 4
+        };
+    };
+
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <utility>
+#include <type_traits>
+
+namespace data_bus {
+
+    // Traits of message_filters (tests/message_traits.h) for protobuf messages, which have a header()
+    // accessor instead of a header member. Specialize TimeStamp for messages without a header.
+    namespace message_traits {
+
+        template<typename M, typename = void>
+        struct HasHeader : public std::false_type {
+        };
+
+        template<typename M>
+        struct HasHeader<M, decltype((void) std::declval<const M &>().header())> : std::true_type {
+        };
+
+        template<typename M, typename Enable = void>
+        struct FrameId {
+            static std::string value(const M &m) {
+                (void) m;
+                return std::string();
+            }
+        };
+
+        template<typename M>
+        struct FrameId<M, typename std::enable_if<HasHeader<M>::value>::type> {
+            static std::string value(const M &m) {
+                return m.header().frame_id();
+            }
+        };
+
+        // nanoseconds of the message stamp
+        template<typename M, typename Enable = void>
+        struct TimeStamp {
+            static_assert(HasHeader<M>::value, "message has no header, specialize TimeStamp for it");
+        };
+
+        template<typename M>
+        struct TimeStamp<M, typename std::enable_if<HasHeader<M>::value>::type> {
+            static int64_t value(const M &m) {
+                return m.header().stamp();
+            }
+        };
+
+    }
+
+}
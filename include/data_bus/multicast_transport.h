@@ -0,0 +1,373 @@
+#pragma once
+
+#include <map>
+#include <array>
+#include <mutex>
+#include <thread>
+#include <random>
+#include <cstring>
+#include <stdexcept>
+#include <functional>
+#include <boost/asio.hpp>
+
+#include "frame_cache.h"
+#include "subscribe_options.h"
+#include "util/logger.h"
+
+namespace data_bus {
+
+    using namespace util;
+    using udp = boost::asio::ip::udp;
+
+    // loss statistics of a multicast sender or receiver
+    struct MulticastStat {
+        std::string group{};
+        unsigned short port{0};
+        std::size_t message_count{0};
+        std::size_t fragment_count{0};
+        std::size_t bytes{0};
+        // receiver only: messages never completed, arrived after a newer one, or with missing fragments
+        std::size_t lost_count{0};
+        std::size_t late_count{0};
+        std::size_t incomplete_count{0};
+
+        std::string toString() {
+            return "{group=" + group +
+                   ", port=" + std::to_string(port) +
+                   ", message_count=" + std::to_string(message_count) +
+                   ", fragment_count=" + std::to_string(fragment_count) +
+                   ", bytes=" + std::to_string(bytes) +
+                   ", lost_count=" + std::to_string(lost_count) +
+                   ", late_count=" + std::to_string(late_count) +
+                   ", incomplete_count=" + std::to_string(incomplete_count) + "}";
+        }
+    };
+
+    // settings of a topic sent by multicast
+    struct MulticastOptions {
+        // address of the local interface to send and join on, e.g. 127.0.0.1 for loopback tests
+        std::string interface{"0.0.0.0"};
+        int ttl{1};
+        std::size_t max_datagram{1400};
+        CodecType codec{CodecType::NONE};
+        int codec_level{0};
+    };
+
+    // Header of every datagram, little endian. A frame larger than a datagram is split into count fragments
+    // which share the sender id and sequence number.
+    struct FragmentHeader {
+        enum {
+            SIZE = 24,
+            MAGIC = 0x434d4244 // "DBMC"
+        };
+
+        uint32_t sender{0};
+        uint32_t seq{0};
+        uint16_t index{0};
+        uint16_t count{0};
+        uint32_t total_size{0};
+        // offset of the fragment in the frame
+        uint32_t offset{0};
+
+        void write(char *out) const {
+            writeU32(out, MAGIC);
+            writeU32(out + 4, sender);
+            writeU32(out + 8, seq);
+            writeU16(out + 12, index);
+            writeU16(out + 14, count);
+            writeU32(out + 16, total_size);
+            writeU32(out + 20, offset);
+        }
+
+        bool read(const char *in, std::size_t size) {
+            if (size < SIZE || readU32(in) != MAGIC) {
+                return false;
+            }
+            sender = readU32(in + 4);
+            seq = readU32(in + 8);
+            index = readU16(in + 12);
+            count = readU16(in + 14);
+            total_size = readU32(in + 16);
+            offset = readU32(in + 20);
+            return count > 0 && index < count;
+        }
+
+    private:
+        static void writeU16(char *out, uint16_t value) {
+            out[0] = static_cast<char>(value & 0xff);
+            out[1] = static_cast<char>(value >> 8);
+        }
+
+        static void writeU32(char *out, uint32_t value) {
+            for (int i = 0; i < 4; i++) {
+                out[i] = static_cast<char>((value >> (8 * i)) & 0xff);
+            }
+        }
+
+        static uint16_t readU16(const char *in) {
+            return static_cast<uint16_t>(static_cast<uint8_t>(in[0]) | (static_cast<uint8_t>(in[1]) << 8));
+        }
+
+        static uint32_t readU32(const char *in) {
+            uint32_t value = 0;
+            for (int i = 0; i < 4; i++) {
+                value |= static_cast<uint32_t>(static_cast<uint8_t>(in[i])) << (8 * i);
+            }
+            return value;
+        }
+    };
+
+    // Best effort sender of encoded frames to a multicast group. The cost of a send only depends on the
+    // frame size, however many hosts joined the group.
+    class MulticastSender {
+    public:
+        // max_datagram is the payload of the UDP datagrams, the default fits an ethernet MTU
+        MulticastSender(const std::string &group, unsigned short port, const MulticastOptions &options)
+                : socket_(ioc_), endpoint_(boost::asio::ip::make_address(group), port) {
+            if (options.max_datagram <= FragmentHeader::SIZE) {
+                throw std::invalid_argument("max_datagram must be larger than the fragment header, max_datagram=" +
+                                            std::to_string(options.max_datagram));
+            }
+            max_payload_ = options.max_datagram - FragmentHeader::SIZE;
+            std::random_device random;
+            sender_ = random();
+
+            socket_.open(endpoint_.protocol());
+            socket_.set_option(boost::asio::ip::multicast::hops(options.ttl));
+            // receivers on the same host, e.g. for tests on loopback
+            socket_.set_option(boost::asio::ip::multicast::enable_loopback(true));
+            boost::asio::ip::address_v4 address = boost::asio::ip::make_address_v4(options.interface);
+            if (!address.is_unspecified()) {
+                socket_.set_option(boost::asio::ip::multicast::outbound_interface(address));
+            }
+            stat_.group = group;
+            stat_.port = port;
+            Logger::info("MulticastSender", "Multicast sender opened, group={}, port={}, interface={}.",
+                         group, port, options.interface);
+        }
+
+        // send one frame, split into fragments if needed
+        void send(const Frame &frame) {
+            std::lock_guard<std::mutex> locker(mutex_);
+            std::size_t size = frame->size();
+            std::size_t count = size == 0 ? 1 : (size + max_payload_ - 1) / max_payload_;
+            if (count > 0xffff) {
+                Logger::error("MulticastSender", "Frame is too large for multicast, size={}.", size);
+                return;
+            }
+
+            FragmentHeader header;
+            header.sender = sender_;
+            header.seq = ++seq_;
+            header.count = static_cast<uint16_t>(count);
+            header.total_size = static_cast<uint32_t>(size);
+
+            char head[FragmentHeader::SIZE];
+            for (std::size_t i = 0; i < count; i++) {
+                std::size_t offset = i * max_payload_;
+                std::size_t length = std::min(max_payload_, size - offset);
+                header.index = static_cast<uint16_t>(i);
+                header.offset = static_cast<uint32_t>(offset);
+                header.write(head);
+
+                // scatter send, the frame bytes are not copied
+                std::array<boost::asio::const_buffer, 2> buffers = {
+                        boost::asio::buffer(head, sizeof(head)),
+                        boost::asio::buffer(frame->data() + offset, length)
+                };
+                boost::system::error_code ec;
+                socket_.send_to(buffers, endpoint_, 0, ec);
+                if (ec) {
+                    Logger::error("MulticastSender", "Send datagram error, group={}, error_message={}.",
+                                  endpoint_.address().to_string(), ec.message());
+                    return;
+                }
+                stat_.fragment_count++;
+            }
+            stat_.message_count++;
+            stat_.bytes += size;
+        }
+
+        MulticastStat getStat() {
+            std::lock_guard<std::mutex> locker(mutex_);
+            return stat_;
+        }
+
+    private:
+        boost::asio::io_context ioc_;
+        udp::socket socket_;
+        udp::endpoint endpoint_;
+        std::size_t max_payload_{0};
+        uint32_t sender_{0};
+
+        std::mutex mutex_;
+        uint32_t seq_{0};
+        MulticastStat stat_;
+    };
+
+    // Joins a multicast group and hands reassembled frames to the handler on its io thread. Frames are
+    // delivered at most once and in order per sender, late and incomplete ones are dropped.
+    class MulticastReceiver {
+    public:
+        using Handler = std::function<void(const char *, std::size_t)>;
+
+        // fragmented frames reassembled at the same time, per receiver
+        static const std::size_t MAX_PARTIAL_FRAMES = 8;
+        static const std::size_t DEFAULT_MAX_FRAME_SIZE = 64 * 1024 * 1024;
+
+        // frames announced larger than max_frame_size are dropped before anything is allocated for them
+        MulticastReceiver(const std::string &group, unsigned short port, Handler handler,
+                          const std::string &interface = "0.0.0.0",
+                          std::size_t max_frame_size = DEFAULT_MAX_FRAME_SIZE)
+                : socket_(ioc_), handler_(handler), buffer_(65536), max_frame_size_(max_frame_size) {
+            udp::endpoint listen_endpoint(boost::asio::ip::make_address("0.0.0.0"), port);
+            socket_.open(listen_endpoint.protocol());
+            socket_.set_option(udp::socket::reuse_address(true));
+            socket_.bind(listen_endpoint);
+            socket_.set_option(boost::asio::ip::multicast::join_group(
+                    boost::asio::ip::make_address_v4(group), boost::asio::ip::make_address_v4(interface)));
+            stat_.group = group;
+            stat_.port = port;
+
+            do_receive();
+            io_thread_ = std::make_shared<std::thread>([this]() { ioc_.run(); });
+            Logger::info("MulticastReceiver", "Multicast group joined, group={}, port={}, interface={}.",
+                         group, port, interface);
+        }
+
+        ~MulticastReceiver() {
+            ioc_.stop();
+            if (io_thread_->joinable()) {
+                io_thread_->join();
+            }
+        }
+
+        MulticastStat getStat() {
+            std::lock_guard<std::mutex> locker(mutex_);
+            return stat_;
+        }
+
+    private:
+        struct Partial {
+            std::vector<char> data;
+            std::vector<bool> received;
+            std::size_t received_count{0};
+        };
+
+        void do_receive() {
+            socket_.async_receive_from(
+                    boost::asio::buffer(buffer_), sender_endpoint_,
+                    [this](boost::system::error_code ec, std::size_t length) {
+                        if (ec) {
+                            if (ec != boost::asio::error::operation_aborted) {
+                                Logger::error("MulticastReceiver", "Receive datagram error, error_message={}.",
+                                              ec.message());
+                            }
+                            return;
+                        }
+                        onDatagram(buffer_.data(), length);
+                        do_receive();
+                    });
+        }
+
+        void onDatagram(const char *data, std::size_t length) {
+            FragmentHeader header;
+            if (!header.read(data, length)) {
+                return;
+            }
+            const char *payload = data + FragmentHeader::SIZE;
+            std::size_t payload_size = length - FragmentHeader::SIZE;
+
+            std::unique_lock<std::mutex> locker(mutex_);
+            stat_.fragment_count++;
+            uint32_t &last_seq = last_seq_[header.sender];
+            if (header.seq <= last_seq) {
+                // count each late message once, by its first fragment
+                stat_.late_count += header.index == 0 ? 1 : 0;
+                return;
+            }
+
+            if (header.count == 1) {
+                deliver(header, locker, payload, payload_size);
+                return;
+            }
+
+            // any datagram on the group can announce a size, no fragment carries more than a datagram
+            if (header.total_size > max_frame_size_ ||
+                header.total_size > static_cast<std::size_t>(header.count) * (buffer_.size() - FragmentHeader::SIZE)) {
+                stat_.incomplete_count += header.index == 0 ? 1 : 0;
+                return;
+            }
+            auto key = std::make_pair(header.sender, header.seq);
+            if (partials_.count(key) == 0) {
+                evict();
+            }
+            Partial &partial = partials_[key];
+            if (partial.received.empty()) {
+                partial.data.resize(header.total_size);
+                partial.received.resize(header.count, false);
+            }
+            if (partial.received.size() != header.count || partial.data.size() != header.total_size ||
+                partial.received[header.index] ||
+                header.offset + payload_size > partial.data.size()) {
+                return;
+            }
+            std::memcpy(partial.data.data() + header.offset, payload, payload_size);
+            partial.received[header.index] = true;
+            if (++partial.received_count < header.count) {
+                return;
+            }
+
+            std::vector<char> frame;
+            frame.swap(partial.data);
+            partials_.erase(key);
+            deliver(header, locker, frame.data(), frame.size());
+        }
+
+        void deliver(const FragmentHeader &header, std::unique_lock<std::mutex> &locker, const char *data,
+                     std::size_t size) {
+            uint32_t &last_seq = last_seq_[header.sender];
+            if (last_seq != 0 && header.seq > last_seq + 1) {
+                stat_.lost_count += header.seq - last_seq - 1;
+            }
+            last_seq = header.seq;
+            // older partial frames of the sender can't be delivered anymore
+            for (auto it = partials_.begin(); it != partials_.end();) {
+                if (it->first.first == header.sender && it->first.second < header.seq) {
+                    stat_.incomplete_count++;
+                    it = partials_.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+            stat_.message_count++;
+            stat_.bytes += size;
+
+            locker.unlock();
+            handler_(data, size);
+        }
+
+        // make room for a new partial frame, drops the one of the lowest sender and sequence
+        void evict() {
+            if (partials_.size() >= MAX_PARTIAL_FRAMES) {
+                partials_.erase(partials_.begin());
+                stat_.incomplete_count++;
+            }
+        }
+
+    private:
+        boost::asio::io_context ioc_;
+        udp::socket socket_;
+        udp::endpoint sender_endpoint_;
+        Handler handler_;
+        std::vector<char> buffer_;
+        std::size_t max_frame_size_;
+        std::shared_ptr<std::thread> io_thread_;
+
+        std::mutex mutex_;
+        std::map<uint32_t, uint32_t> last_seq_;
+        std::map<std::pair<uint32_t, uint32_t>, Partial> partials_;
+        MulticastStat stat_;
+    };
+
+}
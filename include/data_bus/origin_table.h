@@ -0,0 +1,127 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <chrono>
+#include <string>
+
+#include "subscriber.h"
+
+namespace data_bus {
+
+    // where a message on the bus came from
+    struct Origin {
+        // node id of the proxy where the message entered the federation
+        std::string node{};
+        // per (node, topic) sequence number assigned by that node
+        uint64_t seq{0};
+        // session the message was received from, 0 for messages published in this process
+        long from_session{0};
+    };
+
+    // Tracks the origin of the messages in flight on the local bus, so that forwarding to peer proxies can
+    // avoid sending a message back where it came from, and drops duplicates arriving over several links.
+    //
+    // The local sequences start at the start time in microseconds, so a node restarted under the same id
+    // keeps counting up from where the previous run left off, and its messages aren't taken for duplicates.
+    class OriginTable {
+    public:
+        static const std::size_t MAX_ENTRIES = 4096;
+
+        OriginTable() : epoch_(std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count()) {
+        }
+
+        // record the origin of a message before it is published on the local bus
+        void put(const ConstPtr<ProtoMessage> &msg, const Origin &origin) {
+            std::lock_guard<std::mutex> locker(mutex_);
+            prune();
+            entries_[msg.get()] = Entry{msg, origin};
+        }
+
+        // the recorded origin, messages without one are assigned to the local node with the next sequence
+        Origin get(const std::string &topic, const ConstPtr<ProtoMessage> &msg, const std::string &local_node) {
+            std::lock_guard<std::mutex> locker(mutex_);
+            auto it = entries_.find(msg.get());
+            if (it != entries_.end() && !it->second.msg.expired()) {
+                return it->second.origin;
+            }
+            prune();
+            Origin origin;
+            origin.node = local_node;
+            origin.seq = next(topic);
+            entries_[msg.get()] = Entry{msg, origin};
+            return origin;
+        }
+
+        // next sequence of a message entering the federation at the local node
+        uint64_t nextSeq(const std::string &topic) {
+            std::lock_guard<std::mutex> locker(mutex_);
+            return next(topic);
+        }
+
+        // true if the message was seen before, via another link or looped back
+        bool isDuplicate(const std::string &node, const std::string &topic, uint64_t seq) {
+            std::lock_guard<std::mutex> locker(mutex_);
+            uint64_t &last = last_seen_[std::make_pair(node, topic)];
+            if (seq <= last) {
+                duplicate_count_++;
+                return true;
+            }
+            last = seq;
+            return false;
+        }
+
+        // The node linked anew, it may have restarted under the same id with its sequences starting over,
+        // so its messages are not compared with what was seen before.
+        void forget(const std::string &node) {
+            std::lock_guard<std::mutex> locker(mutex_);
+            auto it = last_seen_.lower_bound(std::make_pair(node, std::string()));
+            while (it != last_seen_.end() && it->first.first == node) {
+                it = last_seen_.erase(it);
+            }
+        }
+
+        std::size_t duplicateCount() {
+            std::lock_guard<std::mutex> locker(mutex_);
+            return duplicate_count_;
+        }
+
+    private:
+        struct Entry {
+            std::weak_ptr<const ProtoMessage> msg;
+            Origin origin;
+        };
+
+        uint64_t next(const std::string &topic) {
+            auto it = local_seq_.find(topic);
+            if (it == local_seq_.end()) {
+                it = local_seq_.insert(std::make_pair(topic, epoch_)).first;
+            }
+            return ++it->second;
+        }
+
+        // drop the messages which are not referenced anymore
+        void prune() {
+            if (entries_.size() < MAX_ENTRIES) {
+                return;
+            }
+            for (auto it = entries_.begin(); it != entries_.end();) {
+                if (it->second.msg.expired()) {
+                    it = entries_.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+
+    private:
+        uint64_t epoch_;
+        std::mutex mutex_;
+        std::map<const ProtoMessage *, Entry> entries_;
+        std::map<std::string, uint64_t> local_seq_;
+        std::map<std::pair<std::string, std::string>, uint64_t> last_seen_;
+        std::size_t duplicate_count_{0};
+    };
+
+}
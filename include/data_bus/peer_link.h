@@ -0,0 +1,34 @@
+#pragma once
+
+#include <set>
+
+#include "subscribe_options.h"
+#include "wire_format.h"
+#include "tcp_tool/tcp_client.h"
+
+namespace data_bus {
+
+    using namespace tcp_tool;
+
+    // settings of the traffic a peer proxy sends over a link
+    struct LinkOptions {
+        CodecType codec{CodecType::NONE};
+        int codec_level{0};
+        // max messages per second and topic, 0 means unlimited
+        int max_rate{0};
+    };
+
+    // A connection to another DataBusProxy. Both ends send SUB for the topics somebody downstream of them
+    // is interested in, so a topic only crosses the link when it is needed.
+    struct PeerLink {
+        // node id of the proxy on the other end, empty until its PEER message arrived
+        std::string node_id{};
+        LinkOptions options{};
+        TcpSession<WireMessage> *session{nullptr};
+        // topics subscribed at the other end
+        std::set<std::string> topics{};
+        // set for the links initiated by this proxy
+        Ptr<TcpClient<WireMessage>> client{};
+    };
+
+}
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstdint>
+
 namespace data_bus {
 
     struct QueueStat {
@@ -26,6 +28,48 @@ namespace data_bus {
         }
     };
 
+    // flow control state of a remote session of DataBusProxy
+    struct SessionStat {
+        long session_id{0};
+        int queue_size{0};
+        std::size_t queued_bytes{0};
+        std::size_t pending_count{0};
+        // -1 if the client doesn't use credit based flow control
+        int64_t credit{-1};
+        std::size_t sent_count{0};
+        std::size_t sent_bytes{0};
+        std::size_t dropped_count{0};
+        std::size_t dropped_bytes{0};
+
+        std::string toString() {
+            return "{session_id=" + std::to_string(session_id) +
+                   ", queue_size=" + std::to_string(queue_size) +
+                   ", queued_bytes=" + std::to_string(queued_bytes) +
+                   ", pending_count=" + std::to_string(pending_count) +
+                   ", credit=" + std::to_string(credit) +
+                   ", sent_count=" + std::to_string(sent_count) +
+                   ", sent_bytes=" + std::to_string(sent_bytes) +
+                   ", dropped_count=" + std::to_string(dropped_count) +
+                   ", dropped_bytes=" + std::to_string(dropped_bytes) + "}";
+        }
+    };
+
+    // one input topic of a TimeSynchronizer
+    struct SyncStat {
+        std::string topic{};
+        std::size_t received_count{0};
+        std::size_t matched_count{0};
+        // evicted without a match, by a newer set, a full queue or an out of order stamp
+        std::size_t dropped_count{0};
+
+        std::string toString() {
+            return "{topic=" + topic +
+                   ", received_count=" + std::to_string(received_count) +
+                   ", matched_count=" + std::to_string(matched_count) +
+                   ", dropped_count=" + std::to_string(dropped_count) + "}";
+        }
+    };
+
     struct TopicStat {
         std::string topic{};
         std::size_t publish_count{0};
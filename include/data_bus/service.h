@@ -0,0 +1,313 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <future>
+#include <thread>
+#include <stdexcept>
+#include <condition_variable>
+
+#include "subscriber.h"
+#include "util/logger.h"
+#include "util/thread_pool.h"
+
+namespace data_bus {
+
+    using namespace util;
+
+    // result of a service call, the values are the same as protocol::ServiceStatus
+    enum class ServiceStatus {
+        OK = 0,
+        NOT_FOUND = 1,
+        FAILED = 2,
+        TIMEOUT = 3,
+        CANCELLED = 4
+    };
+
+    class ServiceException : public std::runtime_error {
+    public:
+        ServiceException(ServiceStatus status, const std::string &message)
+                : std::runtime_error(message), status_(status) {
+        }
+
+        ServiceStatus status() const {
+            return status_;
+        }
+
+    private:
+        ServiceStatus status_;
+    };
+
+    // completes a call, response is null unless status is OK
+    using ServiceReply = std::function<void(ServiceStatus, Ptr<ProtoMessage>, const std::string &)>;
+    // untyped service, replies exactly once, possibly later on another thread
+    using ServiceHandler = std::function<void(ConstPtr<ProtoMessage>, ServiceReply)>;
+
+    // Calls waiting for their reply by correlation id. Each call completes exactly once, by its reply, its
+    // timeout or cancel, whichever comes first, later ones are ignored.
+    class CallTable {
+    public:
+        using CancelCallback = std::function<void(long)>;
+
+        CallTable() = default;
+
+        // the calls still waiting fail with CANCELLED
+        ~CallTable() {
+            {
+                std::lock_guard<std::mutex> locker(mutex_);
+                stopped_ = true;
+            }
+            cv_.notify_all();
+            if (sweeper_.joinable()) {
+                sweeper_.join();
+            }
+            std::vector<long> ids;
+            {
+                std::lock_guard<std::mutex> locker(mutex_);
+                for (auto &pair : entries_) {
+                    ids.push_back(pair.first);
+                }
+            }
+            for (long id : ids) {
+                complete(id, ServiceStatus::CANCELLED, nullptr, "call table destroyed");
+            }
+        }
+
+        CallTable(const CallTable &) = delete;
+
+        CallTable &operator=(const CallTable &) = delete;
+
+        // register a call, timeout_ms <= 0 waits forever, on_cancel is called on cancel only
+        long add(ServiceReply reply, int64_t timeout_ms, CancelCallback on_cancel = nullptr) {
+            std::lock_guard<std::mutex> locker(mutex_);
+            long id = ++last_id_;
+            Entry &entry = entries_[id];
+            entry.reply = std::move(reply);
+            entry.on_cancel = std::move(on_cancel);
+            if (timeout_ms > 0) {
+                entry.deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+                entry.has_deadline = true;
+                startSweeper();
+                cv_.notify_one();
+            }
+            return id;
+        }
+
+        // returns false if the call completed before
+        bool complete(long id, ServiceStatus status, Ptr<ProtoMessage> response, const std::string &error) {
+            ServiceReply reply;
+            {
+                std::lock_guard<std::mutex> locker(mutex_);
+                auto it = entries_.find(id);
+                if (it == entries_.end()) {
+                    return false;
+                }
+                reply = std::move(it->second.reply);
+                entries_.erase(it);
+            }
+            reply(status, response, error);
+            return true;
+        }
+
+        bool cancel(long id) {
+            CancelCallback on_cancel;
+            {
+                std::lock_guard<std::mutex> locker(mutex_);
+                auto it = entries_.find(id);
+                if (it == entries_.end()) {
+                    return false;
+                }
+                on_cancel = it->second.on_cancel;
+            }
+            if (!complete(id, ServiceStatus::CANCELLED, nullptr, "call cancelled")) {
+                return false;
+            }
+            if (on_cancel) {
+                on_cancel(id);
+            }
+            return true;
+        }
+
+        std::size_t size() {
+            std::lock_guard<std::mutex> locker(mutex_);
+            return entries_.size();
+        }
+
+    private:
+        struct Entry {
+            ServiceReply reply;
+            CancelCallback on_cancel;
+            bool has_deadline{false};
+            std::chrono::steady_clock::time_point deadline;
+        };
+
+        // one thread per table expires the calls, it sleeps until the earliest deadline
+        void startSweeper() {
+            if (sweeper_.joinable()) {
+                return;
+            }
+            sweeper_ = std::thread([this]() {
+                while (true) {
+                    std::vector<long> expired;
+                    {
+                        std::unique_lock<std::mutex> locker(mutex_);
+                        if (stopped_) {
+                            return;
+                        }
+                        auto now = std::chrono::steady_clock::now();
+                        auto next = now + std::chrono::seconds(1);
+                        for (auto &pair : entries_) {
+                            if (!pair.second.has_deadline) {
+                                continue;
+                            }
+                            if (pair.second.deadline <= now) {
+                                expired.push_back(pair.first);
+                            } else if (pair.second.deadline < next) {
+                                next = pair.second.deadline;
+                            }
+                        }
+                        if (expired.empty()) {
+                            cv_.wait_until(locker, next);
+                            continue;
+                        }
+                    }
+                    for (long id : expired) {
+                        complete(id, ServiceStatus::TIMEOUT, nullptr, "call timed out");
+                    }
+                }
+            });
+        }
+
+    private:
+        std::mutex mutex_;
+        std::condition_variable cv_;
+        long last_id_{0};
+        std::map<long, Entry> entries_;
+        bool stopped_{false};
+        std::thread sweeper_;
+    };
+
+    // Typed result of DataBus::call and DataBusClient::call.
+    template<typename Res>
+    class ServiceFuture {
+    public:
+        ServiceFuture(long id, std::future<ConstPtr<Res>> future, std::function<bool(long)> canceller)
+                : id_(id), future_(std::move(future)), canceller_(std::move(canceller)) {
+        }
+
+        // the response, throws ServiceException if the call failed, timed out or was cancelled
+        ConstPtr<Res> get() {
+            return future_.get();
+        }
+
+        template<typename Rep, typename Period>
+        std::future_status wait_for(const std::chrono::duration<Rep, Period> &duration) const {
+            return future_.wait_for(duration);
+        }
+
+        bool valid() const {
+            return future_.valid();
+        }
+
+        // stop waiting, get() throws CANCELLED, returns false if the call completed before. A call served by
+        // another client through the proxy is cancelled there too, a handler that runs already finishes but its
+        // response is dropped.
+        bool cancel() {
+            return canceller_(id_);
+        }
+
+        long id() const {
+            return id_;
+        }
+
+        // the reply setting a promise of the typed response
+        static ServiceReply resolve(Ptr<std::promise<ConstPtr<Res>>> promise) {
+            return [promise](ServiceStatus status, Ptr<ProtoMessage> response, const std::string &error) {
+                if (status != ServiceStatus::OK) {
+                    promise->set_exception(std::make_exception_ptr(ServiceException(status, error)));
+                    return;
+                }
+                ConstPtr<Res> res = std::dynamic_pointer_cast<const Res>(ConstPtr<ProtoMessage>(response));
+                if (!res) {
+                    promise->set_exception(std::make_exception_ptr(
+                            ServiceException(ServiceStatus::FAILED, "response type mismatch")));
+                    return;
+                }
+                promise->set_value(res);
+            };
+        }
+
+    private:
+        long id_;
+        std::future<ConstPtr<Res>> future_;
+        std::function<bool(long)> canceller_;
+    };
+
+    // Services of this process by name, and the worker pool they run on.
+    class ServiceRegistry {
+    public:
+        static const int DEFAULT_THREADS = 4;
+        static const int64_t DEFAULT_TIMEOUT_MS = 10000;
+
+        static bool advertise(const std::string &service, const ServiceHandler &handler) {
+            std::lock_guard<std::mutex> locker(instance()->mutex_);
+            if (instance()->services_.count(service) > 0) {
+                Logger::error("ServiceRegistry", "Service is advertised already, service={}.", service);
+                return false;
+            }
+            instance()->services_[service] = handler;
+            Logger::info("ServiceRegistry", "Advertise service successfully, service={}.", service);
+            return true;
+        }
+
+        static bool unadvertise(const std::string &service) {
+            std::lock_guard<std::mutex> locker(instance()->mutex_);
+            return instance()->services_.erase(service) > 0;
+        }
+
+        // run the service, replies NOT_FOUND if nobody advertised it
+        static void invoke(const std::string &service, ConstPtr<ProtoMessage> request, ServiceReply reply) {
+            ServiceHandler handler;
+            {
+                std::lock_guard<std::mutex> locker(instance()->mutex_);
+                auto it = instance()->services_.find(service);
+                if (it != instance()->services_.end()) {
+                    handler = it->second;
+                }
+            }
+            if (!handler) {
+                reply(ServiceStatus::NOT_FOUND, nullptr, "service not found: " + service);
+                return;
+            }
+            handler(request, reply);
+        }
+
+        // workers of the typed services, shared by all of them
+        static ThreadPool &pool() {
+            return instance()->pool_;
+        }
+
+        // calls of this process waiting for a reply
+        static CallTable &calls() {
+            return instance()->calls_;
+        }
+
+    private:
+        ServiceRegistry() : pool_(DEFAULT_THREADS) {
+        }
+
+        static ServiceRegistry *instance() {
+            static ServiceRegistry instance;
+            return &instance;
+        }
+
+    private:
+        std::mutex mutex_;
+        std::map<std::string, ServiceHandler> services_;
+        CallTable calls_;
+        // destroyed first, the services it drains reply through calls_
+        ThreadPool pool_;
+    };
+
+}
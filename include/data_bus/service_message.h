@@ -0,0 +1,67 @@
+#pragma once
+
+#include "service.h"
+#include "message_codec.h"
+#include "util/proto_utils.h"
+
+namespace data_bus {
+
+    // Builds and reads the REQUEST, RESPONSE, CANCEL and ADVERTISE messages of remote service calls.
+    class ServiceMessage {
+    public:
+        static protocol::Message request(long id, const std::string &service, const ProtoMessage &request,
+                                         int64_t timeout_ms) {
+            protocol::RequestPayload payload;
+            payload.set_service(service);
+            payload.set_data_type(request.GetTypeName());
+            payload.set_data(request.SerializeAsString());
+            payload.set_timeout_ms(timeout_ms);
+            return pack(protocol::Message_Type_REQUEST, id, payload);
+        }
+
+        static protocol::Message response(long id, ServiceStatus status, const Ptr<ProtoMessage> &response,
+                                          const std::string &error) {
+            protocol::ResponsePayload payload;
+            payload.set_status(static_cast<protocol::ServiceStatus>(status));
+            payload.set_error(error);
+            if (response) {
+                payload.set_data_type(response->GetTypeName());
+                payload.set_data(response->SerializeAsString());
+            }
+            return pack(protocol::Message_Type_RESPONSE, id, payload);
+        }
+
+        static protocol::Message cancel(long id) {
+            protocol::Message message;
+            message.set_type(protocol::Message_Type_CANCEL);
+            message.set_id(id);
+            return message;
+        }
+
+        static protocol::Message advertise(const std::string &service) {
+            protocol::AdvertisePayload payload;
+            payload.set_service(service);
+            return pack(protocol::Message_Type_ADVERTISE, 0, payload);
+        }
+
+        // the message held by a request or response, null if the type is unknown in this process
+        static Ptr<ProtoMessage> parse(const std::string &data_type, const std::string &data) {
+            Ptr<ProtoMessage> message(ProtoUtils::createMessage(data_type));
+            if (message && !message->ParseFromString(data)) {
+                return nullptr;
+            }
+            return message;
+        }
+
+    private:
+        static protocol::Message pack(protocol::Message_Type type, long id, const ProtoMessage &payload) {
+            std::string buf = payload.SerializeAsString();
+            protocol::Message message;
+            message.set_type(type);
+            message.set_id(id);
+            MessageCodec::setPayload(message, buf.data(), buf.size(), CodecType::NONE);
+            return message;
+        }
+    };
+
+}
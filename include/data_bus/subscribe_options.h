@@ -0,0 +1,40 @@
+#pragma once
+
+#include "util/codec.h"
+
+namespace data_bus {
+
+    using namespace util;
+
+    // what the proxy does with a message when the session is out of credit,
+    // the values are the same as protocol::DropPolicy
+    enum class DropPolicy {
+        // keep only the newest message of the topic until there is room again
+        LATEST_WINS = 0,
+        DROP_NEWEST = 1
+    };
+
+    // options of a remote subscription, sent to the proxy in SubPayload
+    struct SubscribeOptions {
+        int max_queue_size{1};
+        int max_rate{0};
+
+        CodecType codec{CodecType::NONE};
+        // 0 means the default level of the codec
+        int codec_level{0};
+        // payloads smaller than this are sent uncompressed
+        int min_compress_size{CodecFactory::DEFAULT_MIN_COMPRESS_SIZE};
+
+        // send diffs against the previous message, for large slowly changing topics like grids
+        bool delta{false};
+        // 0 means the default interval
+        int keyframe_interval{0};
+
+        DropPolicy drop_policy{DropPolicy::LATEST_WINS};
+
+        // share of the connection while several subscriptions have frames to send, a subscription with
+        // priority 4 gets four times the bytes of one with priority 1
+        int priority{1};
+    };
+
+}
@@ -13,58 +13,75 @@ namespace data_bus {
     class SubscriberWorker {
     public:
         SubscriberWorker(const std::string &topic, Ptr<Subscriber> subscriber, int max_queue_size)
-                : topic_(topic), subscriber_(std::move(subscriber)), queue_(max_queue_size) {
-            worker_thread_ = std::make_shared<std::thread>([this] {
-                while (!this->is_stop_) {
-                    Ptr<ProtoMessage> data = this->queue_.take();
+                : context_(std::make_shared<Context>(topic, std::move(subscriber), max_queue_size)) {
+            // the thread shares the context, so it may outlive the worker
+            Ptr<Context> context = context_;
+            std::thread([context] {
+                while (!context->is_stop_) {
+                    Ptr<ProtoMessage> data = context->queue_.take();
+                    if (!data) {
+                        continue;
+                    }
                     try {
                         TimeElapsed time;
-                        this->subscriber_->call(data);
-                        cost_time_sec_ = time.elapsed();
-                        total_time_sec_ += cost_time_sec_;
-                        success_count_++;
+                        context->subscriber_->call(data);
+                        context->cost_time_sec_ = time.elapsed();
+                        context->total_time_sec_ += context->cost_time_sec_;
+                        context->success_count_++;
                     } catch (std::exception &e) {
                         Logger::error("SubscriberWorker",
                                       "Data bus callback error, topic={}, subscriber_name={}, error: ",
-                                      this->topic_, subscriber_->getSubscriberName(), e.what());
+                                      context->topic_, context->subscriber_->getSubscriberName(), e.what());
                     }
                 }
-            });
-            worker_thread_->detach();
+            }).detach();
+        }
+
+        // the thread exits after the callback in progress, a null message wakes it up if it waits
+        ~SubscriberWorker() {
+            context_->is_stop_ = true;
+            context_->queue_.put(nullptr);
         }
 
         void putData(Ptr<ProtoMessage> data) {
-            queue_.put(data);
+            context_->queue_.put(data);
         }
 
         std::string getSubscriberName() {
-            return subscriber_->getSubscriberName();
+            return context_->subscriber_->getSubscriberName();
         }
 
         QueueStat getQueueStat() {
             QueueStat stat;
-            stat.topic = topic_;
-            stat.subscriber_name = subscriber_->getSubscriberName();
-            stat.queue_size = queue_.size();
-            stat.max_queue_size = queue_.maxSize();
-            stat.incoming_count = queue_.incomingCount();
-            stat.dropped_count = queue_.droppedCount();
-            stat.success_count = static_cast<std::size_t >(success_count_);
-            stat.cost_time_sec = cost_time_sec_;
-            stat.total_time_sec = total_time_sec_;
+            stat.topic = context_->topic_;
+            stat.subscriber_name = context_->subscriber_->getSubscriberName();
+            stat.queue_size = context_->queue_.size();
+            stat.max_queue_size = context_->queue_.maxSize();
+            stat.incoming_count = context_->queue_.incomingCount();
+            stat.dropped_count = context_->queue_.droppedCount();
+            stat.success_count = static_cast<std::size_t >(context_->success_count_);
+            stat.cost_time_sec = context_->cost_time_sec_;
+            stat.total_time_sec = context_->total_time_sec_;
             return stat;
         }
 
     private:
-        std::atomic_bool is_stop_{false};
-        std::string topic_;
-        RingQueue<Ptr<ProtoMessage>> queue_;
-        Ptr<Subscriber> subscriber_;
-        Ptr<std::thread> worker_thread_;
+        struct Context {
+            Context(const std::string &topic, Ptr<Subscriber> subscriber, int max_queue_size)
+                    : topic_(topic), queue_(max_queue_size), subscriber_(std::move(subscriber)) {
+            }
+
+            std::atomic_bool is_stop_{false};
+            std::string topic_;
+            RingQueue<Ptr<ProtoMessage>> queue_;
+            Ptr<Subscriber> subscriber_;
+
+            std::atomic_long success_count_{0};
+            double cost_time_sec_{0};
+            double total_time_sec_{0};
+        };
 
-        std::atomic_long success_count_{0};
-        double cost_time_sec_{0};
-        double total_time_sec_{0};
+        Ptr<Context> context_;
     };
 
 }
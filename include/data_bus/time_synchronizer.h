@@ -0,0 +1,284 @@
+#pragma once
+
+#include <array>
+#include <tuple>
+#include <vector>
+#include <limits>
+#include <algorithm>
+
+#include "data_bus.h"
+#include "queue_stat.h"
+#include "message_traits.h"
+
+namespace data_bus {
+
+    template<std::size_t...>
+    struct IndexSequence {
+    };
+
+    template<std::size_t N, std::size_t... Is>
+    struct MakeIndexSequence : MakeIndexSequence<N - 1, N - 1, Is...> {
+    };
+
+    template<std::size_t... Is>
+    struct MakeIndexSequence<0, Is...> {
+        using type = IndexSequence<Is...>;
+    };
+
+    // Stamped messages of one input, in stamp order, in storage allocated once.
+    class SyncRing {
+    public:
+        struct Item {
+            int64_t stamp{0};
+            std::shared_ptr<const void> message;
+        };
+
+        explicit SyncRing(std::size_t capacity) : items_(capacity) {
+        }
+
+        // returns false if the oldest item was evicted to make room
+        bool push(int64_t stamp, std::shared_ptr<const void> message) {
+            bool evicted = false;
+            if (size_ == items_.size()) {
+                pop();
+                evicted = true;
+            }
+            Item &item = items_[(head_ + size_) % items_.size()];
+            item.stamp = stamp;
+            item.message = std::move(message);
+            size_++;
+            return !evicted;
+        }
+
+        void pop() {
+            items_[head_].message.reset();
+            head_ = (head_ + 1) % items_.size();
+            size_--;
+        }
+
+        Item &at(std::size_t index) {
+            return items_[(head_ + index) % items_.size()];
+        }
+
+        Item &front() {
+            return items_[head_];
+        }
+
+        Item &back() {
+            return at(size_ - 1);
+        }
+
+        std::size_t size() const {
+            return size_;
+        }
+
+        bool empty() const {
+            return size_ == 0;
+        }
+
+    private:
+        std::vector<Item> items_;
+        std::size_t head_{0};
+        std::size_t size_{0};
+    };
+
+    // Matches messages of several topics by stamp and calls back with one message of each topic, no two of
+    // them more than max_interval_ns apart. Stamps come from message_traits::TimeStamp and must increase
+    // within a topic.
+    //
+    // The candidate set is the oldest message of each topic. Every queue then slides forward to its newest
+    // message not newer than the newest candidate, which narrows the window. If the window still exceeds
+    // max_interval_ns the oldest candidate can not match anything anymore and is dropped, otherwise the set
+    // is emitted. Each message is visited a bounded number of times, so matching is linear in the input.
+    //
+    // The callback runs on the subscriber thread of the last input, with the synchronizer locked.
+    template<typename... Ts>
+    class ApproximateTimeSynchronizer {
+    public:
+        static const int DEFAULT_QUEUE_SIZE = 10;
+        enum {
+            SIZE = sizeof...(Ts)
+        };
+
+        using SyncCallback = std::function<void(ConstPtr<Ts>...)>;
+        using Topics = std::array<std::string, sizeof...(Ts)>;
+
+        // queue_size is at least 1
+        ApproximateTimeSynchronizer(int64_t max_interval_ns, const SyncCallback &callback,
+                                    int queue_size = DEFAULT_QUEUE_SIZE)
+                : max_interval_ns_(max_interval_ns), queue_size_(std::max(queue_size, 1)), callback_(callback),
+                  anchor_(std::make_shared<Anchor>(this)) {
+            for (int i = 0; i < SIZE; i++) {
+                rings_.emplace_back(queue_size_);
+            }
+        }
+
+        ApproximateTimeSynchronizer(const ApproximateTimeSynchronizer &) = delete;
+
+        ApproximateTimeSynchronizer &operator=(const ApproximateTimeSynchronizer &) = delete;
+
+        // waits for a bus callback running at the moment, later ones find the anchor detached
+        virtual ~ApproximateTimeSynchronizer() {
+            {
+                std::lock_guard<std::mutex> locker(anchor_->mutex);
+                anchor_->owner = nullptr;
+            }
+            unsubscribe();
+        }
+
+        // feed the I-th input, for messages received some other way, such as DataBusClient
+        template<std::size_t I>
+        void add(ConstPtr<typename std::tuple_element<I, std::tuple<Ts...>>::type> message) {
+            using T = typename std::tuple_element<I, std::tuple<Ts...>>::type;
+            int64_t stamp = message_traits::TimeStamp<T>::value(*message);
+
+            std::lock_guard<std::mutex> locker(mutex_);
+            stats_[I].received_count++;
+            SyncRing &ring = rings_[I];
+            if (!ring.empty() && stamp <= ring.back().stamp) {
+                stats_[I].dropped_count++;
+                return;
+            }
+            if (!ring.push(stamp, message)) {
+                stats_[I].dropped_count++;
+            }
+            process();
+        }
+
+        // subscribe the topics on the local DataBus, the I-th topic feeds the I-th input
+        bool subscribe(const std::string &subscriber_name, const Topics &topics) {
+            {
+                std::lock_guard<std::mutex> locker(mutex_);
+                subscriber_name_ = subscriber_name;
+                topics_ = topics;
+                for (int i = 0; i < SIZE; i++) {
+                    stats_[i].topic = topics[i];
+                }
+            }
+            return subscribeAll(typename MakeIndexSequence<sizeof...(Ts)>::type());
+        }
+
+        void unsubscribe() {
+            std::lock_guard<std::mutex> locker(mutex_);
+            if (subscriber_name_.empty()) {
+                return;
+            }
+            for (const std::string &topic : topics_) {
+                DataBus::unsubscribe(topic, subscriber_name_);
+            }
+            subscriber_name_.clear();
+        }
+
+        std::list<SyncStat> getSyncStats() {
+            std::lock_guard<std::mutex> locker(mutex_);
+            return std::list<SyncStat>(stats_.begin(), stats_.end());
+        }
+
+    private:
+        template<std::size_t... Is>
+        bool subscribeAll(IndexSequence<Is...>) {
+            bool results[] = {subscribeOne<Is>()...};
+            for (bool result : results) {
+                if (!result) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        template<std::size_t I>
+        bool subscribeOne() {
+            using T = typename std::tuple_element<I, std::tuple<Ts...>>::type;
+            std::shared_ptr<Anchor> anchor = anchor_;
+            Callback<T> callback = [anchor](ConstPtr<T> message) {
+                std::lock_guard<std::mutex> locker(anchor->mutex);
+                if (anchor->owner) {
+                    anchor->owner->template add<I>(message);
+                }
+            };
+            return DataBus::subscribe<T>(topics_[I], subscriber_name_, callback, queue_size_);
+        }
+
+        // emit or drop until some queue is empty, call with mutex_ held
+        void process() {
+            while (true) {
+                int64_t pivot = std::numeric_limits<int64_t>::min();
+                for (SyncRing &ring : rings_) {
+                    if (ring.empty()) {
+                        return;
+                    }
+                    pivot = std::max(pivot, ring.front().stamp);
+                }
+
+                int oldest = 0;
+                for (int i = 0; i < SIZE; i++) {
+                    SyncRing &ring = rings_[i];
+                    while (ring.size() > 1 && ring.at(1).stamp <= pivot) {
+                        ring.pop();
+                        stats_[i].dropped_count++;
+                    }
+                    if (ring.front().stamp < rings_[oldest].front().stamp) {
+                        oldest = i;
+                    }
+                }
+
+                if (pivot - rings_[oldest].front().stamp > max_interval_ns_) {
+                    rings_[oldest].pop();
+                    stats_[oldest].dropped_count++;
+                    continue;
+                }
+
+                emit(typename MakeIndexSequence<sizeof...(Ts)>::type());
+                for (int i = 0; i < SIZE; i++) {
+                    rings_[i].pop();
+                    stats_[i].matched_count++;
+                }
+            }
+        }
+
+        template<std::size_t... Is>
+        void emit(IndexSequence<Is...>) {
+            try {
+                callback_(std::static_pointer_cast<const Ts>(rings_[Is].front().message)...);
+            } catch (std::exception &e) {
+                Logger::error("TimeSynchronizer", "Sync callback error, subscriber_name={}, error: {}",
+                              subscriber_name_, e.what());
+            }
+        }
+
+    private:
+        // The subscriber threads reach the synchronizer through the anchor, which outlives it in their
+        // callbacks. The bus may still run a callback after unsubscribe returned.
+        struct Anchor {
+            explicit Anchor(ApproximateTimeSynchronizer *owner) : owner(owner) {
+            }
+
+            std::mutex mutex;
+            ApproximateTimeSynchronizer *owner;
+        };
+
+        int64_t max_interval_ns_;
+        int queue_size_;
+        SyncCallback callback_;
+        std::shared_ptr<Anchor> anchor_;
+
+        std::mutex mutex_;
+        std::vector<SyncRing> rings_;
+        std::array<SyncStat, sizeof...(Ts)> stats_;
+        std::string subscriber_name_;
+        Topics topics_;
+    };
+
+    // Emits only sets of messages with the same stamp.
+    template<typename... Ts>
+    class TimeSynchronizer : public ApproximateTimeSynchronizer<Ts...> {
+    public:
+        using SyncCallback = typename ApproximateTimeSynchronizer<Ts...>::SyncCallback;
+
+        explicit TimeSynchronizer(const SyncCallback &callback,
+                                  int queue_size = ApproximateTimeSynchronizer<Ts...>::DEFAULT_QUEUE_SIZE)
+                : ApproximateTimeSynchronizer<Ts...>(0, callback, queue_size) {
+        }
+    };
+
+}
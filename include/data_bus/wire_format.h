@@ -0,0 +1,467 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <cstring>
+#include <stdexcept>
+#include <boost/utility/string_view.hpp>
+
+#include "message_codec.h"
+
+namespace data_bus {
+
+    using string_view = boost::string_view;
+
+    // Fields of a PUB message. They point into the frame or the payload they were parsed from, and are only
+    // valid while it is.
+    struct PubView {
+        // from version 3 the names are announced once per connection and frames carry only the ids, 0 if
+        // the name is inline
+        uint32_t topic_id{0};
+        uint32_t type_id{0};
+        string_view topic{};
+        string_view data_type{};
+        // the serialized message, or a DeltaCodec diff, compressed with codec
+        string_view data{};
+        CodecType codec{CodecType::NONE};
+        bool delta{false};
+        uint64_t seq{0};
+        uint64_t base_seq{0};
+        string_view origin{};
+        uint64_t origin_seq{0};
+    };
+
+    // A piece of a frame too large to be sent in one go, see ChunkAssembler.
+    struct ChunkView {
+        uint32_t channel{0};
+        bool last{false};
+        string_view data{};
+    };
+
+    // A message received by DataBusProxy or DataBusClient, either a PUB frame, a CHUNK of one or a protobuf
+    // control message.
+    struct WireMessage {
+        bool is_pub{false};
+        bool is_chunk{false};
+        PubView pub{};
+        ChunkView chunk{};
+        protocol::Message control{};
+        // bytes of the frame on the stream
+        std::size_t frame_size{0};
+        // decoder state, bytes of the read buffer consumed so far
+        std::size_t offset{0};
+    };
+
+    // Framing of the stream between DataBusProxy, its peers and clients.
+    //
+    // Every frame starts with its size, 4 bytes little endian. In version 1 a protocol::Message follows. In
+    // version 2 the top bit of the size marks a PUB frame, which carries a fixed binary header and the user
+    // message right after it, instead of nesting it in PubPayload and protocol::Message:
+    //
+    //     u8 type, u8 flags, u8 codec, u8 reserved, u32 topic id, u32 type id, u32 data size,
+    //     [u16 size, topic]           FLAG_TOPIC_NAME, else the topic id is set
+    //     [u16 size, data type]       FLAG_TYPE_NAME, else the type id is set
+    //     [u16 size, origin, u64 seq] FLAG_ORIGIN
+    //     [u64 seq, u64 base seq]     FLAG_SEQ, the data is a diff if FLAG_DELTA is set too
+    //     data
+    //
+    // Control messages stay protobuf in both versions. Both ends send HELLO with the highest version they
+    // know after connecting, and use PUB frames once the other end answered with version 2 or higher. From
+    // version 3 the sender announces the names of its ids with a NAME message, see ConnectionNames, and
+    // leaves them out of the frames. Multicast frames keep the names, nobody could announce them there.
+    //
+    // From version 4 a frame larger than a chunk may be cut into CHUNK frames, so that the frames of other
+    // subscriptions of the connection can go out in between. The pieces of one frame are sent in order on
+    // the channel of the subscription and carry the bytes of the complete frame, length prefix included:
+    //
+    //     u8 type, u8 flags, u16 reserved, u32 channel, piece    CHUNK_LAST on the final piece
+    class WireFormat {
+    public:
+        enum {
+            VERSION = 4,
+            LENGTH_SIZE = 4,
+            HEADER_SIZE = 16,
+            CHUNK_HEADER_SIZE = 8
+        };
+
+        enum Flags {
+            FLAG_TOPIC_NAME = 1,
+            FLAG_TYPE_NAME = 2,
+            FLAG_ORIGIN = 4,
+            FLAG_SEQ = 8,
+            FLAG_DELTA = 16
+        };
+
+        enum ChunkFlags {
+            CHUNK_LAST = 1
+        };
+
+        // frames larger than this close the connection, chunked frames included
+        static const std::size_t DEFAULT_MAX_FRAME_SIZE = 256 * 1024 * 1024;
+
+        static void maxFrameSize(std::size_t size) {
+            maxFrameSizeValue() = size;
+        }
+
+        static std::size_t maxFrameSize() {
+            return maxFrameSizeValue();
+        }
+
+        // A PUB frame of the given fields with data_size bytes left for the data, returns where the data goes.
+        // The data of pub is ignored. Returns null if a name is longer than its u16 size or the frame reaches
+        // the PUB frame bit of the length, both would corrupt the stream.
+        static char *preparePub(std::vector<char> &frame, const PubView &pub, std::size_t data_size) {
+            if (pub.topic.size() > MAX_NAME_SIZE || pub.data_type.size() > MAX_NAME_SIZE ||
+                pub.origin.size() > MAX_NAME_SIZE) {
+                Logger::error("WireFormat", "Name is too long for a PUB frame, topic_size={}, data_type_size={}, "
+                                            "origin_size={}.", pub.topic.size(), pub.data_type.size(),
+                              pub.origin.size());
+                return nullptr;
+            }
+            uint8_t flags = 0;
+            std::size_t size = HEADER_SIZE + data_size;
+            if (pub.topic_id == 0) {
+                flags |= FLAG_TOPIC_NAME;
+                size += 2 + pub.topic.size();
+            }
+            if (pub.type_id == 0) {
+                flags |= FLAG_TYPE_NAME;
+                size += 2 + pub.data_type.size();
+            }
+            if (!pub.origin.empty()) {
+                flags |= FLAG_ORIGIN;
+                size += 2 + pub.origin.size() + 8;
+            }
+            // keyframes of a delta subscription have a seq as well
+            if (pub.delta || pub.seq != 0) {
+                flags |= pub.delta ? FLAG_SEQ | FLAG_DELTA : FLAG_SEQ;
+                size += 16;
+            }
+            if (size >= PUB_FRAME_BIT) {
+                Logger::error("WireFormat", "PUB frame is too large, size={}.", size);
+                return nullptr;
+            }
+
+            frame.resize(LENGTH_SIZE + size);
+            char *out = frame.data();
+            out = put32(out, static_cast<uint32_t>(size) | PUB_FRAME_BIT);
+            *out++ = static_cast<char>(protocol::Message_Type_PUB);
+            *out++ = static_cast<char>(flags);
+            *out++ = static_cast<char>(pub.codec);
+            *out++ = 0;
+            out = put32(out, pub.topic_id);
+            out = put32(out, pub.type_id);
+            out = put32(out, static_cast<uint32_t>(data_size));
+            if (flags & FLAG_TOPIC_NAME) {
+                out = putString(out, pub.topic);
+            }
+            if (flags & FLAG_TYPE_NAME) {
+                out = putString(out, pub.data_type);
+            }
+            if (flags & FLAG_ORIGIN) {
+                out = putString(out, pub.origin);
+                out = put64(out, pub.origin_seq);
+            }
+            if (flags & FLAG_SEQ) {
+                out = put64(out, pub.seq);
+                out = put64(out, pub.base_seq);
+            }
+            return out;
+        }
+
+        // null if the frame can't be encoded, see preparePub
+        static Frame encodePub(const PubView &pub) {
+            std::shared_ptr<std::vector<char>> frame = std::make_shared<std::vector<char>>();
+            char *out = preparePub(*frame, pub, pub.data.size());
+            if (!out) {
+                return nullptr;
+            }
+            std::memcpy(out, pub.data.data(), pub.data.size());
+            return frame;
+        }
+
+        // PUB frame with the data compressed with codec if it is at least min_size bytes, sets pub.codec and
+        // pub.data
+        static Frame encodePub(PubView &pub, const char *data, std::size_t size, CodecType codec, int level,
+                               int min_size) {
+            std::vector<char> packed;
+            pub.codec = CodecFactory::compress(codec, level, data, size, packed, min_size);
+            pub.data = pub.codec == CodecType::NONE ? string_view(data, size)
+                                                    : string_view(packed.data(), packed.size());
+            return encodePub(pub);
+        }
+
+        // CHUNK frame holding size bytes of a frame of the channel
+        static Frame encodeChunk(uint32_t channel, bool last, const char *data, std::size_t size) {
+            std::shared_ptr<std::vector<char>> frame = std::make_shared<std::vector<char>>(
+                    LENGTH_SIZE + CHUNK_HEADER_SIZE + size);
+            char *out = frame->data();
+            out = put32(out, static_cast<uint32_t>(CHUNK_HEADER_SIZE + size) | PUB_FRAME_BIT);
+            *out++ = static_cast<char>(protocol::Message_Type_CHUNK);
+            *out++ = static_cast<char>(last ? CHUNK_LAST : 0);
+            *out++ = 0;
+            *out++ = 0;
+            out = put32(out, channel);
+            std::memcpy(out, data, size);
+            return frame;
+        }
+
+        // TcpDecoder of the stream, takes the next frame of data. The bytes stay in place while the handler
+        // runs, so message may point into them, and are erased at once when no complete frame is left.
+        static bool decode(std::vector<char> &data, WireMessage &message) {
+            while (true) {
+                // checked before the frame arrives, so a bogus size can't make the read buffer grow without end
+                if (data.size() - message.offset >= LENGTH_SIZE) {
+                    uint32_t length = get32(data.data() + message.offset) & ~PUB_FRAME_BIT;
+                    if (length > maxFrameSize()) {
+                        throw std::length_error("frame size " + std::to_string(length) +
+                                                " exceeds the maximum " + std::to_string(maxFrameSize()));
+                    }
+                }
+                std::size_t size = parse(data.data() + message.offset, data.size() - message.offset, message);
+                if (size == 0) {
+                    data.erase(data.begin(), data.begin() + message.offset);
+                    message.offset = 0;
+                    return false;
+                }
+                message.offset += size;
+                if (message.frame_size > 0) {
+                    return true;
+                }
+            }
+        }
+
+        // Parse the frame at the start of data, returns its size or 0 if it didn't arrive in full yet. A
+        // frame that can't be parsed is skipped, message.frame_size is 0 then.
+        static std::size_t parse(const char *data, std::size_t size, WireMessage &message) {
+            if (size < LENGTH_SIZE) {
+                return 0;
+            }
+            uint32_t length = get32(data);
+            bool is_pub = (length & PUB_FRAME_BIT) != 0;
+            length &= ~PUB_FRAME_BIT;
+            if (size < LENGTH_SIZE + length) {
+                return 0;
+            }
+
+            const char *body = data + LENGTH_SIZE;
+            message.is_chunk = is_pub && length > 0 && static_cast<uint8_t>(body[0]) == protocol::Message_Type_CHUNK;
+            message.is_pub = is_pub && !message.is_chunk;
+            message.frame_size = LENGTH_SIZE + length;
+            bool success;
+            if (message.is_chunk) {
+                success = parseChunk(body, length, message.chunk);
+            } else if (is_pub) {
+                success = parsePub(body, length, message.pub);
+            } else {
+                success = message.control.ParseFromArray(body, static_cast<int>(length));
+            }
+            if (!success) {
+                Logger::error("WireFormat", "Can not parse frame, size={}, pub={}.", length, is_pub);
+                message.frame_size = 0;
+            }
+            return LENGTH_SIZE + length;
+        }
+
+        // the fields of a version 1 PubPayload, valid while the payload is
+        static PubView viewOf(const protocol::PubPayload &payload) {
+            PubView pub;
+            pub.topic = payload.topic();
+            pub.data_type = payload.data_type();
+            pub.data = payload.data();
+            pub.delta = payload.delta();
+            pub.seq = payload.seq();
+            pub.base_seq = payload.base_seq();
+            pub.origin = payload.origin();
+            pub.origin_seq = payload.origin_seq();
+            return pub;
+        }
+
+    private:
+        static const uint32_t PUB_FRAME_BIT = 0x80000000u;
+        // names are prefixed with a u16 size
+        static const std::size_t MAX_NAME_SIZE = 0xffff;
+
+        static bool parseChunk(const char *body, std::size_t size, ChunkView &chunk) {
+            if (size < CHUNK_HEADER_SIZE) {
+                return false;
+            }
+            chunk.last = (static_cast<uint8_t>(body[1]) & CHUNK_LAST) != 0;
+            chunk.channel = get32(body + 4);
+            chunk.data = string_view(body + CHUNK_HEADER_SIZE, size - CHUNK_HEADER_SIZE);
+            return true;
+        }
+
+        static bool parsePub(const char *body, std::size_t size, PubView &pub) {
+            if (size < HEADER_SIZE) {
+                return false;
+            }
+            const char *end = body + size;
+            uint8_t flags = static_cast<uint8_t>(body[1]);
+            pub.codec = static_cast<CodecType>(static_cast<uint8_t>(body[2]));
+            pub.topic_id = get32(body + 4);
+            pub.type_id = get32(body + 8);
+            uint32_t data_size = get32(body + 12);
+            const char *in = body + HEADER_SIZE;
+
+            pub.topic = string_view();
+            pub.data_type = string_view();
+            pub.origin = string_view();
+            pub.origin_seq = 0;
+            pub.delta = (flags & FLAG_DELTA) != 0;
+            pub.seq = 0;
+            pub.base_seq = 0;
+            if (flags & FLAG_TOPIC_NAME) {
+                pub.topic_id = 0;
+                if (!getString(in, end, pub.topic)) {
+                    return false;
+                }
+            }
+            if (flags & FLAG_TYPE_NAME) {
+                pub.type_id = 0;
+                if (!getString(in, end, pub.data_type)) {
+                    return false;
+                }
+            }
+            if (flags & FLAG_ORIGIN) {
+                if (!getString(in, end, pub.origin) || end - in < 8) {
+                    return false;
+                }
+                pub.origin_seq = get64(in);
+                in += 8;
+            }
+            if (flags & FLAG_SEQ) {
+                if (end - in < 16) {
+                    return false;
+                }
+                pub.seq = get64(in);
+                pub.base_seq = get64(in + 8);
+                in += 16;
+            }
+            if (static_cast<std::size_t>(end - in) != data_size) {
+                return false;
+            }
+            pub.data = string_view(in, data_size);
+            return true;
+        }
+
+        static char *put32(char *out, uint32_t value) {
+            for (int i = 0; i < 4; i++) {
+                *out++ = static_cast<char>((value >> (8 * i)) & 0xff);
+            }
+            return out;
+        }
+
+        static char *put64(char *out, uint64_t value) {
+            for (int i = 0; i < 8; i++) {
+                *out++ = static_cast<char>((value >> (8 * i)) & 0xff);
+            }
+            return out;
+        }
+
+        static char *putString(char *out, string_view value) {
+            *out++ = static_cast<char>(value.size() & 0xff);
+            *out++ = static_cast<char>((value.size() >> 8) & 0xff);
+            std::memcpy(out, value.data(), value.size());
+            return out + value.size();
+        }
+
+        static uint32_t get32(const char *in) {
+            uint32_t value = 0;
+            for (int i = 0; i < 4; i++) {
+                value |= static_cast<uint32_t>(static_cast<uint8_t>(in[i])) << (8 * i);
+            }
+            return value;
+        }
+
+        static uint64_t get64(const char *in) {
+            uint64_t value = 0;
+            for (int i = 0; i < 8; i++) {
+                value |= static_cast<uint64_t>(static_cast<uint8_t>(in[i])) << (8 * i);
+            }
+            return value;
+        }
+
+        static std::atomic<std::size_t> &maxFrameSizeValue() {
+            static std::atomic<std::size_t> value(DEFAULT_MAX_FRAME_SIZE);
+            return value;
+        }
+
+        static bool getString(const char *&in, const char *end, string_view &value) {
+            if (end - in < 2) {
+                return false;
+            }
+            std::size_t size = static_cast<uint8_t>(in[0]) | (static_cast<uint8_t>(in[1]) << 8);
+            in += 2;
+            if (static_cast<std::size_t>(end - in) < size) {
+                return false;
+            }
+            value = string_view(in, size);
+            in += size;
+            return true;
+        }
+    };
+
+    // Joins the CHUNK frames of each channel of a connection back into frames. Used by the thread reading the
+    // connection only.
+    class ChunkAssembler {
+    public:
+        // channels beyond this are rejected, like the name ids the channels are numbered by
+        enum {
+            MAX_CHANNEL = 1 << 20
+        };
+
+        // true once the last piece of a PUB frame arrived, pub stays valid until the next chunk of the channel
+        bool add(const ChunkView &chunk, PubView &pub) {
+            if (chunk.channel >= MAX_CHANNEL) {
+                Logger::error("ChunkAssembler", "Channel out of range, channel={}.", chunk.channel);
+                return false;
+            }
+            if (chunk.channel >= channels_.size()) {
+                channels_.resize(chunk.channel + 1);
+            }
+            Channel &channel = channels_[chunk.channel];
+            if (channel.complete) {
+                channel.data.clear();
+                channel.complete = false;
+                channel.dropped = false;
+            }
+            if (!channel.dropped && channel.data.size() + chunk.data.size() > WireFormat::maxFrameSize()) {
+                Logger::error("ChunkAssembler", "Chunked frame is too large, channel={}, size={}.", chunk.channel,
+                              channel.data.size() + chunk.data.size());
+                std::vector<char>().swap(channel.data);
+                channel.dropped = true;
+            }
+            // the rest of a dropped frame is skipped up to its last piece
+            if (channel.dropped) {
+                channel.complete = chunk.last;
+                return false;
+            }
+            channel.data.insert(channel.data.end(), chunk.data.begin(), chunk.data.end());
+            if (!chunk.last) {
+                return false;
+            }
+
+            channel.complete = true;
+            WireMessage message;
+            std::size_t size = WireFormat::parse(channel.data.data(), channel.data.size(), message);
+            if (size != channel.data.size() || message.frame_size == 0 || !message.is_pub) {
+                Logger::error("ChunkAssembler", "Bad chunked frame, channel={}, size={}.", chunk.channel,
+                              channel.data.size());
+                return false;
+            }
+            pub = message.pub;
+            return true;
+        }
+
+    private:
+        struct Channel {
+            std::vector<char> data;
+            bool complete{false};
+            bool dropped{false};
+        };
+
+        std::vector<Channel> channels_;
+    };
+
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <vector>
+#include <string>
+#include <unordered_map>
+
+#include "subscriber.h"
+#include "message_codec.h"
+#include "util/proto_utils.h"
+
+namespace data_bus {
+
+    using namespace util;
+
+    // the values are the same as protocol::NameKind
+    enum class NameKind {
+        TOPIC = 0,
+        DATA_TYPE = 1
+    };
+
+    // Ids of the topic and data type names this process sends in PUB frames of version 3. They are numbered
+    // per process rather than per connection, so that a frame shared by several connections carries the same
+    // ids on all of them. Id 0 means the name is inline.
+    class NameRegistry {
+    public:
+        uint32_t topicId(const std::string &topic) {
+            std::lock_guard<std::mutex> locker(mutex_);
+            auto it = topic_ids_.find(topic);
+            if (it != topic_ids_.end()) {
+                return it->second;
+            }
+            uint32_t id = static_cast<uint32_t>(topic_ids_.size() + 1);
+            topic_ids_[topic] = id;
+            return id;
+        }
+
+        // keyed by descriptor, so that a message doesn't have to build its type name
+        uint32_t typeId(const google::protobuf::Descriptor *descriptor) {
+            std::lock_guard<std::mutex> locker(mutex_);
+            auto it = type_ids_.find(descriptor);
+            if (it != type_ids_.end()) {
+                return it->second;
+            }
+            uint32_t id = static_cast<uint32_t>(type_ids_.size() + 1);
+            type_ids_[descriptor] = id;
+            return id;
+        }
+
+    private:
+        std::mutex mutex_;
+        std::map<std::string, uint32_t> topic_ids_;
+        std::unordered_map<const google::protobuf::Descriptor *, uint32_t> type_ids_;
+    };
+
+    // Names of the ids on one connection, in both directions.
+    //
+    // Before the first frame with an id, the sender announces it with a NAME message. The receiver keeps the
+    // names in arrays indexed by id, and resolves the topic and the prototype of the data type of a frame
+    // without any string lookup.
+    class ConnectionNames {
+    public:
+        // ids beyond this are rejected, so that a broken peer can't make the arrays grow without bound
+        enum {
+            MAX_ID = 1 << 20
+        };
+
+        // Call send the first time the id is used on the connection. It runs with the lock held, so that a
+        // frame sent by another thread that finds the id announced already can't overtake the NAME message.
+        template<typename Send>
+        void announce(NameKind kind, uint32_t id, Send send) {
+            std::lock_guard<std::mutex> locker(mutex_);
+            std::vector<bool> &announced = kind == NameKind::TOPIC ? announced_topics_ : announced_types_;
+            if (id < announced.size() && announced[id]) {
+                return;
+            }
+            if (id >= announced.size()) {
+                announced.resize(id + 1);
+            }
+            announced[id] = true;
+            send();
+        }
+
+        // the NAME message announcing the id
+        static Frame encodeName(NameKind kind, uint32_t id, const std::string &name) {
+            protocol::NamePayload payload;
+            payload.set_kind(static_cast<protocol::NameKind>(kind));
+            payload.set_id(id);
+            payload.set_name(name);
+
+            protocol::Message message;
+            message.set_type(protocol::Message_Type_NAME);
+            message.set_payload(payload.SerializeAsString());
+            return MessageCodec::serialize(message);
+        }
+
+        // The receiving side below is only used by the thread reading the connection.
+        bool define(NameKind kind, uint32_t id, const std::string &name) {
+            if (id == 0 || id >= MAX_ID) {
+                Logger::error("ConnectionNames", "Name id out of range, id={}, name={}.", id, name);
+                return false;
+            }
+            if (kind == NameKind::TOPIC) {
+                if (id >= topics_.size()) {
+                    topics_.resize(id + 1);
+                }
+                topics_[id] = name;
+                return true;
+            }
+            const ProtoMessage *prototype = ProtoUtils::getPrototype(name);
+            if (!prototype) {
+                return false;
+            }
+            if (id >= prototypes_.size()) {
+                prototypes_.resize(id + 1);
+            }
+            prototypes_[id] = prototype;
+            return true;
+        }
+
+        // null if the id was never announced
+        const std::string *topic(uint32_t id) const {
+            return id < topics_.size() && !topics_[id].empty() ? &topics_[id] : nullptr;
+        }
+
+        const ProtoMessage *prototype(uint32_t id) const {
+            return id < prototypes_.size() ? prototypes_[id] : nullptr;
+        }
+
+    private:
+        std::mutex mutex_;
+        std::vector<bool> announced_topics_;
+        std::vector<bool> announced_types_;
+
+        std::vector<std::string> topics_;
+        std::vector<const ProtoMessage *> prototypes_;
+    };
+
+}
@@ -6,11 +6,19 @@
 
 namespace http_server {
 
-    // Accepts incoming connections and launches the HttpSessions
+#ifdef SO_REUSEPORT
+    using ReusePort = asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+#endif
+
+    // Accepts incoming connections and launches the HttpSessions on the io_context of the acceptor. With
+    // reuse_port several acceptors listen on the same port, one per io_context, and the kernel spreads the
+    // connections over them.
     class Acceptor : public std::enable_shared_from_this<Acceptor> {
     public:
-        Acceptor(asio::io_context &ioc, tcp::endpoint &&endpoint, Attr &attr)
-                : endpoint_(std::move(endpoint)), acceptor_(ioc), attr_(attr) {
+        Acceptor(asio::io_context &ioc, tcp::endpoint &&endpoint, Attr &attr, Sessions &sessions,
+                 bool reuse_port = false)
+                : endpoint_(std::move(endpoint)), acceptor_(ioc), timer_(ioc), attr_(attr), sessions_(sessions),
+                  reuse_port_(reuse_port) {
         }
 
         // Start accepting incoming connections
@@ -21,6 +29,11 @@ namespace http_server {
 
                 // Allow address reuse
                 acceptor_.set_option(asio::socket_base::reuse_address(true));
+#ifdef SO_REUSEPORT
+                if (reuse_port_) {
+                    acceptor_.set_option(ReusePort(true));
+                }
+#endif
 
                 // Bind to the server address
                 acceptor_.bind(endpoint_);
@@ -37,16 +50,43 @@ namespace http_server {
         }
 
         void do_accept() {
+            // leave new connections in the backlog until some of the open ones are closed
+            if (attr_.max_connections > 0 && attr_.connections >= attr_.max_connections) {
+                if (!throttled_) {
+                    throttled_ = true;
+                    Logger::info("Acceptor", "Too many connections, accepting paused, max_connections={}.",
+                                 attr_.max_connections);
+                }
+                timer_.expires_after(std::chrono::milliseconds(THROTTLE_INTERVAL_MS));
+                timer_.async_wait([this](boost::system::error_code ec) {
+                    if (ec) {
+                        return;
+                    }
+                    do_accept();
+                });
+                return;
+            }
+            if (throttled_) {
+                throttled_ = false;
+                Logger::info("Acceptor", "Accepting resumed.");
+            }
+
             acceptor_.async_accept(
                     [this](boost::system::error_code ec, tcp::socket socket) {
                         if (ec) {
                             Logger::error("Acceptor", "On accept http session error, {}.", ec.message());
                         } else {
+                            boost::system::error_code endpoint_ec;
+                            tcp::endpoint remote = socket.remote_endpoint(endpoint_ec);
+                            // pipelined responses and websocket messages are small writes that must not wait
+                            // for the ack of the one before
+                            socket.set_option(tcp::no_delay(true), endpoint_ec);
                             Logger::info("HttpSession", "New http session, host={}, port={}.",
-                                         socket.remote_endpoint().address().to_string(), socket.remote_endpoint().port());
-                            HttpSessionPtr session(new HttpSession(std::move(socket), attr_));
-                            std::lock_guard<std::mutex> locker(attr_.http_mutex);
-                            attr_.http_sessions.insert(session);
+                                         remote.address().to_string(), remote.port());
+                            HttpSessionPtr session(new HttpSession(std::move(socket), attr_, sessions_));
+                            attr_.connections++;
+                            std::lock_guard<std::mutex> locker(sessions_.http_mutex);
+                            sessions_.http_sessions.insert(session);
                             session->run();
 
                         }
@@ -56,8 +96,17 @@ namespace http_server {
         }
 
     private:
+        enum {
+            THROTTLE_INTERVAL_MS = 50
+        };
+
         tcp::endpoint endpoint_;
         tcp::acceptor acceptor_;
+        // retries accepting while there are too many connections
+        asio::steady_timer timer_;
+        bool throttled_{false};
         Attr &attr_;
+        Sessions &sessions_;
+        bool reuse_port_;
     };
 }
\ No newline at end of file
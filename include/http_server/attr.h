@@ -9,11 +9,15 @@
 #include <set>
 #include <map>
 #include <mutex>
+#include <atomic>
 
 #include <boost/beast.hpp>
 #include <boost/asio.hpp>
 
 #include "util/logger.h"
+#include "util/block_pool.h"
+#include "router.h"
+#include "static_files.h"
 
 namespace http_server {
 
@@ -31,15 +35,54 @@ namespace http_server {
     using HttpHeader = boost::beast::http::field;
     using HttpHeaders = boost::beast::http::fields;
 
-    using HttpRequest = http::request<http::string_body>;
+    // the fields of requests and handler responses are allocated from blocks recycled per thread, so a request
+    // that looks like the ones before it doesn't reach the heap
+    using HttpFieldAllocator = util::PooledAllocator<char>;
+    using HttpFields = http::basic_fields<HttpFieldAllocator>;
 
-    using HttpResponse = http::response<http::string_body>;
+    using HttpRequest = http::request<http::string_body, HttpFields>;
+    using HttpRequestParser = http::request_parser<http::string_body, HttpFieldAllocator>;
+
+    using HttpResponse = http::response<http::string_body, HttpFields>;
     using HttpResponsePtr = std::shared_ptr<HttpResponse>;
     using FileResponse = http::response<http::file_body>;
     using FileResponsePtr = std::shared_ptr<FileResponse>;
+    using SharedResponse = http::response<SharedBody>;
+    using SharedResponsePtr = std::shared_ptr<SharedResponse>;
+
+    // a response and its control block in one recycled block
+    template<typename... Args>
+    HttpResponsePtr make_response(Args &&... args) {
+        return std::allocate_shared<HttpResponse>(util::PooledAllocator<HttpResponse>(),
+                                                  std::forward<Args>(args)...);
+    }
 
     using HttpHandler = std::function<void(HttpRequest &, HttpResponse &)>;
 
+    // a handler that reads the path params of its route
+    using HttpParamHandler = std::function<void(HttpRequest &, HttpResponse &, const HttpParams &)>;
+
+    class HttpStream;
+
+    using HttpStreamPtr = std::shared_ptr<HttpStream>;
+
+    // a handler that sends its response piece by piece, see HttpStream
+    using HttpStreamHandler = std::function<void(HttpRequest &, HttpStreamPtr, const HttpParams &)>;
+
+    class HttpResponder;
+
+    using HttpResponderPtr = std::shared_ptr<HttpResponder>;
+
+    // a handler that responds later through the responder, see HttpResponder
+    using HttpAsyncHandler = std::function<void(HttpRequest &, HttpResponderPtr, const HttpParams &)>;
+
+    // the handler of a route and method, one of them is set
+    struct HttpRoute {
+        HttpParamHandler handler;
+        HttpStreamHandler stream_handler;
+        HttpAsyncHandler async_handler;
+    };
+
     class HttpSession;
 
     using HttpSessionPtr = std::shared_ptr<HttpSession>;
@@ -52,23 +95,60 @@ namespace http_server {
 
     using WebsocketCloseCallback = std::function<void(WebsocketSession &)>;
 
+    // The open sessions of an io_context. Every engine of the server has its own, so connects and disconnects
+    // only contend with broadcasts and not with the other io threads.
+    struct Sessions {
+        std::mutex http_mutex;
+        std::set<HttpSessionPtr> http_sessions;
+
+        std::mutex websocket_mutex;
+        std::set<WebsocketSessionPtr> websocket_sessions;
+    };
+
     struct Attr {
         std::string webroot{"."};
 
         std::string index_file{"index.html"};
 
+        StaticFiles static_files;
+
+        // the websocket ping interval
         std::chrono::seconds timeout{10};
 
+        // http connections: the request header and body after its first byte, each response write, and the
+        // wait for the next request on a keep-alive connection
+        std::chrono::seconds header_timeout{10};
+        std::chrono::seconds body_timeout{30};
+        std::chrono::seconds write_timeout{30};
+        std::chrono::seconds idle_timeout{60};
+
+        // requests served per connection, the last one is answered with "Connection: close", 0 for no limit
+        std::size_t max_requests{1000};
+
+        // http and websocket connections, accepting waits while there are this many, 0 for no limit
+        std::size_t max_connections{10000};
+
+        // a request with a larger header is answered with 431, with a larger body with 413
+        std::size_t header_limit{8 * 1024};
+        std::size_t body_limit{1024 * 1024};
+
+        // handler responses of at least this many bytes are compressed when the client accepts it
+        bool compression{true};
+        std::size_t compression_min_size{1024};
+
         // default http headers
         HttpHeaders http_headers{};
 
-        std::map<std::string, std::map<int, HttpHandler>> http_routes;
+        Router<HttpRoute> http_routes;
 
-        std::mutex http_mutex;
-        std::set<HttpSessionPtr> http_sessions;
+        // responses queued per connection for pipelined requests, reading pauses when it's reached
+        std::size_t pipeline_limit{8};
 
-        std::mutex websocket_mutex;
-        std::set<WebsocketSessionPtr> websocket_sessions;
+        // runs the http and async handlers if set, instead of the io threads
+        std::unique_ptr<asio::thread_pool> workers;
+
+        // open http and websocket connections of all io_contexts, for max_connections
+        std::atomic<std::size_t> connections{0};
 
         WebsocketHandler websocket_handler{[](std::vector<char> &, WebsocketSession &){}};
         WebsocketCloseCallback websocket_close_callback{[](WebsocketSession &) {}};
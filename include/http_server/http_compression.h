@@ -0,0 +1,174 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <boost/beast.hpp>
+
+#ifdef USE_BROTLI
+#include <brotli/encode.h>
+#endif
+
+#ifdef USE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "util/logger.h"
+#include "util/zlib_utils.h"
+#include "http_utils.h"
+
+namespace http_server {
+
+    namespace beast = boost::beast;
+
+    // content codings of HTTP responses, in the order the server prefers them
+    enum class ContentEncoding {
+        IDENTITY = 0,
+        BROTLI,
+        ZSTD,
+        GZIP,
+        DEFLATE
+    };
+
+    // Content-Encoding negotiation and the compressors of the response bodies. The zlib and zstd states are
+    // kept per thread and reset between responses, brotli has no reset, its encoder is created per call.
+    class HttpCompression {
+    public:
+        // the highest level of each coding, for bodies compressed once and sent many times
+        static const int BEST_LEVEL = -1;
+
+        static const char *name(ContentEncoding encoding) {
+            switch (encoding) {
+                case ContentEncoding::BROTLI:
+                    return "br";
+                case ContentEncoding::ZSTD:
+                    return "zstd";
+                case ContentEncoding::GZIP:
+                    return "gzip";
+                case ContentEncoding::DEFLATE:
+                    return "deflate";
+                default:
+                    return "identity";
+            }
+        }
+
+        static bool supported(ContentEncoding encoding) {
+            switch (encoding) {
+#ifdef USE_BROTLI
+                case ContentEncoding::BROTLI:
+#endif
+#ifdef USE_ZSTD
+                case ContentEncoding::ZSTD:
+#endif
+                case ContentEncoding::GZIP:
+                case ContentEncoding::DEFLATE:
+                    return true;
+                default:
+                    return false;
+            }
+        }
+
+        // The supported coding with the highest q value in the Accept-Encoding header, on a tie the one the
+        // server prefers. IDENTITY if the client accepts none.
+        static ContentEncoding negotiate(beast::string_view accept_encoding) {
+            ContentEncoding best = ContentEncoding::IDENTITY;
+            double best_q = 0;
+            for (ContentEncoding encoding : {ContentEncoding::BROTLI, ContentEncoding::ZSTD, ContentEncoding::GZIP,
+                                             ContentEncoding::DEFLATE}) {
+                if (!supported(encoding)) {
+                    continue;
+                }
+                double q = HttpUtils::encoding_quality(accept_encoding, name(encoding));
+                if (q > best_q) {
+                    best = encoding;
+                    best_q = q;
+                }
+            }
+            return best;
+        }
+
+        // text formats, binary ones are usually compressed already. An unset type counts as text, handlers
+        // mostly return JSON without setting it.
+        static bool compressible(beast::string_view content_type) {
+            content_type = content_type.substr(0, content_type.find(';'));
+            return content_type.empty() || content_type.starts_with("text/") ||
+                   content_type == "application/javascript" || content_type == "application/json" ||
+                   content_type == "application/xml" || content_type == "image/svg+xml";
+        }
+
+        // Level 0 is the default level of the coding, which favours speed. Returns false if the coding isn't
+        // supported or failed.
+        static bool compress(ContentEncoding encoding, const char *in, std::size_t size, std::vector<char> &out,
+                             int level = 0) {
+            try {
+                switch (encoding) {
+                    case ContentEncoding::GZIP:
+                        util::ZlibUtils::gzip(in, size, out, zlibLevel(level));
+                        return true;
+                    case ContentEncoding::DEFLATE:
+                        // "deflate" of HTTP is the zlib format
+                        util::ZlibUtils::compress(in, size, out, zlibLevel(level));
+                        return true;
+#ifdef USE_BROTLI
+                    case ContentEncoding::BROTLI: {
+                        int quality = level == BEST_LEVEL ? BROTLI_MAX_QUALITY : level == 0 ? 5 : level;
+                        out.resize(BrotliEncoderMaxCompressedSize(size));
+                        std::size_t written = out.size();
+                        if (!BrotliEncoderCompress(quality, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_GENERIC, size,
+                                                   reinterpret_cast<const uint8_t *>(in), &written,
+                                                   reinterpret_cast<uint8_t *>(out.data()))) {
+                            return false;
+                        }
+                        out.resize(written);
+                        return true;
+                    }
+#endif
+#ifdef USE_ZSTD
+                    case ContentEncoding::ZSTD: {
+                        int zstd_level = level == BEST_LEVEL ? ZSTD_maxCLevel() : level == 0 ? 3 : level;
+                        out.resize(ZSTD_compressBound(size));
+                        std::size_t written = ZSTD_compressCCtx(zstdContext().cctx, out.data(), out.size(), in, size,
+                                                                zstd_level);
+                        if (ZSTD_isError(written)) {
+                            return false;
+                        }
+                        out.resize(written);
+                        return true;
+                    }
+#endif
+                    default:
+                        return false;
+                }
+            } catch (std::exception &e) {
+                util::Logger::error("HttpCompression", "Compress error, encoding={}, size={}, error: {}",
+                                    name(encoding), size, e.what());
+                return false;
+            }
+        }
+
+    private:
+        static int zlibLevel(int level) {
+            return level == BEST_LEVEL ? Z_BEST_COMPRESSION : level == 0 ? 6 : level;
+        }
+
+#ifdef USE_ZSTD
+        // not shared with util::ZstdCodec, which may be set up with a dictionary browsers don't have
+        struct ZstdContext {
+            ZstdContext() : cctx(ZSTD_createCCtx()) {
+            }
+
+            ~ZstdContext() {
+                ZSTD_freeCCtx(cctx);
+            }
+
+            ZSTD_CCtx *cctx;
+        };
+
+        static ZstdContext &zstdContext() {
+            static thread_local ZstdContext context;
+            return context;
+        }
+#endif
+    };
+
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <atomic>
+
+#include "attr.h"
+
+namespace http_server {
+
+    // The response of an asynchronous handler, sent when the handler calls send().
+    //
+    // The handler may keep the responder and send from any thread after it returns, e.g. once a slow query
+    // on another thread is done. The request stays valid as long as the responder. A responder released
+    // without send() answers with 500, so the connection isn't left waiting.
+    class HttpResponder {
+    public:
+        // called once, on the thread that sends, with the complete response
+        using DoneCallback = std::function<void(HttpResponsePtr)>;
+
+        HttpResponder(std::shared_ptr<HttpRequest> req, HttpHeaders const &headers, DoneCallback done)
+                : req_(std::move(req)), done_(std::move(done)) {
+            resp_ = make_response(std::piecewise_construct, std::make_tuple(), std::make_tuple(headers));
+        }
+
+        ~HttpResponder() {
+            if (!sent_) {
+                Logger::error("HttpResponder", "Http responder released without a response, target={}.",
+                              req_->target().to_string());
+                send(HttpStatus::internal_server_error);
+            }
+        }
+
+        HttpResponder(const HttpResponder &) = delete;
+
+        HttpResponder &operator=(const HttpResponder &) = delete;
+
+        HttpRequest &request() {
+            return *req_;
+        }
+
+        // fill it in before send()
+        HttpResponse &response() {
+            return *resp_;
+        }
+
+        // only the first call sends
+        void send() {
+            if (sent_.exchange(true)) {
+                return;
+            }
+            done();
+        }
+
+        // an error response in place of whatever the handler set, the send is claimed before the response
+        // is touched, another thread may be sending it
+        void send(HttpStatus status) {
+            if (sent_.exchange(true)) {
+                return;
+            }
+            resp_->result(status);
+            resp_->set(HttpHeader::content_type, "text/plain");
+            resp_->body() = "Error: " + std::to_string(resp_->result_int());
+            done();
+        }
+
+        bool sent() const {
+            return sent_;
+        }
+
+    private:
+        // the caller won sent_
+        void done() {
+            done_(std::move(resp_));
+        }
+
+        std::shared_ptr<HttpRequest> req_;
+        HttpResponsePtr resp_;
+        DoneCallback done_;
+        std::atomic_bool sent_{false};
+    };
+
+}
@@ -28,28 +28,120 @@ namespace http_server {
             attr_.webroot = webroot;
         }
 
-        // set the socket timeout
+        // Files of the webroot up to max_file_size are kept in memory with their compressed variants, up to
+        // capacity bytes in total. Larger files are sent from disk.
+        void static_cache(std::size_t capacity, std::size_t max_file_size) {
+            attr_.static_files.limits(capacity, max_file_size);
+        }
+
+        // Compress the text responses of the handlers with at least min_size bytes, with the best coding the
+        // client accepts. On by default.
+        void compression(bool enabled, std::size_t min_size = 1024) {
+            attr_.compression = enabled;
+            attr_.compression_min_size = min_size;
+        }
+
+        // The responses a connection queues for pipelined requests, they are written in the order of the
+        // requests. The connection reads no more requests while it has this many.
+        void pipeline_limit(std::size_t limit) {
+            attr_.pipeline_limit = limit > 0 ? limit : 1;
+        }
+
+        // The largest request header and body, larger requests are answered with 431 and 413 and their
+        // connection is closed. 8KB and 1MB by default.
+        void request_limits(std::size_t header_limit, std::size_t body_limit) {
+            attr_.header_limit = header_limit;
+            attr_.body_limit = body_limit;
+        }
+
+        // set the websocket ping interval
         void timeout(std::chrono::seconds timeout) {
             attr_.timeout = timeout;
         }
 
-        void on_http(std::string url_regx, HttpMethod method, HttpHandler handler) {
-            if (attr_.http_routes.find(url_regx) == attr_.http_routes.end()) {
-                attr_.http_routes[url_regx] = {{static_cast<int>(method), handler}};
-            } else {
-                attr_.http_routes.at(url_regx)[static_cast<int>(method)] = handler;
-            }
+        // A connection is closed when the header of a request or its body takes longer than these from their
+        // start, a write of a response takes longer than write, or no request starts within idle after the
+        // last response.
+        void http_timeouts(std::chrono::seconds header, std::chrono::seconds body, std::chrono::seconds write,
+                           std::chrono::seconds idle) {
+            attr_.header_timeout = header;
+            attr_.body_timeout = body;
+            attr_.write_timeout = write;
+            attr_.idle_timeout = idle;
+        }
+
+        // Requests served per connection before it is closed, 0 for no limit. 1000 by default.
+        void max_requests(std::size_t requests) {
+            attr_.max_requests = requests;
+        }
+
+        // Open http and websocket connections, new ones wait in the listen backlog while there are this many.
+        // 0 for no limit, 10000 by default. With engines every acceptor may take one more connection than this.
+        void max_connections(std::size_t connections) {
+            attr_.max_connections = connections;
+        }
+
+        // The url is a path like "/robots/{id}/pose", where "{id}" matches one segment and is passed to the
+        // handler in its params, or a regex for anything else.
+        void on_http(std::string url_regx, HttpMethod method, HttpParamHandler handler) {
+            attr_.http_routes.add(url_regx, method, HttpRoute{std::move(handler), nullptr, nullptr});
             Logger::info("HttpServer", "Register http handler, http_method={}, url={}",
                          http::to_string(method).to_string(), url_regx);
         }
 
+        void on_http(std::string url_regx, HttpMethod method, HttpHandler handler) {
+            on_http(std::move(url_regx), method, withoutParams(std::move(handler)));
+        }
+
+        void on_http(std::string url_regx, HttpParamHandler handler) {
+            attr_.http_routes.add(url_regx, HttpMethod::unknown, HttpRoute{std::move(handler), nullptr, nullptr});
+            Logger::info("HttpServer", "Register http handler, http_method=ALL, url={}", url_regx);
+        }
+
         void on_http(std::string url_regx, HttpHandler handler) {
-            if (attr_.http_routes.find(url_regx) == attr_.http_routes.end()) {
-                attr_.http_routes[url_regx] = {{static_cast<int>(HttpMethod::unknown), handler}};
-            } else {
-                attr_.http_routes.at(url_regx)[static_cast<int>(HttpMethod::unknown)] = handler;
+            on_http(std::move(url_regx), withoutParams(std::move(handler)));
+        }
+
+        // The handler writes the response through the stream while it produces it, for large exports and
+        // server-sent events. It may keep the stream and write from other threads after it returns.
+        void on_stream(std::string url_regx, HttpMethod method, HttpStreamHandler handler) {
+            attr_.http_routes.add(url_regx, method, HttpRoute{nullptr, std::move(handler), nullptr});
+            Logger::info("HttpServer", "Register http stream handler, http_method={}, url={}",
+                         http::to_string(method).to_string(), url_regx);
+        }
+
+        void on_stream(std::string url_regx, HttpStreamHandler handler) {
+            attr_.http_routes.add(url_regx, HttpMethod::unknown, HttpRoute{nullptr, std::move(handler), nullptr});
+            Logger::info("HttpServer", "Register http stream handler, http_method=ALL, url={}", url_regx);
+        }
+
+        // The handler doesn't block the io thread, it responds through the responder when the response is
+        // ready, from any thread.
+        void on_async(std::string url_regx, HttpMethod method, HttpAsyncHandler handler) {
+            attr_.http_routes.add(url_regx, method, HttpRoute{nullptr, nullptr, std::move(handler)});
+            Logger::info("HttpServer", "Register http async handler, http_method={}, url={}",
+                         http::to_string(method).to_string(), url_regx);
+        }
+
+        void on_async(std::string url_regx, HttpAsyncHandler handler) {
+            attr_.http_routes.add(url_regx, HttpMethod::unknown, HttpRoute{nullptr, nullptr, std::move(handler)});
+            Logger::info("HttpServer", "Register http async handler, http_method=ALL, url={}", url_regx);
+        }
+
+        // Run the http and async handlers on a pool of this many threads, so that a slow handler doesn't hold
+        // up the other sessions of its io thread. Call it before start. Stream handlers stay on the io threads.
+        void workers(std::size_t threads) {
+            attr_.workers.reset(threads > 0 ? new asio::thread_pool(threads) : nullptr);
+        }
+
+        // Run count io_contexts with one thread each instead of the threads of the constructor on one. Every
+        // io_context has its own acceptor on the port and its own sessions, so accepts and completions don't
+        // contend across threads. 0 for one per core. Call it before start, needs SO_REUSEPORT.
+        void engines(int count) {
+            if (count <= 0) {
+                count = static_cast<int>(std::thread::hardware_concurrency());
             }
-            Logger::info("HttpServer", "Register http handler, http_method=ALL, url={}", url_regx);
+            engine_count_ = count > 0 ? count : 1;
         }
 
         void on_websocket(WebsocketHandler handler) {
@@ -63,20 +155,40 @@ namespace http_server {
         }
 
         void start(bool sync = false) {
-            acceptor_ = std::make_shared<Acceptor>(
-                    ioc_,
-                    tcp::endpoint{asio::ip::make_address(host_), port_},
-                    attr_);
-            acceptor_->listen();
-
-            // Run the I/O service on the requested number of threads
-            io_threads_.reserve(threads_);
-            for (int i = 0; i < threads_; i++) {
-                io_threads_.emplace_back([this] {
-                    ioc_.run();
-                });
+            // one io_context on all the io threads, or an engine per thread
+            bool reuse_port = engine_count_ > 0;
+#ifndef SO_REUSEPORT
+            if (reuse_port) {
+                Logger::error("HttpServer", "No SO_REUSEPORT, engines run on one io_context, engines={}.",
+                              engine_count_);
+                threads_ = engine_count_;
+                reuse_port = false;
+            }
+#endif
+            int engines = reuse_port ? engine_count_ : 1;
+            int threads = reuse_port ? 1 : threads_;
+            for (int i = 0; i < engines; i++) {
+                engines_.emplace_back(new Engine(threads));
+                Engine &engine = *engines_.back();
+                engine.acceptor = std::make_shared<Acceptor>(
+                        engine.ioc,
+                        tcp::endpoint{asio::ip::make_address(host_), port_},
+                        attr_, engine.sessions, reuse_port);
+                engine.acceptor->listen();
+            }
+
+            // Run the I/O services on the requested number of threads
+            io_threads_.reserve(engines * threads);
+            for (auto &engine : engines_) {
+                asio::io_context &ioc = engine->ioc;
+                for (int i = 0; i < threads; i++) {
+                    io_threads_.emplace_back([&ioc] {
+                        ioc.run();
+                    });
+                }
             }
-            Logger::info("HttpServer", "Http server started successful, host={}, port={}.", host_, port_);
+            Logger::info("HttpServer", "Http server started successful, host={}, port={}, engines={}, threads={}.",
+                         host_, port_, engines, engines * threads);
 
             if (sync) {
                 for (std::thread &t : io_threads_) {
@@ -90,18 +202,37 @@ namespace http_server {
         }
 
         void broadcast(std::shared_ptr<std::vector<char>> data) {
-            std::lock_guard<std::mutex> locker(attr_.websocket_mutex);
-            for (auto const session : attr_.websocket_sessions) {
-                session->send(data);
+            for (auto &engine : engines_) {
+                std::lock_guard<std::mutex> locker(engine->sessions.websocket_mutex);
+                for (auto const session : engine->sessions.websocket_sessions) {
+                    session->send(data);
+                }
             }
         }
 
     private:
-        std::shared_ptr<Acceptor> acceptor_;
+        static HttpParamHandler withoutParams(HttpHandler handler) {
+            return [handler](HttpRequest &req, HttpResponse &resp, const HttpParams &) {
+                handler(req, resp);
+            };
+        }
+
+        // an io_context with its acceptor and the sessions it runs
+        struct Engine {
+            explicit Engine(int threads) : ioc(threads) {
+            }
+
+            asio::io_context ioc;
+            Sessions sessions;
+            std::shared_ptr<Acceptor> acceptor;
+        };
+
         std::string host_;
         unsigned short port_;
         int threads_;
-        asio::io_context ioc_;
+        // io_contexts with a thread each, 0 for one io_context run by threads_ threads
+        int engine_count_{0};
+        std::vector<std::unique_ptr<Engine>> engines_;
         std::vector<std::thread> io_threads_;
         Attr attr_;
 
@@ -2,19 +2,62 @@
 
 #pragma once
 
+#include <deque>
+#include <cstring>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+#endif
+
 #include "attr.h"
 #include "http_utils.h"
+#include "http_stream.h"
+#include "http_responder.h"
 #include "websocket_session.h"
 
 namespace http_server {
 
     // Handles an HTTP server connection
     class HttpSession : public std::enable_shared_from_this<HttpSession> {
+        // the place of a response in the pipeline, one of them is set once the response is ready, a handler
+        // response or the write of any other kind
+        struct ResponseSlot {
+            HttpResponsePtr response;
+            std::function<void()> write;
+        };
+
+        using ResponseSlotPtr = std::shared_ptr<ResponseSlot>;
+
+#ifdef __linux__
+        // a response whose body is sent with sendfile(2) after the header
+        struct FileSend {
+            FileSend(int fd, std::uint64_t size, HttpHeaders const &headers)
+                    : fd(fd), size(size),
+                      resp(std::piecewise_construct, std::make_tuple(), std::make_tuple(headers)),
+                      serializer(resp) {
+            }
+
+            ~FileSend() {
+                ::close(fd);
+            }
+
+            int fd;
+            off_t offset{0};
+            std::uint64_t size;
+            http::response<http::empty_body> resp;
+            http::response_serializer<http::empty_body> serializer;
+        };
+#endif
+
     public:
         // Take ownership of the socket
-        HttpSession(tcp::socket socket, Attr &attr)
-                : socket_(std::move(socket)), strand_(socket_.get_executor()), attr_(attr),
-                  timer_(socket_.get_executor().context(), (std::chrono::steady_clock::time_point::max) ()) {
+        HttpSession(tcp::socket socket, Attr &attr, Sessions &sessions)
+                : stream_(std::move(socket)), strand_(HttpUtils::io_executor(stream_)),
+                  read_buffer_(attr.header_limit + READ_SIZE), attr_(attr), sessions_(sessions),
+                  idle_timer_(stream_.get_executor(), (std::chrono::steady_clock::time_point::max) ()),
+                  file_timer_(stream_.get_executor(), (std::chrono::steady_clock::time_point::max) ()) {
         }
 
         // Start the asynchronous operation
@@ -32,54 +75,260 @@ namespace http_server {
         }
 
         void do_read() {
-            // Set the timer
-//            timer_.expires_after(attr_.timeout);
+            reading_ = true;
+            if (read_buffer_.size() == 0) {
+                wait_request();
+            } else {
+                // a pipelined request is in the buffer already
+                read_header();
+            }
+        }
+
+        // The connection is idle until the first bytes of the next request. The idle timeout only runs while
+        // no response is queued, a slow handler doesn't cost the client its connection.
+        void wait_request() {
+            waiting_ = true;
+            if (queue_.empty()) {
+                arm_idle_timer();
+            }
+            stream_.expires_never();
+            auto self = shared_from_this();
+            stream_.async_read_some(
+                    read_buffer_.prepare(READ_SIZE),
+                    asio::bind_executor(
+                            strand_,
+                            HttpUtils::pooled([this, self](boost::system::error_code ec, std::size_t bytes_transferred) {
+                                waiting_ = false;
+                                idle_timer_.cancel();
+                                read_buffer_.commit(bytes_transferred);
+                                if (ec) {
+                                    on_read_error(ec);
+                                    return;
+                                }
+                                read_header();
+                            })));
+        }
+
+        void arm_idle_timer() {
+            idle_timer_.expires_after(attr_.idle_timeout);
+            auto self = shared_from_this();
+            idle_timer_.async_wait(
+                    asio::bind_executor(
+                            strand_,
+                            HttpUtils::pooled([this, self](boost::system::error_code ec) {
+                                if (ec == asio::error::operation_aborted) {
+                                    return;
+                                }
+                                if (waiting_ && queue_.empty()) {
+                                    do_shutdown("idle_timeout");
+                                }
+                            })));
+        }
+
+        // the header within header_timeout, then the body within body_timeout
+        void read_header() {
+            // Make the request empty before reading, otherwise the operation behavior is undefined. The body
+            // of the previous request is reused, its capacity is kept.
+            parser_.emplace(std::piecewise_construct, std::make_tuple(std::move(spare_body_)));
+            parser_->header_limit(static_cast<std::uint32_t>(attr_.header_limit));
+            parser_->body_limit(attr_.body_limit);
+            stream_.expires_after(attr_.header_timeout);
+            auto self = shared_from_this();
+            http::async_read_header(
+                    stream_, read_buffer_, *parser_,
+                    asio::bind_executor(
+                            strand_,
+                            HttpUtils::pooled([this, self](boost::system::error_code ec, std::size_t bytes_transferred) {
+                                if (ec) {
+                                    on_read_error(ec);
+                                    return;
+                                }
+                                if (parser_->is_done()) {
+                                    on_request();
+                                    return;
+                                }
+                                stream_.expires_after(attr_.body_timeout);
+                                http::async_read(
+                                        stream_, read_buffer_, *parser_,
+                                        asio::bind_executor(
+                                                strand_,
+                                                HttpUtils::pooled([this, self](boost::system::error_code ec, std::size_t) {
+                                                    if (ec) {
+                                                        on_read_error(ec);
+                                                        return;
+                                                    }
+                                                    on_request();
+                                                })));
+                            })));
+        }
+
+        void on_read_error(boost::system::error_code ec) {
+            reading_ = false;
+            if (ec == asio::error::operation_aborted) {
+                return;
+            }
+            // This means they closed the connection
+            if (ec == http::error::end_of_stream || ec == asio::error::eof) {
+                do_shutdown("read_end_of_stream");
+                return;
+            }
+            if (ec == beast::error::timeout) {
+                do_shutdown("read_timeout");
+                return;
+            }
+            if (ec == http::error::body_limit) {
+                reject(HttpStatus::payload_too_large);
+                return;
+            }
+            if (ec == http::error::header_limit || ec == http::error::buffer_overflow) {
+                reject(HttpStatus::request_header_fields_too_large);
+                return;
+            }
+            Logger::error("HttpSession", "Http read data error, error_message={}.", ec.message());
+            do_shutdown("read_error");
+        }
 
-            // Make the request empty before reading,
-            // otherwise the operation behavior is undefined.
+        void on_request() {
+            reading_ = false;
+            req_ = parser_->release();
+            requests_++;
+
+            // See if it is a WebSocket Upgrade
+            if (websocket::is_upgrade(req_)) {
+                // after the responses of the requests before it
+                last_request_ = true;
+                ready(reserve(), [this]() {
+                    handle_websocket();
+                });
+                return;
+            }
+
+            // the last request of the connection is answered with "Connection: close"
+            if (attr_.max_requests > 0 && requests_ >= attr_.max_requests) {
+                req_.keep_alive(false);
+            }
+
+            // the response of each request takes the next place in the queue
+            current_ = reserve();
+            if (!req_.keep_alive()) {
+                last_request_ = true;
+            }
+            // Send the response
+            handle_http_request();
+            current_ = nullptr;
+            if (!streaming_) {
+                recycle_body();
+            }
+
+            // pipelined requests are read while the responses are on their way
+            maybe_read();
+        }
+
+        // The request that can't be read whole is answered, and the connection closed after it, the rest of
+        // the request is never read.
+        void reject(HttpStatus status) {
             req_ = {};
+            req_.keep_alive(false);
+            last_request_ = true;
+            current_ = reserve();
+            handle_error(status);
+            current_ = nullptr;
+        }
+
+        // keeps the body of a handled request for the next one, unless a handler took it or it's large
+        void recycle_body() {
+            std::string &body = req_.body();
+            if (body.capacity() > MAX_SPARE_BODY || body.capacity() <= spare_body_.capacity()) {
+                return;
+            }
+            spare_body_ = std::move(body);
+            spare_body_.clear();
+        }
+
+        // reads the next request unless the queue is full, a stream is open or the connection is ending
+        void maybe_read() {
+            if (reading_ || streaming_ || last_request_ || closed_ || queue_.size() >= attr_.pipeline_limit) {
+                return;
+            }
+            do_read();
+        }
+
+        // a place in the response queue, for a request that was read
+        ResponseSlotPtr reserve() {
+            ResponseSlotPtr slot = std::allocate_shared<ResponseSlot>(util::PooledAllocator<ResponseSlot>());
+            queue_.push_back(slot);
+            return slot;
+        }
+
+        // The response of the slot is ready, write is called once all the responses before it are written.
+        // It ends with written().
+        void ready(ResponseSlotPtr const &slot, std::function<void()> write) {
+            slot->write = std::move(write);
+            flush();
+        }
+
+        // start writing the response at the front of the queue if it is ready
+        void flush() {
+            if (writing_ || closed_ || queue_.empty() || (!queue_.front()->response && !queue_.front()->write)) {
+                return;
+            }
+            writing_ = true;
+            if (queue_.front()->response) {
+                do_write(std::move(queue_.front()->response));
+                return;
+            }
+            std::function<void()> write = std::move(queue_.front()->write);
+            write();
+        }
 
-            // Read a request
-            http::async_read(socket_, read_buffer_, req_,
-                             asio::bind_executor(
-                                     strand_,
-                                     [this](boost::system::error_code ec, std::size_t bytes_transferred) {
-                                         // happens when the timer closes the socket
-                                         if (ec == asio::error::operation_aborted) {
-                                             return;
-                                         }
-                                         // This means they closed the connection
-                                         if (ec == http::error::end_of_stream) {
-                                             do_shutdown("read_end_of_stream");
-                                             return;
-                                         }
-                                         if (ec) {
-                                             Logger::error("HttpSession", "Http read data error, error_message={}.",
-                                                           ec.message());
-                                             return;
-                                         }
-
-                                         // See if it is a WebSocket Upgrade
-                                         if (websocket::is_upgrade(req_)) {
-                                             handle_websocket();
-                                         } else {
-                                             // Send the response
-                                             handle_http_request();
-
-                                             do_read();
-                                         }
-                                     }));
-        }
-
-        template<typename T>
-        void do_write(std::shared_ptr<http::response<T>> resp) {
-            this->resp_ = resp;
+        // the response at the front of the queue was written
+        void written(bool keep_alive) {
+            writing_ = false;
+            if (!queue_.empty()) {
+                queue_.pop_front();
+            }
+            if (!keep_alive) {
+                // This means we should close the connection, usually because
+                // the response indicated the "Connection: close" semantic.
+                do_shutdown("write_eof");
+                return;
+            }
+            flush();
+            if (queue_.empty() && waiting_) {
+                arm_idle_timer();
+            }
+            maybe_read();
+        }
+
+        // the response goes out after the ones of the earlier requests
+        template<typename Response>
+        void respond(std::shared_ptr<Response> resp) {
+            respond(current_, std::move(resp));
+        }
+
+        template<typename Response>
+        void respond(ResponseSlotPtr const &slot, std::shared_ptr<Response> resp) {
+            ready(slot, [this, resp]() {
+                do_write(resp);
+            });
+        }
+
+        // the common case, without a std::function to allocate
+        void respond(ResponseSlotPtr const &slot, HttpResponsePtr resp) {
+            slot->response = std::move(resp);
+            flush();
+        }
+
+        template<typename Response>
+        void do_write(std::shared_ptr<Response> resp) {
+            auto self = shared_from_this();
+            stream_.expires_after(attr_.write_timeout);
             http::async_write(
-                    socket_,
+                    stream_,
                     *resp,
                     asio::bind_executor(
                             strand_,
-                            [this, resp](boost::system::error_code ec, std::size_t bytes_transferred) {
+                            HttpUtils::pooled([this, self, resp](boost::system::error_code ec, std::size_t bytes_transferred) {
                                 // Happens when the timer closes the socket
                                 if (ec == asio::error::operation_aborted) {
                                     return;
@@ -87,25 +336,34 @@ namespace http_server {
 
                                 if (ec) {
                                     Logger::error("HttpSession", "Http write error,  error_message={}.", ec.message());
+                                    do_shutdown("write_error");
                                     return;
                                 }
-                                if (resp->need_eof()) {
-                                    // This means we should close the connection, usually because
-                                    // the response indicated the "Connection: close" semantic.
-                                    do_shutdown("write_eof");
-                                }
-                            }));
+                                written(!resp->need_eof());
+                            })));
         }
 
         void do_shutdown(std::string reason) {
+            if (closed_) {
+                return;
+            }
+            closed_ = true;
+            // drops the responses that can't be sent anymore
+            queue_.clear();
+            idle_timer_.cancel();
+            file_timer_.cancel();
+            // the peer may be gone already
+            beast::error_code ec;
+            tcp::endpoint remote = stream_.socket().remote_endpoint(ec);
             Logger::info("HttpSession", "Socket shutdown[{}], and remove http session, host={}, port={}.", reason,
-                         socket_.remote_endpoint().address().to_string(), socket_.remote_endpoint().port());
+                         remote.address().to_string(), remote.port());
             // Send a TCP shutdown
-            beast::error_code ec;
-            socket_.shutdown(tcp::socket::shutdown_both, ec);
+            stream_.socket().shutdown(tcp::socket::shutdown_both, ec);
             // At this point the connection is closed gracefully
-            std::lock_guard<std::mutex> locker(attr_.http_mutex);
-            attr_.http_sessions.erase(shared_from_this());
+            std::lock_guard<std::mutex> locker(sessions_.http_mutex);
+            if (sessions_.http_sessions.erase(shared_from_this()) > 0) {
+                attr_.connections--;
+            }
         }
 
         HttpStatus handle_static() {
@@ -117,14 +375,204 @@ namespace http_server {
                 return HttpStatus::not_found;
             }
 
-            std::string path = HttpUtils::path_cat(attr_.webroot, req_.target().to_string());
-            if (req_.target().back() == '/') {
+            // the query doesn't select a different file
+            beast::string_view target = req_.target();
+            target = target.substr(0, target.find('?'));
+            std::string path = HttpUtils::path_cat(attr_.webroot, target.to_string());
+            if (target.back() == '/') {
                 path.append(attr_.index_file);
             }
 
+            StaticFilePtr file = attr_.static_files.get(path);
+            if (!file) {
+                return HttpStatus::not_found;
+            }
+
+            if (not_modified(*file)) {
+                HttpResponsePtr resp = make_response(HttpStatus::not_modified, req_.version());
+                resp->set(HttpHeader::etag, file->etag);
+                resp->set(HttpHeader::last_modified, file->headers[HttpHeader::last_modified]);
+                resp->keep_alive(req_.keep_alive());
+                respond(resp);
+                return HttpStatus::ok;
+            }
+
+            if (!file->body) {
+                return send_file(file);
+            }
+
+            // the smallest variant the client accepts
+            std::shared_ptr<const std::string> body = file->body;
+            beast::string_view encoding;
+            beast::string_view accept_encoding = req_[HttpHeader::accept_encoding];
+            if (file->brotli && HttpUtils::accepts_encoding(accept_encoding, "br")) {
+                body = file->brotli;
+                encoding = "br";
+            } else if (file->gzip && HttpUtils::accepts_encoding(accept_encoding, "gzip")) {
+                body = file->gzip;
+                encoding = "gzip";
+            }
+
+            std::uint64_t const size = body->size();
+            if (req_.method() == http::verb::head) {
+                body = nullptr;
+            }
+            SharedResponsePtr resp = SharedResponsePtr(new SharedResponse{
+                    std::piecewise_construct,
+                    std::make_tuple(std::move(body)),
+                    std::make_tuple(attr_.http_headers)
+            });
+            for (auto const &field : file->headers) {
+                resp->set(field.name(), field.value());
+            }
+            if (file->gzip || file->brotli) {
+                resp->set(HttpHeader::vary, "Accept-Encoding");
+            }
+            if (!encoding.empty()) {
+                resp->set(HttpHeader::content_encoding, encoding);
+            }
+            resp->version(req_.version());
+            resp->keep_alive(req_.keep_alive());
+            resp->content_length(size);
+            respond(resp);
+            return HttpStatus::ok;
+        }
+
+        // conditional GET, If-None-Match takes precedence over If-Modified-Since
+        bool not_modified(StaticFile const &file) {
+            beast::string_view if_none_match = req_[HttpHeader::if_none_match];
+            if (!if_none_match.empty()) {
+                if (if_none_match == "*") {
+                    return true;
+                }
+                // the weak comparison, ignoring the W/ prefix
+                auto opaque = [](std::string tag) {
+                    return tag.compare(0, 2, "W/") == 0 ? tag.substr(2) : tag;
+                };
+                for (auto const &tag : HttpUtils::split(if_none_match.to_string(), ",")) {
+                    if (opaque(HttpUtils::trim(tag)) == opaque(file.etag)) {
+                        return true;
+                    }
+                }
+                return false;
+            }
+            beast::string_view if_modified_since = req_[HttpHeader::if_modified_since];
+            if (!if_modified_since.empty()) {
+                std::time_t since = HttpUtils::parse_http_date(if_modified_since);
+                return since != -1 && file.mtime <= since;
+            }
+            return false;
+        }
+
+#ifdef __linux__
+
+        // A file too large for the cache goes from the page cache to the socket with sendfile(2), without
+        // copies through user space buffers.
+        HttpStatus send_file(StaticFilePtr file) {
+            int fd = ::open(file->path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0) {
+                return HttpStatus::not_found;
+            }
+            std::shared_ptr<FileSend> send(new FileSend(fd, file->size, attr_.http_headers));
+            for (auto const &field : file->headers) {
+                send->resp.set(field.name(), field.value());
+            }
+            send->resp.version(req_.version());
+            send->resp.keep_alive(req_.keep_alive());
+            send->resp.content_length(file->size);
+            if (req_.method() == http::verb::head) {
+                send->offset = static_cast<off_t>(send->size);
+            }
+            ready(current_, [this, send]() {
+                do_write_file(send);
+            });
+            return HttpStatus::ok;
+        }
+
+        void do_write_file(std::shared_ptr<FileSend> send) {
+            auto self = shared_from_this();
+            stream_.expires_after(attr_.write_timeout);
+            http::async_write_header(
+                    stream_,
+                    send->serializer,
+                    asio::bind_executor(
+                            strand_,
+                            [this, self, send](boost::system::error_code ec, std::size_t bytes_transferred) {
+                                if (ec == asio::error::operation_aborted) {
+                                    return;
+                                }
+                                if (ec) {
+                                    Logger::error("HttpSession", "Http write error,  error_message={}.", ec.message());
+                                    do_shutdown("write_error");
+                                    return;
+                                }
+                                do_send_file(send);
+                            }));
+        }
+
+        void do_send_file(std::shared_ptr<FileSend> send) {
+            boost::system::error_code ec;
+            tcp::socket &socket = stream_.socket();
+            socket.native_non_blocking(true, ec);
+            while (static_cast<std::uint64_t>(send->offset) < send->size) {
+                ssize_t n = ::sendfile(socket.native_handle(), send->fd, &send->offset,
+                                       send->size - static_cast<std::uint64_t>(send->offset));
+                if (n > 0 || (n < 0 && errno == EINTR)) {
+                    continue;
+                }
+                if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                    // wait until the socket buffer has room again, the wait bypasses the expiry of the stream
+                    auto self = shared_from_this();
+                    arm_file_timer();
+                    socket.async_wait(tcp::socket::wait_write,
+                                      asio::bind_executor(
+                                              strand_,
+                                              [this, self, send](boost::system::error_code ec) {
+                                                  file_timer_.cancel();
+                                                  if (ec == asio::error::operation_aborted) {
+                                                       return;
+                                                   }
+                                                  if (ec) {
+                                                      Logger::error("HttpSession", "Http write error,  error_message={}.",
+                                                                    ec.message());
+                                                      do_shutdown("write_error");
+                                                      return;
+                                                  }
+                                                  do_send_file(send);
+                                              }));
+                    return;
+                }
+                // the file was truncated, the response can't be completed
+                Logger::error("HttpSession", "Sendfile error, path_size={}, offset={}, error_message={}.",
+                              send->size, send->offset, n < 0 ? std::strerror(errno) : "end of file");
+                do_shutdown("sendfile_error");
+                return;
+            }
+            written(!send->resp.need_eof());
+        }
+
+        void arm_file_timer() {
+            file_timer_.expires_after(attr_.write_timeout);
+            auto self = shared_from_this();
+            file_timer_.async_wait(
+                    asio::bind_executor(
+                            strand_,
+                            [this, self](boost::system::error_code ec) {
+                                if (ec == asio::error::operation_aborted) {
+                                    return;
+                                }
+                                boost::system::error_code ignored;
+                                stream_.socket().cancel(ignored);
+                                do_shutdown("write_timeout");
+                            }));
+        }
+
+#else
+
+        HttpStatus send_file(StaticFilePtr file) {
             boost::system::error_code ec;
             http::file_body::value_type body;
-            body.open(path.data(), beast::file_mode::scan, ec);
+            body.open(file->path.data(), beast::file_mode::scan, ec);
             if (ec) {
                 return HttpStatus::not_found;
             }
@@ -135,83 +583,161 @@ namespace http_server {
                     std::make_tuple(std::move(body)),
                     std::make_tuple(attr_.http_headers)
             });
+            for (auto const &field : file->headers) {
+                resp->set(field.name(), field.value());
+            }
             resp->version(req_.version());
             resp->keep_alive(req_.keep_alive());
             resp->content_length(size);
-            resp->set(HttpHeader::content_type, HttpUtils::mime_type(path));
-            do_write(resp);
+            respond(resp);
             return HttpStatus::ok;
         }
 
+#endif
+
         HttpStatus handle_dynamic() {
             if (attr_.http_routes.empty()) {
                 return HttpStatus::not_found;
             }
 
-            // regex variables
-            std::smatch rx_match{};
-            std::regex_constants::syntax_option_type const rx_opts{std::regex::ECMAScript};
-            std::regex_constants::match_flag_type const rx_flgs{std::regex_constants::match_not_null};
+            // the request path without the query parameters
+            beast::string_view target = req_.target();
+            beast::string_view path = target.substr(0, target.find('?'));
 
-            // the request path
-            std::string path{req_.target().to_string()};
+            HttpParams params;
+            HttpRoute const *route = attr_.http_routes.find(path, req_.method(), params);
+            if (route && route->stream_handler) {
+                return handle_stream(*route, params);
+            }
+            if (route && (route->async_handler || attr_.workers)) {
+                return handle_async(*route, std::move(params));
+            }
+            if (route) {
+                // set callback function
+                HttpResponsePtr resp = make_response();
+                try {
+                    // handle biz
+                    route->handler(req_, *resp, params);
+                }
+                catch (std::exception &e) {
+                    Logger::error("HttpSession", "Call http_handler error,  error_message={}.", e.what());
+                    return HttpStatus::internal_server_error;
+                }
+                resp->version(req_.version());
+                resp->keep_alive(req_.keep_alive());
+                compress(req_, *resp);
+                resp->content_length(resp->body().size());
 
-            // separate the query parameters
-            auto params = HttpUtils::split(path, "?", 1);
-            path = params.at(0);
+                respond(std::move(resp));
 
-            // iterate over routes
-            for (auto const &regex_method : attr_.http_routes) {
-                bool method_match{false};
-                auto match = regex_method.second.find(static_cast<int>(HttpMethod::unknown));
+                return HttpStatus::ok;
+            }
 
-                if (match != regex_method.second.end()) {
-                    method_match = true;
-                } else {
-                    match = regex_method.second.find(static_cast<int>(req_.method()));
+            return HttpStatus::not_found;
+        }
 
-                    if (match != regex_method.second.end()) {
-                        method_match = true;
+        // Runs the handler on the worker pool if there is one, and queues the response on the strand once it's
+        // sent. The request moves to the responder, it may outlive the next read.
+        HttpStatus handle_async(HttpRoute const &route, HttpParams params) {
+            auto self = shared_from_this();
+            ResponseSlotPtr slot = current_;
+            std::shared_ptr<HttpRequest> req = std::allocate_shared<HttpRequest>(util::PooledAllocator<HttpRequest>(),
+                                                                             std::move(req_));
+            HttpResponderPtr responder = std::make_shared<HttpResponder>(
+                    req, attr_.http_headers,
+                    [this, self, req, slot](HttpResponsePtr resp) {
+                        // compressed on the thread that sends, off the io thread with workers
+                        resp->version(req->version());
+                        resp->keep_alive(req->keep_alive());
+                        compress(*req, *resp);
+                        resp->content_length(resp->body().size());
+                        asio::post(strand_, [this, self, slot, resp]() {
+                            respond(slot, resp);
+                        });
+                    });
+
+            HttpRoute handlers = route;
+            auto call = [handlers, req, responder, params]() {
+                try {
+                    if (handlers.async_handler) {
+                        handlers.async_handler(*req, responder, params);
+                    } else {
+                        handlers.handler(*req, responder->response(), params);
+                        responder->send();
                     }
                 }
+                catch (std::exception &e) {
+                    Logger::error("HttpSession", "Call http_handler error,  error_message={}.", e.what());
+                    responder->send(HttpStatus::internal_server_error);
+                }
+            };
+            if (attr_.workers) {
+                asio::post(*attr_.workers, std::move(call));
+            } else {
+                call();
+            }
+            return HttpStatus::ok;
+        }
 
-                if (method_match) {
-                    std::regex rx_str{regex_method.first, rx_opts};
-                    if (std::regex_match(path, rx_match, rx_str, rx_flgs)) {
-                        // set callback function
-                        HttpResponsePtr resp = HttpResponsePtr(new HttpResponse());
-                        HttpHandler const &http_handler = match->second;
-                        try {
-                            // handle biz
-                            http_handler(req_, *resp);
-                        }
-                        catch (std::exception &e) {
-                            Logger::error("HttpSession", "Call http_handler error,  error_message={}.", e.what());
-                            return HttpStatus::internal_server_error;
-                        }
-                        resp->version(req_.version());
-                        resp->keep_alive(req_.keep_alive());
-                        resp->content_length(resp->body().size());
-
-                        do_write(std::move(resp));
-
-                        return HttpStatus::ok;
-                    }
+        // The stream starts writing when the responses before it are written. No request is read while it's open,
+        // the handler may use the request until it closes the stream.
+        HttpStatus handle_stream(HttpRoute const &route, HttpParams const &params) {
+            streaming_ = true;
+            auto self = shared_from_this();
+            HttpStreamPtr stream(new HttpStream(stream_, strand_, self, req_, attr_.http_headers, attr_.write_timeout,
+                                                [this, self](bool keep_alive) {
+                                                    streaming_ = false;
+                                                    written(keep_alive);
+                                                }));
+            try {
+                route.stream_handler(req_, stream, params);
+            }
+            catch (std::exception &e) {
+                Logger::error("HttpSession", "Call http_stream_handler error,  error_message={}.", e.what());
+                if (!stream->started()) {
+                    stream->discard();
+                    streaming_ = false;
+                    return HttpStatus::internal_server_error;
                 }
+                stream->close();
             }
+            ready(current_, [stream]() {
+                stream->begin();
+            });
+            return HttpStatus::ok;
+        }
 
-            return HttpStatus::not_found;
+        // compress the body with the coding the client prefers, unless the handler encoded it already
+        void compress(HttpRequest const &req, HttpResponse &resp) {
+            if (!attr_.compression || resp.body().size() < attr_.compression_min_size ||
+                resp.count(HttpHeader::content_encoding) ||
+                !HttpCompression::compressible(resp[HttpHeader::content_type])) {
+                return;
+            }
+            // caches must not hand the compressed body to a client that didn't ask for it
+            resp.set(HttpHeader::vary, "Accept-Encoding");
+            ContentEncoding encoding = HttpCompression::negotiate(req[HttpHeader::accept_encoding]);
+            if (encoding == ContentEncoding::IDENTITY) {
+                return;
+            }
+            std::vector<char> out;
+            if (!HttpCompression::compress(encoding, resp.body().data(), resp.body().size(), out) ||
+                out.size() >= resp.body().size()) {
+                return;
+            }
+            resp.body().assign(out.data(), out.size());
+            resp.set(HttpHeader::content_encoding, HttpCompression::name(encoding));
         }
 
         void handle_error(HttpStatus err) {
-            HttpResponsePtr res = HttpResponsePtr(new HttpResponse());
+            HttpResponsePtr res = make_response();
             res->version(req_.version());
             res->keep_alive(req_.keep_alive());
             res->result(err);
             res->set(HttpHeader::content_type, "text/plain");
             res->body() = "Error: " + std::to_string(res->result_int());
             res->content_length(res->body().size());
-            do_write(res);
+            respond(res);
         };
 
         void handle_http_request() {
@@ -246,21 +772,57 @@ namespace http_server {
         }
 
         void handle_websocket() {
-            WebsocketSessionPtr session(new WebsocketSession(std::move(socket_), attr_, std::move(req_)));
-            std::lock_guard<std::mutex> locker(attr_.websocket_mutex);
-            attr_.websocket_sessions.insert(session);
+            auto self = shared_from_this();
+            idle_timer_.cancel();
+            WebsocketSessionPtr session(new WebsocketSession(stream_.release_socket(), attr_, sessions_,
+                                                             std::move(req_)));
+            {
+                std::lock_guard<std::mutex> locker(sessions_.websocket_mutex);
+                sessions_.websocket_sessions.insert(session);
+            }
             Logger::info("HttpSession", "Create new websocket session, session_id={}.", session->session_id());
 
             session->do_accept();
+
+            // the connection belongs to the websocket session now, it counts as one still
+            closed_ = true;
+            std::lock_guard<std::mutex> locker(sessions_.http_mutex);
+            sessions_.http_sessions.erase(self);
         }
 
     private:
-        tcp::socket socket_;
+        // the reads before the first byte of a request aren't much larger than a request line and its headers
+        enum {
+            READ_SIZE = 4096,
+            // the largest body kept for the next request
+            MAX_SPARE_BODY = 64 * 1024
+        };
+
+        beast::tcp_stream stream_;
         asio::strand<asio::io_context::executor_type> strand_;
-        asio::steady_timer timer_;
         beast::flat_buffer read_buffer_;
         Attr &attr_;
+        Sessions &sessions_;
+        // the idle keep-alive timeout, and the write timeout of sendfile
+        asio::steady_timer idle_timer_;
+        asio::steady_timer file_timer_;
+        boost::optional<HttpRequestParser> parser_;
         HttpRequest req_;
-        std::shared_ptr<void> resp_;
+        std::string spare_body_;
+        // requests read on the connection, for max_requests
+        std::size_t requests_{0};
+        // the responses of the pipelined requests, in the order of the requests
+        std::deque<ResponseSlotPtr> queue_;
+        // the slot of the request being handled
+        ResponseSlotPtr current_;
+        bool reading_{false};
+        // no request bytes arrived yet, see wait_request
+        bool waiting_{false};
+        bool writing_{false};
+        // a stream handler is sending its response, the next request waits for it
+        bool streaming_{false};
+        // the request asked to close the connection or to upgrade it, nothing is read after it
+        bool last_request_{false};
+        bool closed_{false};
     };
 }
\ No newline at end of file
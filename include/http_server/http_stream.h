@@ -0,0 +1,289 @@
+#pragma once
+
+#include <deque>
+#include <atomic>
+
+#include "attr.h"
+
+namespace http_server {
+
+    // The response of a streaming handler, sent piece by piece while the handler produces it.
+    //
+    // Set the status and headers on response() before the first write. With HTTP/1.1 the body goes out
+    // with chunked encoding and the connection serves the next request after close(). HTTP/1.0 has no
+    // chunks, the body is sent as is and the connection is closed at the end.
+    //
+    // write and close may be called from any thread. Each write completes with its callback once the bytes
+    // are on the socket, or with false when the connection is gone, so a producer can wait for it or watch
+    // queued_bytes() instead of buffering the whole payload. A stream released without close() ends the
+    // connection, the client can't mistake the truncated body for a complete one.
+    //
+    // Nothing goes out before the session calls begin(), once the responses of the earlier pipelined
+    // requests are written.
+    class HttpStream : public std::enable_shared_from_this<HttpStream> {
+    public:
+        using WriteCallback = std::function<void(bool)>;
+        // called on the strand once the response is complete or failed, with whether to read the next request
+        using DoneCallback = std::function<void(bool)>;
+
+        HttpStream(beast::tcp_stream &stream, asio::strand<asio::io_context::executor_type> strand,
+                   std::shared_ptr<void> owner, HttpRequest const &req, HttpHeaders const &headers,
+                   std::chrono::seconds write_timeout, DoneCallback done)
+                : stream_(stream), strand_(strand), owner_(std::move(owner)), write_timeout_(write_timeout),
+                  resp_(std::piecewise_construct, std::make_tuple(), std::make_tuple(headers)),
+                  serializer_(resp_), done_(std::move(done)) {
+            resp_.version(req.version());
+            resp_.keep_alive(req.keep_alive());
+            chunked_ = req.version() >= 11;
+        }
+
+        ~HttpStream() {
+            if (begun_ && !finished_) {
+                DoneCallback done = std::move(done_);
+                std::shared_ptr<void> owner = owner_;
+                asio::post(strand_, [done, owner]() {
+                    done(false);
+                });
+            }
+        }
+
+        HttpStream(const HttpStream &) = delete;
+
+        HttpStream &operator=(const HttpStream &) = delete;
+
+        // the status and headers, only before the first write
+        http::response<http::empty_body> &response() {
+            return resp_;
+        }
+
+        // Make the response a stream of server-sent events, before the first write
+        void event_stream() {
+            resp_.set(HttpHeader::content_type, "text/event-stream");
+            resp_.set(HttpHeader::cache_control, "no-cache");
+        }
+
+        // false if the stream is closed or the connection is gone, the callback isn't called then
+        bool write(std::string data, WriteCallback callback = nullptr) {
+            if (closed_) {
+                return false;
+            }
+            if (data.empty()) {
+                // an empty chunk would end the body
+                if (callback) {
+                    callback(true);
+                }
+                return true;
+            }
+            started_ = true;
+            queued_bytes_ += data.size();
+            auto self = shared_from_this();
+            std::shared_ptr<Pending> pending(new Pending{std::move(data), std::move(callback), false});
+            asio::post(strand_, [self, pending]() {
+                self->queue_.push_back(pending);
+                self->pump();
+            });
+            return true;
+        }
+
+        // A server-sent event, each line of the data becomes a data field
+        bool event(const std::string &data, const std::string &event = "", const std::string &id = "",
+                   WriteCallback callback = nullptr) {
+            std::string message;
+            message.reserve(data.size() + event.size() + id.size() + 32);
+            if (!event.empty()) {
+                message.append("event: ").append(event).append("\n");
+            }
+            if (!id.empty()) {
+                message.append("id: ").append(id).append("\n");
+            }
+            std::size_t begin = 0;
+            while (true) {
+                std::size_t end = data.find('\n', begin);
+                message.append("data: ").append(data, begin, end == std::string::npos ? end : end - begin)
+                        .append("\n");
+                if (end == std::string::npos) {
+                    break;
+                }
+                begin = end + 1;
+            }
+            message.append("\n");
+            return write(std::move(message), std::move(callback));
+        }
+
+        // ends the body after the queued writes
+        void close() {
+            if (closed_.exchange(true)) {
+                return;
+            }
+            started_ = true;
+            auto self = shared_from_this();
+            std::shared_ptr<Pending> pending(new Pending{std::string(), nullptr, true});
+            asio::post(strand_, [self, pending]() {
+                self->queue_.push_back(pending);
+                self->pump();
+            });
+        }
+
+        bool closed() const {
+            return closed_;
+        }
+
+        // bytes given to write and not on the socket yet
+        std::size_t queued_bytes() const {
+            return queued_bytes_;
+        }
+
+        // called once, on the strand, when the connection fails while streaming
+        void on_error(std::function<void()> callback) {
+            auto self = shared_from_this();
+            asio::post(strand_, [self, callback]() {
+                if (self->failed_) {
+                    callback();
+                } else {
+                    self->error_callback_ = callback;
+                }
+            });
+        }
+
+        // whether write or close was called, a handler that threw before that gets an error response instead
+        bool started() const {
+            return started_;
+        }
+
+        // on the strand, when the stream's turn to write comes
+        void begin() {
+            begun_ = true;
+            pump();
+        }
+
+        // drop a stream that never started, its connection goes on with an error response
+        void discard() {
+            closed_ = true;
+            finished_ = true;
+        }
+
+    private:
+        struct Pending {
+            std::string data;
+            WriteCallback callback;
+            bool last;
+        };
+
+        // runs on the strand, writes the header and then the queued pieces one at a time
+        void pump() {
+            if (!begun_ || writing_ || failed_ || queue_.empty()) {
+                return;
+            }
+            writing_ = true;
+            auto self = shared_from_this();
+            // each piece within the timeout, a stream of events may be quiet in between
+            stream_.expires_after(write_timeout_);
+            if (!header_sent_) {
+                if (chunked_) {
+                    resp_.chunked(true);
+                } else {
+                    resp_.keep_alive(false);
+                }
+                http::async_write_header(stream_, serializer_, asio::bind_executor(
+                        strand_, [self](boost::system::error_code ec, std::size_t) {
+                            self->writing_ = false;
+                            if (ec) {
+                                self->fail(ec);
+                                return;
+                            }
+                            self->header_sent_ = true;
+                            self->pump();
+                        }));
+                return;
+            }
+
+            std::shared_ptr<Pending> pending = queue_.front();
+            queue_.pop_front();
+            auto written = [self, pending](boost::system::error_code ec, std::size_t) {
+                self->writing_ = false;
+                self->queued_bytes_ -= pending->data.size();
+                if (ec) {
+                    if (pending->callback) {
+                        pending->callback(false);
+                    }
+                    self->fail(ec);
+                    return;
+                }
+                if (pending->callback) {
+                    pending->callback(true);
+                }
+                if (pending->last) {
+                    self->finish(self->resp_.keep_alive());
+                    return;
+                }
+                self->pump();
+            };
+            if (pending->last) {
+                if (chunked_) {
+                    asio::async_write(stream_, http::make_chunk_last(), asio::bind_executor(strand_, written));
+                } else {
+                    asio::post(strand_, [written]() {
+                        written({}, 0);
+                    });
+                }
+            } else if (chunked_) {
+                asio::async_write(stream_, http::make_chunk(asio::buffer(pending->data)),
+                                  asio::bind_executor(strand_, written));
+            } else {
+                asio::async_write(stream_, asio::buffer(pending->data), asio::bind_executor(strand_, written));
+            }
+        }
+
+        void fail(boost::system::error_code ec) {
+            if (ec != asio::error::operation_aborted) {
+                Logger::error("HttpStream", "Http stream write error, error_message={}.", ec.message());
+            }
+            failed_ = true;
+            closed_ = true;
+            for (auto &pending : queue_) {
+                if (pending->callback) {
+                    pending->callback(false);
+                }
+                queued_bytes_ -= pending->data.size();
+            }
+            queue_.clear();
+            if (error_callback_) {
+                error_callback_();
+                error_callback_ = nullptr;
+            }
+            finish(false);
+        }
+
+        void finish(bool keep_alive) {
+            if (finished_) {
+                return;
+            }
+            finished_ = true;
+            done_(keep_alive);
+        }
+
+        beast::tcp_stream &stream_;
+        asio::strand<asio::io_context::executor_type> strand_;
+        // the session of the socket
+        std::shared_ptr<void> owner_;
+        std::chrono::seconds write_timeout_;
+        http::response<http::empty_body> resp_;
+        http::response_serializer<http::empty_body> serializer_;
+        DoneCallback done_;
+        bool chunked_{true};
+
+        std::atomic_bool closed_{false};
+        std::atomic_bool started_{false};
+        std::atomic_bool begun_{false};
+        std::atomic_size_t queued_bytes_{0};
+
+        // used on the strand only
+        std::deque<std::shared_ptr<Pending>> queue_;
+        bool header_sent_{false};
+        bool writing_{false};
+        bool failed_{false};
+        bool finished_{false};
+        std::function<void()> error_callback_;
+    };
+
+}
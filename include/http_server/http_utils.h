@@ -1,16 +1,55 @@
 #pragma once
 
+#include <ctime>
+#include <cstdlib>
 #include <memory>
 #include <string>
 #include <unordered_map>
 
 #include <boost/beast.hpp>
 
+#include "util/block_pool.h"
+
 namespace http_server {
     namespace beast = boost::beast;
 
+    // A completion handler whose operation state is allocated from the BlockPool of the thread. Asio and beast
+    // allocate through the associated allocator of the handler, so the reads and writes of a busy connection
+    // reuse the same few blocks instead of reaching the heap.
+    template<typename Handler>
+    class PooledHandler {
+    public:
+        using allocator_type = util::PooledAllocator<void>;
+
+        explicit PooledHandler(Handler handler) : handler_(std::move(handler)) {
+        }
+
+        allocator_type get_allocator() const noexcept {
+            return allocator_type();
+        }
+
+        template<typename... Args>
+        void operator()(Args &&... args) {
+            handler_(std::forward<Args>(args)...);
+        }
+
+    private:
+        Handler handler_;
+    };
+
     class HttpUtils {
     public:
+        template<typename Handler>
+        static PooledHandler<typename std::decay<Handler>::type> pooled(Handler &&handler) {
+            return PooledHandler<typename std::decay<Handler>::type>(std::forward<Handler>(handler));
+        }
+
+        // the executor of the io_context the stream runs on, strands of it can be bound to websocket handlers
+        template<typename Stream>
+        static boost::asio::io_context::executor_type io_executor(Stream &stream) {
+            return static_cast<boost::asio::io_context &>(stream.get_executor().context()).get_executor();
+        }
+
         static beast::string_view mime_type(beast::string_view path) {
             using beast::iequals;
             auto const ext = [&path] {
@@ -43,6 +82,62 @@ namespace http_server {
             return "application/text";
         }
 
+        // the IMF-fixdate of HTTP headers, like "Sun, 06 Nov 1994 08:49:37 GMT"
+        static std::string http_date(std::time_t time) {
+            std::tm tm{};
+            gmtime_r(&time, &tm);
+            char buf[64];
+            std::size_t n = std::strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+            return std::string(buf, n);
+        }
+
+        // -1 if the date isn't an IMF-fixdate
+        static std::time_t parse_http_date(beast::string_view date) {
+            std::string str(date.data(), date.size());
+            std::tm tm{};
+            const char *end = strptime(str.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+            if (!end || *end != '\0') {
+                return -1;
+            }
+            return timegm(&tm);
+        }
+
+        // whether an Accept-Encoding header value allows the content coding, "gzip" or "br" for example
+        static bool accepts_encoding(beast::string_view accept_encoding, beast::string_view coding) {
+            return encoding_quality(accept_encoding, coding) > 0;
+        }
+
+        // the q value of the content coding in an Accept-Encoding header value, 0 if it isn't acceptable
+        static double encoding_quality(beast::string_view accept_encoding, beast::string_view coding) {
+            double wildcard = 0;
+            for (auto const &item : split(std::string(accept_encoding.data(), accept_encoding.size()), ",")) {
+                auto parts = split(item, ";", 1);
+                std::string name = trim(parts.at(0));
+                double q = 1;
+                if (parts.size() == 2) {
+                    std::string param = trim(parts.at(1));
+                    if (param.compare(0, 2, "q=") == 0) {
+                        q = std::strtod(param.c_str() + 2, nullptr);
+                    }
+                }
+                if (beast::iequals(name, coding)) {
+                    return q;
+                }
+                if (name == "*") {
+                    wildcard = q;
+                }
+            }
+            return wildcard;
+        }
+
+        static std::string trim(std::string const &str) {
+            auto begin = str.find_first_not_of(" \t");
+            if (begin == std::string::npos) {
+                return "";
+            }
+            return str.substr(begin, str.find_last_not_of(" \t") - begin + 1);
+        }
+
         // serialize path and query parameters to the target
         static std::string params_serialize(std::unordered_multimap<std::string, std::string> &param) {
             std::string path;
@@ -188,7 +283,7 @@ namespace http_server {
         static std::shared_ptr<std::vector<char>> buffers_to_vector(T const &buffers) {
             std::shared_ptr<std::vector<char>> result(new std::vector<char>());
             result->reserve(boost::asio::buffer_size(buffers));
-            for (boost::asio::const_buffer buffer : beast::detail::buffers_range(buffers)) {
+            for (boost::asio::const_buffer buffer : beast::buffers_range(buffers)) {
                 result->insert(result->begin(), static_cast<char const*>(buffer.data()),
                                static_cast<char const*>(buffer.data()) + buffer.size());
             }
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <regex>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <unordered_map>
+
+#include <boost/beast.hpp>
+
+namespace http_server {
+
+    // path params of the matched route, "{name}" segments by name and regex groups by number from "1",
+    // the values are not url decoded
+    using HttpParams = std::unordered_map<std::string, std::string>;
+
+    // Routes of on_http, compiled once when they are registered.
+    //
+    // Patterns made of literal segments and "{name}" segments go into a tree with one level per path
+    // segment, so that dispatch is a hash lookup per segment. A literal segment is preferred over a param
+    // at the same level. Patterns with other regex syntax are kept as compiled regexes, and tried in
+    // registration order when the tree has no match. Handlers registered for all methods are preferred,
+    // as before.
+    template<typename Handler>
+    class Router {
+    public:
+        void add(const std::string &pattern, boost::beast::http::verb method, Handler handler) {
+            if (isRegex(pattern)) {
+                for (RegexRoute &route : regex_routes_) {
+                    if (route.pattern == pattern) {
+                        route.handlers[static_cast<int>(method)] = std::move(handler);
+                        return;
+                    }
+                }
+                regex_routes_.push_back(RegexRoute{pattern, std::regex(pattern, std::regex::ECMAScript),
+                                                   {{static_cast<int>(method), std::move(handler)}}});
+                return;
+            }
+
+            Node *node = &root_;
+            std::size_t pos = 1;
+            while (pos <= pattern.size()) {
+                std::size_t end = std::min(pattern.find('/', pos), pattern.size());
+                std::string segment = pattern.substr(pos, end - pos);
+                if (isParam(segment)) {
+                    std::string name = segment.substr(1, segment.size() - 2);
+                    if (!node->param) {
+                        node->param.reset(new Node());
+                        node->param->param_name = name;
+                    } else if (node->param->param_name != name) {
+                        throw std::invalid_argument("conflicting path params {" + node->param->param_name +
+                                                    "} and {" + name + "} in " + pattern);
+                    }
+                    node = node->param.get();
+                } else {
+                    std::unique_ptr<Node> &child = node->children[segment];
+                    if (!child) {
+                        child.reset(new Node());
+                    }
+                    node = child.get();
+                }
+                pos = end + 1;
+            }
+            node->handlers[static_cast<int>(method)] = std::move(handler);
+        }
+
+        // the handler of the route matching the path without its query, null if there is none
+        const Handler *find(boost::beast::string_view path, boost::beast::http::verb method,
+                            HttpParams &params) const {
+            if (path.empty() || path.front() != '/') {
+                return nullptr;
+            }
+            const Handler *handler = match(root_, path, 1, static_cast<int>(method), params);
+            if (handler || regex_routes_.empty()) {
+                return handler;
+            }
+
+            std::string path_str(path.data(), path.size());
+            std::smatch match{};
+            for (const RegexRoute &route : regex_routes_) {
+                handler = handlerOf(route.handlers, static_cast<int>(method));
+                if (handler && std::regex_match(path_str, match, route.regex, std::regex_constants::match_not_null)) {
+                    for (std::size_t i = 1; i < match.size(); i++) {
+                        params[std::to_string(i)] = match[i].str();
+                    }
+                    return handler;
+                }
+            }
+            return nullptr;
+        }
+
+        bool empty() const {
+            return root_.children.empty() && !root_.param && root_.handlers.empty() && regex_routes_.empty();
+        }
+
+    private:
+        struct Node {
+            std::unordered_map<std::string, std::unique_ptr<Node>> children;
+            std::unique_ptr<Node> param;
+            std::string param_name;
+            std::map<int, Handler> handlers;
+        };
+
+        struct RegexRoute {
+            std::string pattern;
+            std::regex regex;
+            std::map<int, Handler> handlers;
+        };
+
+        static bool isParam(const std::string &segment) {
+            return segment.size() > 2 && segment.front() == '{' && segment.back() == '}' &&
+                   segment.find_first_of("{}", 1) == segment.size() - 1;
+        }
+
+        // '.' is taken literally, it is far more common in file names than as a pattern on its own
+        static bool isRegex(const std::string &pattern) {
+            if (pattern.empty() || pattern.front() != '/') {
+                return true;
+            }
+            std::size_t pos = 1;
+            while (pos <= pattern.size()) {
+                std::size_t end = std::min(pattern.find('/', pos), pattern.size());
+                std::string segment = pattern.substr(pos, end - pos);
+                if (!isParam(segment) && segment.find_first_of("\\^$|?*+()[]{}") != std::string::npos) {
+                    return true;
+                }
+                pos = end + 1;
+            }
+            return false;
+        }
+
+        static const Handler *handlerOf(const std::map<int, Handler> &handlers, int method) {
+            auto it = handlers.find(static_cast<int>(boost::beast::http::verb::unknown));
+            if (it == handlers.end()) {
+                it = handlers.find(method);
+            }
+            return it == handlers.end() ? nullptr : &it->second;
+        }
+
+        // pos is the start of the next segment, past the end when the path is consumed
+        const Handler *match(const Node &node, boost::beast::string_view path, std::size_t pos, int method,
+                             HttpParams &params) const {
+            if (pos > path.size()) {
+                return handlerOf(node.handlers, method);
+            }
+            std::size_t end = std::min(path.find('/', pos), path.size());
+            boost::beast::string_view segment = path.substr(pos, end - pos);
+
+            auto it = node.children.find(std::string(segment.data(), segment.size()));
+            if (it != node.children.end()) {
+                const Handler *handler = match(*it->second, path, end + 1, method, params);
+                if (handler) {
+                    return handler;
+                }
+            }
+            if (node.param && !segment.empty()) {
+                const Handler *handler = match(*node.param, path, end + 1, method, params);
+                if (handler) {
+                    // set on the way back, so that a branch that didn't match leaves nothing behind
+                    params[node.param->param_name] = std::string(segment.data(), segment.size());
+                    return handler;
+                }
+            }
+            return nullptr;
+        }
+
+        Node root_;
+        std::vector<RegexRoute> regex_routes_;
+    };
+
+}
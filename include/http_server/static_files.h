@@ -0,0 +1,218 @@
+#pragma once
+
+#include <list>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
+#include <sys/stat.h>
+
+#include <boost/beast.hpp>
+
+#include "http_utils.h"
+#include "http_compression.h"
+
+namespace http_server {
+
+    namespace beast = boost::beast;
+    namespace http = boost::beast::http;
+
+    // A body of bytes shared by all the responses that send it, so a cached file is never copied.
+    struct SharedBody {
+        using value_type = std::shared_ptr<const std::string>;
+
+        static std::uint64_t size(value_type const &body) {
+            return body ? body->size() : 0;
+        }
+
+        class writer {
+        public:
+            using const_buffers_type = boost::asio::const_buffer;
+
+            template<bool isRequest, class Fields>
+            writer(http::header<isRequest, Fields> const &, value_type const &body) : body_(body) {
+            }
+
+            void init(beast::error_code &ec) {
+                ec = {};
+            }
+
+            boost::optional<std::pair<const_buffers_type, bool>> get(beast::error_code &ec) {
+                ec = {};
+                if (!body_ || body_->empty()) {
+                    return boost::none;
+                }
+                return {{const_buffers_type(body_->data(), body_->size()), false}};
+            }
+
+        private:
+            value_type const &body_;
+        };
+    };
+
+    // A file of the webroot. Small files are kept in memory with their compressed variants, larger ones
+    // have only the metadata and are sent from disk.
+    struct StaticFile {
+        std::string path;
+        std::time_t mtime{0};
+        std::uint64_t size{0};
+        // the headers of every response of the file, content type, ETag and Last-Modified
+        http::fields headers;
+        std::string etag;
+        // null if the file isn't cached, the variants are null if they wouldn't be smaller
+        std::shared_ptr<const std::string> body;
+        std::shared_ptr<const std::string> gzip;
+        std::shared_ptr<const std::string> brotli;
+
+        std::size_t cost() const {
+            return (body ? body->size() : 0) + (gzip ? gzip->size() : 0) + (brotli ? brotli->size() : 0);
+        }
+    };
+
+    using StaticFilePtr = std::shared_ptr<const StaticFile>;
+
+    // LRU cache of the hot files of the webroot, bounded by the total bytes of the cached bodies.
+    //
+    // Each lookup checks the modification time and size of the file, and loads it again if they changed.
+    // The gzip variant is compressed when the file is loaded, unless there is a precompressed "<file>.gz"
+    // next to it. So is the brotli variant with "<file>.br", it is only compressed if built with USE_BROTLI.
+    // Loading happens on the io thread of the request that missed the cache, so the variants are compressed
+    // at the default level, which is a few milliseconds for a cacheable file. Precompress the files at deploy
+    // time for the best level, e.g. with "gzip -9k" and "brotli -k".
+    class StaticFiles {
+    public:
+        // capacity is the total bytes of the cache, files larger than max_file_size are not cached
+        void limits(std::size_t capacity, std::size_t max_file_size) {
+            std::lock_guard<std::mutex> locker(mutex_);
+            capacity_ = capacity;
+            max_file_size_ = max_file_size;
+            evict();
+        }
+
+        // null if there is no such regular file
+        StaticFilePtr get(const std::string &path) {
+            struct stat st{};
+            if (::stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+                return nullptr;
+            }
+            std::size_t max_file_size;
+            {
+                std::lock_guard<std::mutex> locker(mutex_);
+                auto it = index_.find(path);
+                if (it != index_.end()) {
+                    StaticFilePtr file = *it->second;
+                    if (file->mtime == st.st_mtime && file->size == static_cast<std::uint64_t>(st.st_size)) {
+                        lru_.splice(lru_.begin(), lru_, it->second);
+                        return file;
+                    }
+                    bytes_ -= file->cost();
+                    lru_.erase(it->second);
+                    index_.erase(it);
+                }
+                max_file_size = max_file_size_;
+            }
+
+            std::shared_ptr<StaticFile> file(new StaticFile());
+            file->path = path;
+            file->mtime = st.st_mtime;
+            file->size = static_cast<std::uint64_t>(st.st_size);
+            std::ostringstream etag;
+            etag << "W/\"" << std::hex << file->size << "-" << file->mtime << "\"";
+            file->etag = etag.str();
+            file->headers.set(http::field::content_type, HttpUtils::mime_type(path));
+            file->headers.set(http::field::etag, file->etag);
+            file->headers.set(http::field::last_modified, HttpUtils::http_date(file->mtime));
+            if (file->size > max_file_size || !load(*file)) {
+                return file;
+            }
+
+            std::lock_guard<std::mutex> locker(mutex_);
+            if (index_.find(path) == index_.end()) {
+                lru_.push_front(file);
+                index_[path] = lru_.begin();
+                bytes_ += file->cost();
+                evict();
+            }
+            return file;
+        }
+
+    private:
+        // files smaller than this aren't worth compressing
+        enum {
+            MIN_COMPRESS_SIZE = 256
+        };
+
+        static bool readFile(const std::string &path, std::string &data) {
+            std::ifstream in(path, std::ios::binary);
+            if (!in) {
+                return false;
+            }
+            std::ostringstream buf;
+            buf << in.rdbuf();
+            data = buf.str();
+            return true;
+        }
+
+        // a precompressed file next to the original, if it isn't older
+        static std::shared_ptr<const std::string> precompressed(const StaticFile &file, const std::string &suffix) {
+            struct stat st{};
+            std::string path = file.path + suffix;
+            std::shared_ptr<std::string> data(new std::string());
+            if (::stat(path.c_str(), &st) != 0 || st.st_mtime < file.mtime || !readFile(path, *data)) {
+                return nullptr;
+            }
+            return data;
+        }
+
+        static bool load(StaticFile &file) {
+            std::shared_ptr<std::string> body(new std::string());
+            if (!readFile(file.path, *body) || body->size() != file.size) {
+                return false;
+            }
+            file.body = body;
+
+            file.gzip = precompressed(file, ".gz");
+            file.brotli = precompressed(file, ".br");
+            beast::string_view content_type = file.headers[http::field::content_type];
+            if (body->size() < MIN_COMPRESS_SIZE || !HttpCompression::compressible(content_type)) {
+                return true;
+            }
+            // the highest levels take up to a second for a megabyte, far too long for the io thread
+            std::vector<char> out;
+            if (!file.gzip && HttpCompression::compress(ContentEncoding::GZIP, body->data(), body->size(), out)) {
+                file.gzip = smaller(out.data(), out.size(), *body);
+            }
+            if (!file.brotli && HttpCompression::supported(ContentEncoding::BROTLI) &&
+                HttpCompression::compress(ContentEncoding::BROTLI, body->data(), body->size(), out)) {
+                file.brotli = smaller(out.data(), out.size(), *body);
+            }
+            return true;
+        }
+
+        static std::shared_ptr<const std::string> smaller(const char *data, std::size_t size, const std::string &body) {
+            if (size >= body.size()) {
+                return nullptr;
+            }
+            return std::make_shared<const std::string>(data, size);
+        }
+
+        // called with the lock held
+        void evict() {
+            while (bytes_ > capacity_ && !lru_.empty()) {
+                bytes_ -= lru_.back()->cost();
+                index_.erase(lru_.back()->path);
+                lru_.pop_back();
+            }
+        }
+
+        std::mutex mutex_;
+        std::size_t capacity_{64 * 1024 * 1024};
+        std::size_t max_file_size_{1024 * 1024};
+        std::size_t bytes_{0};
+        std::list<StaticFilePtr> lru_;
+        std::unordered_map<std::string, std::list<StaticFilePtr>::iterator> index_;
+    };
+
+}
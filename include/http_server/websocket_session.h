@@ -6,11 +6,12 @@
 namespace http_server {
     class WebsocketSession : public std::enable_shared_from_this<WebsocketSession> {
     public:
-        WebsocketSession(tcp::socket socket, Attr &attr, HttpRequest &&req)
+        WebsocketSession(tcp::socket socket, Attr &attr, Sessions &sessions, HttpRequest &&req)
                 : websocket_(std::move(socket)),
-                  strand_(websocket_.get_executor()),
-                  timer_(websocket_.get_executor().context(), (std::chrono::steady_clock::time_point::max) ()),
+                  strand_(HttpUtils::io_executor(websocket_)),
+                  timer_(websocket_.get_executor(), (std::chrono::steady_clock::time_point::max) ()),
                   attr_(attr),
+                  sessions_(sessions),
                   req_(std::move(req)) {
             websocket_.binary(true);
         }
@@ -194,8 +195,10 @@ namespace http_server {
             Logger::info("WebsocketSession", "Socket shutdown, and remove websocket session, session_id={}.",
                          session_id_);
             attr_.websocket_close_callback(*shared_from_this());
-            std::lock_guard<std::mutex> locker(attr_.websocket_mutex);
-            attr_.websocket_sessions.erase(shared_from_this());
+            std::lock_guard<std::mutex> locker(sessions_.websocket_mutex);
+            if (sessions_.websocket_sessions.erase(shared_from_this()) > 0) {
+                attr_.connections--;
+            }
         }
 
         long session_id() {
@@ -214,6 +217,7 @@ namespace http_server {
         asio::steady_timer timer_;
         bool ping_state_ = true;
         Attr &attr_;
+        Sessions &sessions_;
         HttpRequest req_;
 
         beast::multi_buffer read_buffer_;
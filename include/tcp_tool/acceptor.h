@@ -11,9 +11,10 @@ namespace tcp_tool {
         Acceptor(boost::asio::io_context &ioc, unsigned short port,
                  TcpEncoder<T> encoder,
                  TcpDecoder<T> decoder,
-                 TcpHandler<T> handler)
+                 TcpHandler<T> handler,
+                 CloseCallback<T> close_callback = nullptr)
                 : endpoint_(tcp::v4(), port), acceptor_(ioc),
-                  encoder_(encoder), decoder_(decoder), handler_(handler) {
+                  encoder_(encoder), decoder_(decoder), handler_(handler), close_callback_(close_callback) {
         }
 
         // Start accepting incoming connections
@@ -54,10 +55,22 @@ namespace tcp_tool {
                                  socket.remote_endpoint().address().to_string(), socket.remote_endpoint().port());
 
                     ErrorCallback error_callback = [this](long session_id) {
+                        std::shared_ptr<TcpSession<T>> closed;
+                        {
+                            std::lock_guard<std::mutex> locker(mutex_);
+                            auto it = sessions_.find(session_id);
+                            if (it == sessions_.end()) {
+                                // a read and a write may both fail
+                                return;
+                            }
+                            closed = it->second;
+                            sessions_.erase(it);
+                        }
                         Logger::info("Acceptor", "Remove tcp session, session_id={}.",
                                      session_id);
-                        std::lock_guard<std::mutex> locker(mutex_);
-                        sessions_.erase(session_id);
+                        if (close_callback_) {
+                            close_callback_(*closed);
+                        }
                     };
                     std::shared_ptr<TcpSession<T>> session(
                             new TcpSession<T>(std::move(socket), encoder_, decoder_, handler_, error_callback));
@@ -81,6 +94,7 @@ namespace tcp_tool {
         TcpEncoder<T> encoder_;
         TcpDecoder<T> decoder_;
         TcpHandler<T> handler_;
+        CloseCallback<T> close_callback_;
         std::mutex mutex_;
         std::map<long, std::shared_ptr<TcpSession<T>>> sessions_;
     };
@@ -42,6 +42,11 @@ namespace tcp_tool {
             Logger::info("TcpClient", "Set tpc handler.");
         }
 
+        // set before connect
+        void onClose(CloseCallback<T> callback) {
+            close_callback_ = callback;
+        }
+
         void connect(const std::string &host, unsigned short port, bool sync = false) {
             try {
                 endpoint_ = tcp::endpoint(boost::asio::ip::make_address(host), port);
@@ -55,8 +60,14 @@ namespace tcp_tool {
                              socket_.remote_endpoint().address().to_string(),
                              socket_.remote_endpoint().port());
 
+                ErrorCallback error_callback = [this](long session_id) {
+                    // a read and a write may both fail
+                    if (close_callback_ && !closed_.exchange(true)) {
+                        close_callback_(*session_);
+                    }
+                };
                 session_ = std::shared_ptr<TcpSession<T>>(
-                        new TcpSession<T>(std::move(socket_), encoder_, decoder_, handler_));
+                        new TcpSession<T>(std::move(socket_), encoder_, decoder_, handler_, error_callback));
                 session_->start();
             } catch (std::exception &e) {
                 Logger::error("Acceptor", "On connect[{}:{}] error, {}.", endpoint_.address().to_string(),
@@ -65,7 +76,10 @@ namespace tcp_tool {
                 throw e;
             }
 
-            io_thread_ = std::make_shared<std::thread>([this]() { ioc_.run(); });
+            io_thread_ = std::make_shared<std::thread>([this]() {
+                ioc_.run();
+                stopped_ = true;
+            });
             if (sync) {
                 io_thread_->join();
             } else {
@@ -77,8 +91,23 @@ namespace tcp_tool {
             boost::asio::post(ioc_, [this]() { socket_.close(); });
         }
 
-        void send(T &msg) {
-            session_->send(msg);
+        void send(T &msg, WriteCallback callback = nullptr) {
+            session_->send(msg, callback);
+        }
+
+        void send(std::shared_ptr<const std::vector<char>> data, WriteCallback callback = nullptr) {
+            session_->send(data, callback);
+        }
+
+        // the io thread ran out of work after the connection closed, the client may be destroyed on any
+        // thread from now on
+        bool stopped() {
+            return stopped_;
+        }
+
+        // the session of the connection, null before connect
+        std::shared_ptr<TcpSession<T>> session() {
+            return session_;
         }
 
     private:
@@ -90,6 +119,9 @@ namespace tcp_tool {
         TcpEncoder<T> encoder_;
         TcpDecoder<T> decoder_;
         TcpHandler<T> handler_;
+        CloseCallback<T> close_callback_;
+        std::atomic_bool closed_{false};
+        std::atomic_bool stopped_{false};
         std::shared_ptr<TcpSession<T>> session_;
     };
 
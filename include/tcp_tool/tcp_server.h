@@ -46,12 +46,17 @@ namespace tcp_tool {
             Logger::info("TcpServer", "Set tpc handler.");
         }
 
+        // set before listen
+        void onClose(CloseCallback<T> callback) {
+            close_callback_ = callback;
+        }
+
         void broadcast(T &msg) {
             acceptor_->broadcast(msg);
         }
 
         void listen(unsigned short port, bool sync = false) {
-            acceptor_ = std::make_shared<Acceptor<T>>(ioc_, port, encoder_, decoder_, handler_);
+            acceptor_ = std::make_shared<Acceptor<T>>(ioc_, port, encoder_, decoder_, handler_, close_callback_);
             // listen server
             acceptor_->listen();
 
@@ -82,5 +87,6 @@ namespace tcp_tool {
         TcpEncoder<T> encoder_;
         TcpDecoder<T> decoder_;
         TcpHandler<T> handler_;
+        CloseCallback<T> close_callback_;
     };
 }
\ No newline at end of file
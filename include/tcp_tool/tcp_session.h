@@ -16,12 +16,21 @@ namespace tcp_tool {
     class TcpSession;
 
     using ErrorCallback = std::function<void(long)>;
+    using DrainCallback = std::function<void()>;
+    // completion of a send, false if the connection failed before the bytes were written
+    using WriteCallback = std::function<void(bool)>;
     template<typename T>
     using TcpEncoder = std::function<void(T &, std::vector<char> &)>;
+    // takes the next message off the read data, returns false if there is none. One message object is
+    // reused for the messages of a read, and the handler runs before the decoder is called again. A decoder
+    // throws if the stream can't be framed any more, e.g. a frame is too large, the session is closed then.
     template<typename T>
     using TcpDecoder = std::function<bool(std::vector<char> &, T &)>;
     template<typename T>
     using TcpHandler = std::function<void(T &, TcpSession<T> &)>;
+    // the connection failed or the peer closed it, called once per session on its io thread
+    template<typename T>
+    using CloseCallback = std::function<void(TcpSession<T> &)>;
 
     template<typename T>
     class TcpSession : public std::enable_shared_from_this<TcpSession<T>> {
@@ -41,15 +50,48 @@ namespace tcp_tool {
         }
 
         void start() {
+            // messages are small and written one by one, don't let the second wait for the ack of the first
+            boost::system::error_code ec;
+            socket_.set_option(tcp::no_delay(true), ec);
             do_read();
         }
 
-        void send(T &msg) {
+        // state the application keeps for the connection, set on the io thread before other threads use it
+        void context(std::shared_ptr<void> context) {
+            context_ = std::move(context);
+        }
+
+        std::shared_ptr<void> context() {
+            return context_;
+        }
+
+        // called on the io thread whenever the write queue becomes empty
+        void onDrain(DrainCallback callback) {
+            std::lock_guard<std::mutex> locker(mutex_);
+            drain_callback_ = callback;
+        }
+
+        std::size_t writeQueueSize() {
+            std::lock_guard<std::mutex> locker(mutex_);
+            return write_queue_.size();
+        }
+
+        std::size_t writeQueueBytes() {
+            std::lock_guard<std::mutex> locker(mutex_);
+            return write_queue_bytes_;
+        }
+
+        void send(T &msg, WriteCallback callback = nullptr) {
             std::shared_ptr<std::vector<char>> data(new std::vector<char>());
             encoder_(msg, *data);
+            send(data, callback);
+        }
 
+        // send already encoded bytes, the buffer may be shared with other sessions
+        void send(std::shared_ptr<const std::vector<char>> data, WriteCallback callback = nullptr) {
             std::lock_guard<std::mutex> locker(mutex_);
-            write_queue_.emplace_back(data);
+            write_queue_bytes_ += data->size();
+            write_queue_.emplace_back(PendingWrite{data, callback});
 
             if (write_queue_.size() > 1) {
                 return;
@@ -65,8 +107,10 @@ namespace tcp_tool {
         }
 
         void do_read() {
+            // the handlers keep the session alive, the owner may release it while an operation is pending
+            auto self = this->shared_from_this();
             socket_.async_read_some(boost::asio::buffer(read_buffer_, max_buffer_length),
-                                    [this](boost::system::error_code ec, std::size_t bytes_transferred) {
+                                    [this, self](boost::system::error_code ec, std::size_t bytes_transferred) {
                                         if (ec) {
                                             Logger::error("TcpSession",
                                                           "Read data error, session_id={}, error_message={}.",
@@ -82,7 +126,16 @@ namespace tcp_tool {
                                         T msg;
                                         bool success = true;
                                         while (success) {
-                                            success = decoder_(remaining_read_data_, msg);
+                                            try {
+                                                success = decoder_(remaining_read_data_, msg);
+                                            } catch (std::exception &e) {
+                                                Logger::error("TcpSession",
+                                                              "Decode data error, session_id={}, error_message={}.",
+                                                              session_id_, e.what());
+                                                close();
+                                                error_callback_(session_id_);
+                                                return;
+                                            }
                                             if (success) {
                                                 handler_(msg, *this);
                                             }
@@ -95,25 +148,54 @@ namespace tcp_tool {
                                     });
         }
 
+        // a pending write fails with the socket, its handler runs error_callback_ again, which is ignored
+        void close() {
+            std::lock_guard<std::mutex> locker(mutex_);
+            boost::system::error_code ec;
+            socket_.close(ec);
+            remaining_read_data_.clear();
+        }
+
         void do_write() {
+            auto self = this->shared_from_this();
             boost::asio::async_write(socket_,
-                                     boost::asio::buffer(*write_queue_.front()),
-                                     [this](boost::system::error_code ec, std::size_t length) {
+                                     boost::asio::buffer(*write_queue_.front().data),
+                                     [this, self](boost::system::error_code ec, std::size_t length) {
+                                         std::unique_lock<std::mutex> locker(mutex_);
                                          if (ec) {
                                              Logger::error("TcpSession",
                                                            "Write data error, session_id={}, error_message={}.",
                                                            session_id_, ec.message());
+                                             std::deque<PendingWrite> failed;
+                                             failed.swap(write_queue_);
+                                             write_queue_bytes_ = 0;
+                                             locker.unlock();
+                                             for (auto &write : failed) {
+                                                 if (write.callback) {
+                                                     write.callback(false);
+                                                 }
+                                             }
                                              error_callback_(session_id_);
                                              return;
                                          }
 
-                                         std::lock_guard<std::mutex> locker(mutex_);
+                                         WriteCallback written = write_queue_.front().callback;
+                                         write_queue_bytes_ -= write_queue_.front().data->size();
                                          write_queue_.pop_front();
-                                         if (write_queue_.empty()) {
-                                             return;
+                                         bool drained = write_queue_.empty();
+                                         DrainCallback callback = drain_callback_;
+                                         if (!drained) {
+                                             do_write();
                                          }
+                                         locker.unlock();
 
-                                         do_write();
+                                         // the callbacks may send again, so they must not hold the lock
+                                         if (written) {
+                                             written(true);
+                                         }
+                                         if (drained && callback) {
+                                             callback();
+                                         }
                                      });
         }
 
@@ -126,11 +208,19 @@ namespace tcp_tool {
         char read_buffer_[max_buffer_length];
         std::vector<char> remaining_read_data_;
         std::mutex mutex_;
-        std::deque<std::shared_ptr<std::vector<char>>> write_queue_;
+        struct PendingWrite {
+            std::shared_ptr<const std::vector<char>> data;
+            WriteCallback callback;
+        };
+
+        std::deque<PendingWrite> write_queue_;
+        std::size_t write_queue_bytes_{0};
+        DrainCallback drain_callback_;
         TcpEncoder<T> encoder_;
         TcpDecoder<T> decoder_;
         TcpHandler<T> handler_;
         ErrorCallback error_callback_;
+        std::shared_ptr<void> context_;
     };
 
 }
\ No newline at end of file
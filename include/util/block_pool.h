@@ -0,0 +1,123 @@
+#pragma once
+
+#include <new>
+#include <vector>
+#include <cstddef>
+
+namespace util {
+
+    // Free lists of small blocks, per thread, for objects that are allocated and freed at a high rate, like the
+    // header fields of HTTP messages. A block freed on another thread than the one that allocated it goes to
+    // the free list of the thread that frees it. Blocks larger than the largest size class come from new.
+    class BlockPool {
+    public:
+        static void *allocate(std::size_t size) {
+            int index = sizeClass(size);
+            if (index < 0 || destroyed()) {
+                return ::operator new(size);
+            }
+            std::vector<void *> &list = lists().free[index];
+            if (list.empty()) {
+                return ::operator new(MIN_BLOCK << index);
+            }
+            void *block = list.back();
+            list.pop_back();
+            return block;
+        }
+
+        static void deallocate(void *block, std::size_t size) {
+            int index = sizeClass(size);
+            if (index < 0 || destroyed()) {
+                ::operator delete(block);
+                return;
+            }
+            std::vector<void *> &list = lists().free[index];
+            if (list.size() >= MAX_FREE) {
+                ::operator delete(block);
+                return;
+            }
+            list.push_back(block);
+        }
+
+    private:
+        // size classes of 64, 128, 256, 512 and 1024 bytes, at most MAX_FREE free blocks of each per thread
+        enum {
+            MIN_BLOCK = 64,
+            CLASSES = 5,
+            MAX_FREE = 256
+        };
+
+        struct Lists {
+            Lists() {
+                for (auto &list : free) {
+                    list.reserve(MAX_FREE);
+                }
+            }
+
+            ~Lists() {
+                destroyed() = true;
+                for (auto &list : free) {
+                    for (void *block : list) {
+                        ::operator delete(block);
+                    }
+                }
+            }
+
+            std::vector<void *> free[CLASSES];
+        };
+
+        static int sizeClass(std::size_t size) {
+            std::size_t block = MIN_BLOCK;
+            for (int index = 0; index < CLASSES; index++, block <<= 1) {
+                if (size <= block) {
+                    return index;
+                }
+            }
+            return -1;
+        }
+
+        static Lists &lists() {
+            static thread_local Lists lists;
+            return lists;
+        }
+
+        // the lists of the thread are gone, the blocks freed by the destructors of other thread locals and
+        // statics then go straight to delete
+        static bool &destroyed() {
+            static thread_local bool destroyed = false;
+            return destroyed;
+        }
+    };
+
+    // An allocator of BlockPool blocks, for the containers of a hot path
+    template<typename T>
+    class PooledAllocator {
+    public:
+        using value_type = T;
+
+        PooledAllocator() = default;
+
+        template<typename U>
+        PooledAllocator(const PooledAllocator<U> &) {
+        }
+
+        T *allocate(std::size_t n) {
+            return static_cast<T *>(BlockPool::allocate(n * sizeof(T)));
+        }
+
+        void deallocate(T *p, std::size_t n) {
+            BlockPool::deallocate(p, n * sizeof(T));
+        }
+
+        template<typename U>
+        bool operator==(const PooledAllocator<U> &) const {
+            return true;
+        }
+
+        template<typename U>
+        bool operator!=(const PooledAllocator<U> &) const {
+            return false;
+        }
+    };
+
+}
@@ -0,0 +1,352 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <cstring>
+
+#include "util/logger.h"
+#include "util/zlib_utils.h"
+
+#ifdef USE_LZ4
+#include <lz4.h>
+#endif
+
+#ifdef USE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace util {
+
+    // the values are used on the wire, keep them in sync with protocol::Codec
+    enum class CodecType {
+        NONE = 0,
+        ZLIB = 1,
+        LZ4 = 2,
+        ZSTD = 3
+    };
+
+    class Codec {
+    public:
+        // the raw size comes from the wire, larger payloads are rejected before anything is allocated
+        static const size_t MAX_RAW_SIZE = 256 * 1024 * 1024;
+
+        virtual ~Codec() = default;
+
+        virtual CodecType type() const = 0;
+
+        virtual std::string name() const = 0;
+
+        // level 0 means the default level of the codec
+        virtual bool compress(const char *in, size_t size, std::vector<char> &out, int level) = 0;
+
+        virtual bool decompress(const char *in, size_t size, std::vector<char> &out) = 0;
+    };
+
+    class ZlibCodec : public Codec {
+    public:
+        static const int DEFAULT_LEVEL = 6;
+
+        CodecType type() const override {
+            return CodecType::ZLIB;
+        }
+
+        std::string name() const override {
+            return "zlib";
+        }
+
+        bool compress(const char *in, size_t size, std::vector<char> &out, int level) override {
+            if (level <= 0) {
+                level = DEFAULT_LEVEL;
+            }
+            try {
+                ZlibUtils::compress(in, size, out, level);
+            } catch (std::exception &e) {
+                Logger::error("ZlibCodec", "Compress error, size={}, error: {}", size, e.what());
+                return false;
+            }
+            return true;
+        }
+
+        bool decompress(const char *in, size_t size, std::vector<char> &out) override {
+            try {
+                ZlibUtils::decompress(in, size, out, MAX_RAW_SIZE);
+            } catch (std::exception &e) {
+                Logger::error("ZlibCodec", "Decompress error, size={}, error: {}", size, e.what());
+                return false;
+            }
+            return true;
+        }
+    };
+
+#ifdef USE_LZ4
+
+    // LZ4 block format prefixed with the 4 bytes little endian raw size, level is the acceleration factor
+    class Lz4Codec : public Codec {
+    public:
+        static const int DEFAULT_LEVEL = 1;
+
+        CodecType type() const override {
+            return CodecType::LZ4;
+        }
+
+        std::string name() const override {
+            return "lz4";
+        }
+
+        bool compress(const char *in, size_t size, std::vector<char> &out, int level) override {
+            if (size > LZ4_MAX_INPUT_SIZE) {
+                Logger::error("Lz4Codec", "Input is too large, size={}", size);
+                return false;
+            }
+            if (level <= 0) {
+                level = DEFAULT_LEVEL;
+            }
+            int bound = LZ4_compressBound(static_cast<int>(size));
+            out.resize(HEADER_SIZE + bound);
+            writeSize(static_cast<uint32_t>(size), out.data());
+            int n = LZ4_compress_fast(in, out.data() + HEADER_SIZE, static_cast<int>(size), bound, level);
+            if (n <= 0) {
+                Logger::error("Lz4Codec", "Compress error, size={}", size);
+                return false;
+            }
+            out.resize(HEADER_SIZE + n);
+            return true;
+        }
+
+        bool decompress(const char *in, size_t size, std::vector<char> &out) override {
+            if (size < HEADER_SIZE) {
+                Logger::error("Lz4Codec", "Decompress error, truncated header, size={}", size);
+                return false;
+            }
+            uint32_t raw_size = readSize(in);
+            if (raw_size > MAX_RAW_SIZE || raw_size > static_cast<uint32_t>(LZ4_MAX_INPUT_SIZE)) {
+                Logger::error("Lz4Codec", "Decompress error, raw size is too large, size={}, raw_size={}", size,
+                              raw_size);
+                return false;
+            }
+            out.resize(raw_size);
+            int n = LZ4_decompress_safe(in + HEADER_SIZE, out.data(), static_cast<int>(size - HEADER_SIZE),
+                                        static_cast<int>(raw_size));
+            if (n < 0 || static_cast<uint32_t>(n) != raw_size) {
+                Logger::error("Lz4Codec", "Decompress error, size={}, raw_size={}", size, raw_size);
+                return false;
+            }
+            return true;
+        }
+
+    private:
+        enum {
+            HEADER_SIZE = 4
+        };
+
+        static void writeSize(uint32_t size, char *out) {
+            for (int i = 0; i < 4; i++) {
+                out[i] = static_cast<char>((size >> (8 * i)) & 0xff);
+            }
+        }
+
+        static uint32_t readSize(const char *in) {
+            uint32_t size = 0;
+            for (int i = 0; i < 4; i++) {
+                size |= static_cast<uint32_t>(static_cast<unsigned char>(in[i])) << (8 * i);
+            }
+            return size;
+        }
+    };
+
+#endif
+
+#ifdef USE_ZSTD
+
+    // zstd frames, optionally with a dictionary which has to be the same on both ends
+    class ZstdCodec : public Codec {
+    public:
+        static const int DEFAULT_LEVEL = 3;
+
+        ZstdCodec() = default;
+
+        explicit ZstdCodec(std::vector<char> dictionary) : dictionary_(std::move(dictionary)) {
+            if (!dictionary_.empty()) {
+                ddict_ = ZSTD_createDDict(dictionary_.data(), dictionary_.size());
+            }
+        }
+
+        ~ZstdCodec() override {
+            for (auto &pair : cdicts_) {
+                ZSTD_freeCDict(pair.second);
+            }
+            if (ddict_) {
+                ZSTD_freeDDict(ddict_);
+            }
+        }
+
+        CodecType type() const override {
+            return CodecType::ZSTD;
+        }
+
+        std::string name() const override {
+            return "zstd";
+        }
+
+        bool compress(const char *in, size_t size, std::vector<char> &out, int level) override {
+            if (level == 0) {
+                level = DEFAULT_LEVEL;
+            }
+            out.resize(ZSTD_compressBound(size));
+            size_t n;
+            if (dictionary_.empty()) {
+                n = ZSTD_compressCCtx(context().cctx, out.data(), out.size(), in, size, level);
+            } else {
+                n = ZSTD_compress_usingCDict(context().cctx, out.data(), out.size(), in, size, cdict(level));
+            }
+            if (ZSTD_isError(n)) {
+                Logger::error("ZstdCodec", "Compress error, size={}, error: {}", size, ZSTD_getErrorName(n));
+                return false;
+            }
+            out.resize(n);
+            return true;
+        }
+
+        bool decompress(const char *in, size_t size, std::vector<char> &out) override {
+            unsigned long long raw_size = ZSTD_getFrameContentSize(in, size);
+            if (raw_size == ZSTD_CONTENTSIZE_ERROR || raw_size == ZSTD_CONTENTSIZE_UNKNOWN) {
+                Logger::error("ZstdCodec", "Decompress error, unknown content size, size={}", size);
+                return false;
+            }
+            if (raw_size > MAX_RAW_SIZE) {
+                Logger::error("ZstdCodec", "Decompress error, raw size is too large, size={}, raw_size={}", size,
+                              raw_size);
+                return false;
+            }
+            out.resize(raw_size);
+            size_t n;
+            if (ddict_) {
+                n = ZSTD_decompress_usingDDict(context().dctx, out.data(), out.size(), in, size, ddict_);
+            } else {
+                n = ZSTD_decompressDCtx(context().dctx, out.data(), out.size(), in, size);
+            }
+            if (ZSTD_isError(n)) {
+                Logger::error("ZstdCodec", "Decompress error, size={}, error: {}", size, ZSTD_getErrorName(n));
+                return false;
+            }
+            out.resize(n);
+            return true;
+        }
+
+    private:
+        // zstd contexts are expensive to create and not thread safe, keep one pair per thread
+        struct Context {
+            Context() : cctx(ZSTD_createCCtx()), dctx(ZSTD_createDCtx()) {
+            }
+
+            ~Context() {
+                ZSTD_freeCCtx(cctx);
+                ZSTD_freeDCtx(dctx);
+            }
+
+            ZSTD_CCtx *cctx;
+            ZSTD_DCtx *dctx;
+        };
+
+        static Context &context() {
+            static thread_local Context context;
+            return context;
+        }
+
+        const ZSTD_CDict *cdict(int level) {
+            std::lock_guard<std::mutex> locker(mutex_);
+            ZSTD_CDict *&cdict = cdicts_[level];
+            if (!cdict) {
+                cdict = ZSTD_createCDict(dictionary_.data(), dictionary_.size(), level);
+            }
+            return cdict;
+        }
+
+    private:
+        std::vector<char> dictionary_;
+        std::mutex mutex_;
+        std::map<int, ZSTD_CDict *> cdicts_;
+        ZSTD_DDict *ddict_{nullptr};
+    };
+
+#endif
+
+    // Registry of the codecs compiled into this binary, NONE is never registered.
+    class CodecFactory {
+    public:
+        // messages smaller than this are not worth compressing
+        static const int DEFAULT_MIN_COMPRESS_SIZE = 1024;
+
+        static std::shared_ptr<Codec> get(CodecType type) {
+            std::lock_guard<std::mutex> locker(instance()->mutex_);
+            auto it = instance()->codecs_.find(type);
+            if (it == instance()->codecs_.end()) {
+                return nullptr;
+            }
+            return it->second;
+        }
+
+        static bool isSupported(CodecType type) {
+            return type == CodecType::NONE || get(type) != nullptr;
+        }
+
+        // replace the default codec of a type, e.g. by a zstd codec with a trained dictionary
+        static void registerCodec(std::shared_ptr<Codec> codec) {
+            std::lock_guard<std::mutex> locker(instance()->mutex_);
+            instance()->codecs_[codec->type()] = codec;
+        }
+
+        // Compress in to out with the given codec. Returns the codec that was actually applied, which is NONE
+        // when the codec isn't available, the input is below min_size or compression failed.
+        static CodecType compress(CodecType type, int level, const char *in, size_t size, std::vector<char> &out,
+                                  int min_size = DEFAULT_MIN_COMPRESS_SIZE) {
+            if (type == CodecType::NONE || size < static_cast<size_t>(min_size)) {
+                return CodecType::NONE;
+            }
+            std::shared_ptr<Codec> codec = get(type);
+            if (!codec) {
+                Logger::warn("CodecFactory", "Codec is not supported, codec={}", static_cast<int>(type));
+                return CodecType::NONE;
+            }
+            if (!codec->compress(in, size, out, level)) {
+                out.clear();
+                return CodecType::NONE;
+            }
+            return type;
+        }
+
+        static bool decompress(CodecType type, const char *in, size_t size, std::vector<char> &out) {
+            if (type == CodecType::NONE) {
+                out.assign(in, in + size);
+                return true;
+            }
+            std::shared_ptr<Codec> codec = get(type);
+            if (!codec) {
+                Logger::error("CodecFactory", "Codec is not supported, codec={}", static_cast<int>(type));
+                return false;
+            }
+            return codec->decompress(in, size, out);
+        }
+
+    private:
+        CodecFactory() {
+            codecs_[CodecType::ZLIB] = std::make_shared<ZlibCodec>();
+#ifdef USE_LZ4
+            codecs_[CodecType::LZ4] = std::make_shared<Lz4Codec>();
+#endif
+#ifdef USE_ZSTD
+            codecs_[CodecType::ZSTD] = std::make_shared<ZstdCodec>();
+#endif
+        }
+
+        static CodecFactory *instance() {
+            static CodecFactory instance;
+            return &instance;
+        }
+
+        std::mutex mutex_;
+        std::map<CodecType, std::shared_ptr<Codec>> codecs_;
+    };
+}
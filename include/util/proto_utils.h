@@ -10,18 +10,19 @@ namespace data_bus {
     class ProtoUtils {
     public:
         static google::protobuf::Message *createMessage(const std::string &type_name) {
+            const google::protobuf::Message *prototype = getPrototype(type_name);
+            return prototype ? prototype->New() : nullptr;
+        }
+
+        // the default instance of the type, New() on it creates messages without looking up the name again
+        static const google::protobuf::Message *getPrototype(const std::string &type_name) {
             const google::protobuf::Descriptor *descriptor =
                     google::protobuf::DescriptorPool::generated_pool()->FindMessageTypeByName(type_name);
-            if (descriptor) {
-                const google::protobuf::Message *prototype =
-                        google::protobuf::MessageFactory::generated_factory()->GetPrototype(descriptor);
-                if (prototype) {
-                    return prototype->New();
-                }
-            } else {
+            if (!descriptor) {
                 Logger::error("ProtoUtils", "Can't find protobuf descriptor, type_name={}", type_name);
+                return nullptr;
             }
-            return nullptr;
+            return google::protobuf::MessageFactory::generated_factory()->GetPrototype(descriptor);
         }
     };
 }
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <functional>
+#include <condition_variable>
+
+#include "util/logger.h"
+
+namespace util {
+
+    // Fixed number of worker threads running posted tasks in order of arrival. Stopping runs the tasks posted
+    // before and joins the workers, tasks posted after are dropped.
+    class ThreadPool {
+    public:
+        using Task = std::function<void()>;
+
+        explicit ThreadPool(int threads) {
+            workers_.reserve(threads);
+            for (int i = 0; i < threads; i++) {
+                workers_.emplace_back([this]() {
+                    while (true) {
+                        Task task;
+                        {
+                            std::unique_lock<std::mutex> locker(mutex_);
+                            cv_.wait(locker, [this]() { return stopped_ || !tasks_.empty(); });
+                            if (tasks_.empty()) {
+                                break;
+                            }
+                            task = std::move(tasks_.front());
+                            tasks_.pop_front();
+                        }
+                        try {
+                            task();
+                        } catch (std::exception &e) {
+                            Logger::error("ThreadPool", "Task error, {}.", e.what());
+                        }
+                    }
+                });
+            }
+        }
+
+        ~ThreadPool() {
+            stop();
+        }
+
+        ThreadPool(const ThreadPool &) = delete;
+
+        ThreadPool &operator=(const ThreadPool &) = delete;
+
+        void post(Task task) {
+            {
+                std::lock_guard<std::mutex> locker(mutex_);
+                if (stopped_) {
+                    Logger::error("ThreadPool", "Task posted after stop, dropped.");
+                    return;
+                }
+                tasks_.push_back(std::move(task));
+            }
+            cv_.notify_one();
+        }
+
+        std::size_t queueSize() {
+            std::lock_guard<std::mutex> locker(mutex_);
+            return tasks_.size();
+        }
+
+        // Waits for the queued tasks. A task may stop its own pool, its thread then ends after it, but it must not
+        // destroy the pool.
+        void stop() {
+            {
+                std::lock_guard<std::mutex> locker(mutex_);
+                stopped_ = true;
+            }
+            cv_.notify_all();
+            std::lock_guard<std::mutex> locker(join_mutex_);
+            for (std::thread &worker : workers_) {
+                if (!worker.joinable()) {
+                    continue;
+                }
+                if (worker.get_id() == std::this_thread::get_id()) {
+                    worker.detach();
+                } else {
+                    worker.join();
+                }
+            }
+        }
+
+    private:
+        std::mutex mutex_;
+        std::condition_variable cv_;
+        std::deque<Task> tasks_;
+        bool stopped_{false};
+        std::mutex join_mutex_;
+        std::vector<std::thread> workers_;
+    };
+}
@@ -1,43 +1,286 @@
 #pragma once
 
-#include <boost/iostreams/filter/zlib.hpp>
-#include <boost/iostreams/filtering_streambuf.hpp>
-#include <boost/iostreams/device/back_inserter.hpp>
-#include <boost/iostreams/copy.hpp>
+#include <string>
+#include <limits>
+#include <vector>
+#include <stdexcept>
+#include <algorithm>
+#include <zlib.h>
 
 namespace util {
 
+    // Thin wrappers over the zlib stream API. The deflate/inflate states are allocated once per thread
+    // and reset between calls, the output is sized with compressBound so it is allocated only once.
     class ZlibUtils {
     public:
+        static const int DEFAULT_LEVEL = Z_DEFAULT_COMPRESSION;
 
-        static void compress(const char *in, size_t size, std::vector<char> &out) {
-            boost::iostreams::filtering_streambuf<boost::iostreams::output> ios;
-            ios.push(boost::iostreams::zlib_compressor(boost::iostreams::zlib::best_compression));
-            ios.push(boost::iostreams::back_inserter(out));
-            boost::iostreams::copy(boost::iostreams::basic_array_source<char>(in, size), ios);
+        static size_t compressBound(size_t size) {
+            return ::compressBound(static_cast<uLong>(size));
         }
 
-        static void compress(const std::string &in, std::vector<char> &out) {
-            compress(&in[0], out);
+        // Compress into a caller provided buffer, which should hold at least compressBound(size) bytes.
+        // Returns the number of bytes written.
+        static size_t compress(const char *in, size_t size, char *out, size_t capacity,
+                               int level = Z_BEST_COMPRESSION) {
+            return deflateAll(deflater(level, false), in, size, out, capacity);
         }
 
-        static void compress(const std::vector<char> &in, std::vector<char> &out) {
-            compress(&in[0], out);
+        static void compress(const char *in, size_t size, std::vector<char> &out, int level = Z_BEST_COMPRESSION) {
+            out.resize(compressBound(size));
+            out.resize(compress(in, size, out.data(), out.size(), level));
         }
 
-        static void decompress(const char *in, size_t size, std::vector<char> &out) {
-            boost::iostreams::filtering_streambuf<boost::iostreams::output> ios;
-            ios.push(boost::iostreams::zlib_decompressor());
-            ios.push(boost::iostreams::back_inserter(out));
-            boost::iostreams::copy(boost::iostreams::basic_array_source<char>(in, size), ios);
+        static void compress(const std::string &in, std::vector<char> &out, int level = Z_BEST_COMPRESSION) {
+            compress(in.data(), in.size(), out, level);
+        }
+
+        static void compress(const std::vector<char> &in, std::vector<char> &out, int level = Z_BEST_COMPRESSION) {
+            compress(in.data(), in.size(), out, level);
+        }
+
+        // The gzip format of HTTP "Content-Encoding: gzip", the same deflate data with a header and trailer
+        static void gzip(const char *in, size_t size, std::vector<char> &out, int level = Z_BEST_COMPRESSION) {
+            out.resize(compressBound(size) + GZIP_OVERHEAD);
+            out.resize(deflateAll(deflater(level, true), in, size, out.data(), out.size()));
+        }
+
+        // Decompress into a caller provided buffer, throws if the buffer is too small.
+        // Returns the number of bytes written.
+        static size_t decompress(const char *in, size_t size, char *out, size_t capacity) {
+            z_stream &stream = inflater();
+            stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(in));
+            stream.avail_in = static_cast<uInt>(size);
+            stream.next_out = reinterpret_cast<Bytef *>(out);
+            stream.avail_out = static_cast<uInt>(capacity);
+            int ret = inflate(&stream, Z_FINISH);
+            size_t written = capacity - stream.avail_out;
+            inflateReset(&stream);
+            if (ret != Z_STREAM_END) {
+                throw std::runtime_error("zlib decompress error, output buffer is too small or input is invalid");
+            }
+            return written;
+        }
+
+        // Throws if the output would grow beyond max_size, which guards against decompression bombs.
+        static void decompress(const char *in, size_t size, std::vector<char> &out,
+                               size_t max_size = std::numeric_limits<size_t>::max()) {
+            // the raw size isn't stored in the zlib format, start from a guess and grow
+            out.resize(std::min(max_size, std::max(out.capacity(), std::max<size_t>(size * 4, 1024))));
+            z_stream &stream = inflater();
+            stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(in));
+            stream.avail_in = static_cast<uInt>(size);
+            size_t written = 0;
+            int ret = Z_OK;
+            while (ret == Z_OK) {
+                if (written == out.size()) {
+                    if (out.size() >= max_size) {
+                        inflateReset(&stream);
+                        throw std::runtime_error("zlib decompress error, output exceeds the maximum size");
+                    }
+                    out.resize(std::min(max_size, out.size() * 2));
+                }
+                stream.next_out = reinterpret_cast<Bytef *>(out.data() + written);
+                stream.avail_out = static_cast<uInt>(out.size() - written);
+                ret = inflate(&stream, Z_NO_FLUSH);
+                written = out.size() - stream.avail_out;
+            }
+            inflateReset(&stream);
+            if (ret != Z_STREAM_END) {
+                throw std::runtime_error("zlib decompress error, input is truncated or invalid");
+            }
+            out.resize(written);
         }
 
         static void decompress(const std::string &in, std::vector<char> &out) {
-            decompress(&in[0], out);
+            decompress(in.data(), in.size(), out);
         }
 
         static void decompress(const std::vector<char> &in, std::vector<char> &out) {
-            decompress(&in[0], out);
+            decompress(in.data(), in.size(), out);
+        }
+
+    private:
+        // the 10 byte header and 8 byte trailer
+        enum {
+            GZIP_OVERHEAD = 18
+        };
+
+        static size_t deflateAll(z_stream &stream, const char *in, size_t size, char *out, size_t capacity) {
+            stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(in));
+            stream.avail_in = static_cast<uInt>(size);
+            stream.next_out = reinterpret_cast<Bytef *>(out);
+            stream.avail_out = static_cast<uInt>(capacity);
+            int ret = deflate(&stream, Z_FINISH);
+            size_t written = capacity - stream.avail_out;
+            deflateReset(&stream);
+            if (ret != Z_STREAM_END) {
+                throw std::runtime_error("zlib compress error, output buffer is too small or input is invalid");
+            }
+            return written;
         }
+
+        struct Deflater {
+            Deflater() {
+                stream.zalloc = Z_NULL;
+                stream.zfree = Z_NULL;
+                stream.opaque = Z_NULL;
+            }
+
+            ~Deflater() {
+                if (level != NOT_INITIALIZED) {
+                    deflateEnd(&stream);
+                }
+            }
+
+            enum {
+                NOT_INITIALIZED = -2
+            };
+            int level{NOT_INITIALIZED};
+            z_stream stream;
+        };
+
+        struct Inflater {
+            Inflater() {
+                stream.zalloc = Z_NULL;
+                stream.zfree = Z_NULL;
+                stream.opaque = Z_NULL;
+                stream.next_in = Z_NULL;
+                stream.avail_in = 0;
+                if (inflateInit(&stream) != Z_OK) {
+                    throw std::runtime_error("zlib inflateInit error");
+                }
+            }
+
+            ~Inflater() {
+                inflateEnd(&stream);
+            }
+
+            z_stream stream;
+        };
+
+        static z_stream &deflater(int level, bool gzip) {
+            static thread_local Deflater zlib_deflater;
+            static thread_local Deflater gzip_deflater;
+            Deflater &deflater = gzip ? gzip_deflater : zlib_deflater;
+            if (deflater.level == Deflater::NOT_INITIALIZED) {
+                // 16 added to the window bits selects the gzip wrapper
+                if (deflateInit2(&deflater.stream, level, Z_DEFLATED, gzip ? MAX_WBITS + 16 : MAX_WBITS, 8,
+                                 Z_DEFAULT_STRATEGY) != Z_OK) {
+                    throw std::runtime_error("zlib deflateInit error");
+                }
+                deflater.level = level;
+            } else if (deflater.level != level) {
+                // the stream is reset after each call, so the parameters can be changed without flushing
+                deflateParams(&deflater.stream, level, Z_DEFAULT_STRATEGY);
+                deflater.level = level;
+            }
+            return deflater.stream;
+        }
+
+        static z_stream &inflater() {
+            static thread_local Inflater inflater;
+            return inflater.stream;
+        }
+    };
+
+    // Per connection compression context. The deflate history is kept between messages and each message is
+    // ended with a sync flush, so repeated similar messages compress far better than one by one. The
+    // messages must be decompressed in the same order by a ZlibInflateStream on the other end, optionally
+    // both primed with the same preset dictionary.
+    class ZlibDeflateStream {
+    public:
+        explicit ZlibDeflateStream(int level = ZlibUtils::DEFAULT_LEVEL, const std::string &dictionary = "") {
+            stream_.zalloc = Z_NULL;
+            stream_.zfree = Z_NULL;
+            stream_.opaque = Z_NULL;
+            if (deflateInit(&stream_, level) != Z_OK) {
+                throw std::runtime_error("zlib deflateInit error");
+            }
+            if (!dictionary.empty()) {
+                deflateSetDictionary(&stream_, reinterpret_cast<const Bytef *>(dictionary.data()),
+                                     static_cast<uInt>(dictionary.size()));
+            }
+        }
+
+        ZlibDeflateStream(const ZlibDeflateStream &) = delete;
+
+        ZlibDeflateStream &operator=(const ZlibDeflateStream &) = delete;
+
+        ~ZlibDeflateStream() {
+            deflateEnd(&stream_);
+        }
+
+        void compress(const char *in, size_t size, std::vector<char> &out) {
+            // a sync flush adds at most a few bytes on top of the deflate bound
+            out.resize(deflateBound(&stream_, static_cast<uLong>(size)) + 16);
+            stream_.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(in));
+            stream_.avail_in = static_cast<uInt>(size);
+            stream_.next_out = reinterpret_cast<Bytef *>(out.data());
+            stream_.avail_out = static_cast<uInt>(out.size());
+            int ret = deflate(&stream_, Z_SYNC_FLUSH);
+            if (ret != Z_OK || stream_.avail_in != 0) {
+                throw std::runtime_error("zlib stream compress error");
+            }
+            out.resize(out.size() - stream_.avail_out);
+        }
+
+    private:
+        z_stream stream_;
+    };
+
+    class ZlibInflateStream {
+    public:
+        explicit ZlibInflateStream(const std::string &dictionary = "") : dictionary_(dictionary) {
+            stream_.zalloc = Z_NULL;
+            stream_.zfree = Z_NULL;
+            stream_.opaque = Z_NULL;
+            stream_.next_in = Z_NULL;
+            stream_.avail_in = 0;
+            if (inflateInit(&stream_) != Z_OK) {
+                throw std::runtime_error("zlib inflateInit error");
+            }
+        }
+
+        ZlibInflateStream(const ZlibInflateStream &) = delete;
+
+        ZlibInflateStream &operator=(const ZlibInflateStream &) = delete;
+
+        ~ZlibInflateStream() {
+            inflateEnd(&stream_);
+        }
+
+        void decompress(const char *in, size_t size, std::vector<char> &out) {
+            out.resize(std::max(out.capacity(), std::max<size_t>(size * 4, 1024)));
+            stream_.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(in));
+            stream_.avail_in = static_cast<uInt>(size);
+            size_t written = 0;
+            while (true) {
+                if (written == out.size()) {
+                    out.resize(out.size() * 2);
+                }
+                stream_.next_out = reinterpret_cast<Bytef *>(out.data() + written);
+                stream_.avail_out = static_cast<uInt>(out.size() - written);
+                int ret = inflate(&stream_, Z_SYNC_FLUSH);
+                if (ret == Z_NEED_DICT && !dictionary_.empty()) {
+                    inflateSetDictionary(&stream_, reinterpret_cast<const Bytef *>(dictionary_.data()),
+                                         static_cast<uInt>(dictionary_.size()));
+                    ret = inflate(&stream_, Z_SYNC_FLUSH);
+                }
+                written = out.size() - stream_.avail_out;
+                if (ret != Z_OK && ret != Z_BUF_ERROR) {
+                    throw std::runtime_error("zlib stream decompress error");
+                }
+                // done when all input is consumed and inflate didn't fill the whole output
+                if (stream_.avail_in == 0 && stream_.avail_out != 0) {
+                    break;
+                }
+            }
+            out.resize(written);
+        }
+
+    private:
+        std::string dictionary_;
+        z_stream stream_;
     };
 }
@@ -0,0 +1,102 @@
+#include <iostream>
+#include <chrono>
+#include "util/codec.h"
+#include "./map_loader.h"
+
+using namespace util;
+using namespace walle;
+
+struct BenchResult {
+    std::string name;
+    int level;
+    std::size_t raw_size;
+    std::size_t packed_size;
+    double compress_mb_s;
+    double decompress_mb_s;
+};
+
+// run the function repeatedly for at least min_sec seconds, returns the average seconds per call
+template<typename F>
+double measure(F f, double min_sec = 0.5) {
+    int count = 0;
+    auto start = std::chrono::steady_clock::now();
+    double elapsed = 0;
+    while (elapsed < min_sec || count < 3) {
+        f();
+        count++;
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    return elapsed / count;
+}
+
+BenchResult bench(CodecType type, int level, const std::vector<char> &grid) {
+    std::shared_ptr<Codec> codec = CodecFactory::get(type);
+    std::vector<char> packed;
+    std::vector<char> unpacked;
+
+    double compress_sec = measure([&]() {
+        packed.clear();
+        codec->compress(grid.data(), grid.size(), packed, level);
+    });
+    double decompress_sec = measure([&]() {
+        unpacked.clear();
+        codec->decompress(packed.data(), packed.size(), unpacked);
+    });
+    if (unpacked != grid) {
+        Logger::error("CodecBench", "Round trip mismatch, codec={}, level={}", codec->name(), level);
+    }
+
+    double mb = grid.size() / 1024.0 / 1024.0;
+    return {codec->name(), level, grid.size(), packed.size(), mb / compress_sec, mb / decompress_sec};
+}
+
+// tile the map to get the multi-megabyte grids we stream on the bus
+std::vector<char> tile(const OccupancyGrid &map, int times) {
+    std::vector<char> grid;
+    grid.reserve(map.data.size() * times * times);
+    for (int ty = 0; ty < times; ty++) {
+        for (unsigned int y = 0; y < map.info.height; y++) {
+            for (int tx = 0; tx < times; tx++) {
+                auto row = map.data.begin() + y * map.info.width;
+                grid.insert(grid.end(), row, row + map.info.width);
+            }
+        }
+    }
+    return grid;
+}
+
+int main(int argc, char *argv[]) {
+    std::string map_file = argc > 1 ? argv[1] : "data/map.yaml";
+    MapLoader map_loader(map_file);
+    OccupancyGridConstPtr map = map_loader.getMap();
+
+    std::vector<std::pair<CodecType, int>> cases = {
+            {CodecType::ZLIB, 1},
+            {CodecType::ZLIB, 6},
+            {CodecType::ZLIB, 9},
+            {CodecType::LZ4,  1},
+            {CodecType::LZ4,  8},
+            {CodecType::ZSTD, 1},
+            {CodecType::ZSTD, 3},
+            {CodecType::ZSTD, 9},
+            {CodecType::ZSTD, 19},
+    };
+
+    for (int times : {1, 2}) {
+        std::vector<char> grid = tile(*map, times);
+        Logger::info("CodecBench", "grid {}x{}, size={}", map->info.width * times, map->info.height * times,
+                     grid.size());
+        printf("%-6s %6s %12s %12s %8s %14s %14s\n", "codec", "level", "raw", "packed", "ratio", "compress MB/s",
+               "decompress MB/s");
+        for (auto &c : cases) {
+            if (!CodecFactory::isSupported(c.first)) {
+                continue;
+            }
+            BenchResult r = bench(c.first, c.second, grid);
+            printf("%-6s %6d %12zu %12zu %8.2f %14.1f %14.1f\n", r.name.c_str(), r.level, r.raw_size,
+                   r.packed_size, static_cast<double>(r.raw_size) / r.packed_size, r.compress_mb_s,
+                   r.decompress_mb_s);
+        }
+    }
+    return 0;
+}
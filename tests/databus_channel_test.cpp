@@ -0,0 +1,106 @@
+#include <iostream>
+#include <chrono>
+#include <algorithm>
+#include "data_bus/data_bus.h"
+#include "data_bus/data_bus_proxy.h"
+#include "data_bus/data_bus_client.h"
+
+#include "Pose.pb.h"
+
+using namespace data_bus;
+
+static int64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// A cloud used up the credit of a 1 MB window, and the next cloud and a pose wait for credit. As soon as the
+// client returns enough for the pose it goes out, the cloud keeps waiting for half a window. Nobody reads the
+// socket, so the frames stay in the write queue.
+static bool creditCase() {
+    boost::asio::io_context ioc;
+    tcp::acceptor acceptor(ioc, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+    tcp::socket client(ioc);
+    client.connect(acceptor.local_endpoint());
+    std::shared_ptr<TcpSession<WireMessage>> session(new TcpSession<WireMessage>(
+            acceptor.accept(), [](WireMessage &, std::vector<char> &) {},
+            [](std::vector<char> &, WireMessage &) { return false; }, [](WireMessage &, TcpSession<WireMessage> &) {}));
+
+    const int64_t window = 1024 * 1024;
+    FlowController flow(*session, 64 * 1024 * 1024);
+    flow.grant(window);
+    Ptr<FlowChannel> cloud = flow.open("cloud", 1, 1, true);
+    Ptr<FlowChannel> pose = flow.open("pose", 2, 4, true);
+    Frame cloud_frame = std::make_shared<std::vector<char>>(8 * 1024 * 1024);
+    Frame pose_frame = std::make_shared<std::vector<char>>(50);
+
+    bool success = flow.send(*cloud, cloud_frame, DropPolicy::LATEST_WINS) == FlowController::SENT;
+    success = success && flow.send(*cloud, cloud_frame, DropPolicy::LATEST_WINS) == FlowController::PENDING;
+    success = success && flow.send(*pose, pose_frame, DropPolicy::LATEST_WINS) == FlowController::PENDING;
+    // the credit is back to 1 KB
+    flow.grant(static_cast<int64_t>(cloud_frame->size()) - window + 1024);
+    success = success && flow.getSessionStat().pending_count == 1;
+    success = success && flow.send(*pose, pose_frame, DropPolicy::LATEST_WINS) == FlowController::SENT;
+    std::cout << "credit exhausted: pose " << (success ? "passed" : "waited behind") << " the pending cloud"
+              << std::endl;
+    return success;
+}
+
+// Small poses and 8 MB clouds on one connection. The clouds go out in chunks, so on a slow link a pose
+// waits for about a chunk instead of a whole cloud.
+int main() {
+    creditCase();
+
+    DataBusProxy::listen(8090);
+    DataBusClient::connect("127.0.0.1", 8090);
+
+    std::mutex mutex;
+    std::vector<double> latencies_ms;
+    SubscribeOptions pose_options;
+    pose_options.max_queue_size = 100;
+    pose_options.priority = 4;
+    DataBusClient::subscribe<msg::Pose>("pose", "channel_test", [&](ConstPtr<msg::Pose> pose) {
+        std::lock_guard<std::mutex> locker(mutex);
+        latencies_ms.push_back((nowNs() - pose->header().stamp()) / 1e6);
+    }, pose_options);
+
+    std::atomic_int clouds{0};
+    SubscribeOptions cloud_options;
+    cloud_options.max_queue_size = 2;
+    DataBusClient::subscribe<msg::Pose>("cloud", "channel_test", [&](ConstPtr<msg::Pose> cloud) {
+        clouds++;
+    }, cloud_options);
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    std::thread([]() {
+        for (int i = 0; i < 20; i++) {
+            Ptr<msg::Pose> cloud(new msg::Pose());
+            cloud->set_id(i);
+            cloud->set_name(std::string(8 * 1024 * 1024, 'c'));
+            DataBus::publish<msg::Pose>("cloud", cloud);
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+    }).detach();
+
+    for (int i = 0; i < 300; i++) {
+        Ptr<msg::Pose> pose(new msg::Pose());
+        pose->set_id(i);
+        pose->mutable_header()->set_stamp(nowNs());
+        DataBus::publish<msg::Pose>("pose", pose);
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+    std::lock_guard<std::mutex> locker(mutex);
+    std::sort(latencies_ms.begin(), latencies_ms.end());
+    if (!latencies_ms.empty()) {
+        std::cout << "poses: " << latencies_ms.size() << ", clouds: " << clouds
+                  << ", latency p50: " << latencies_ms[latencies_ms.size() / 2]
+                  << " ms, p99: " << latencies_ms[latencies_ms.size() * 99 / 100]
+                  << " ms, max: " << latencies_ms.back() << " ms" << std::endl;
+    }
+    for (auto &stat : DataBusProxy::getSessionStats()) {
+        Logger::info("SessionStats", "{}", stat.toString());
+    }
+    _exit(0);
+}
@@ -0,0 +1,70 @@
+// needs -DUSE_COROUTINES=ON
+#include <iostream>
+#include <thread>
+#include "data_bus/async_bus.h"
+#include "data_bus/data_bus_proxy.h"
+
+#include "Pose.pb.h"
+
+using namespace data_bus;
+
+Ptr<msg::Pose> makePose(int id) {
+    Ptr<msg::Pose> pose(new msg::Pose());
+    pose->set_id(id);
+    return pose;
+}
+
+Task remote(AsyncBus &bus) {
+    bool subscribed = co_await bus.subscribe<msg::Pose>("remote_pose");
+    std::cout << "subscribed: " << subscribed << std::endl;
+
+    for (int i = 0; i < 5; i++) {
+        bool sent = co_await bus.publish<msg::Pose>("remote_pose", makePose(i));
+        auto pose = co_await bus.next<msg::Pose>("remote_pose");
+        std::cout << "sent: " << sent << ", remote pose: " << pose->id() << std::endl;
+    }
+
+    bool unsubscribed = co_await bus.unsubscribe("remote_pose");
+    std::cout << "unsubscribed: " << unsubscribed << std::endl;
+}
+
+Task local(AsyncBus &bus) {
+    // ends when the topic is unsubscribed
+    while (auto pose = co_await bus.next<msg::Pose>("local_pose")) {
+        std::cout << "local pose: " << pose->id() << std::endl;
+    }
+    std::cout << "local done" << std::endl;
+}
+
+Task stopLocal(AsyncBus &bus) {
+    co_await bus.unsubscribe("local_pose");
+}
+
+int main() {
+    DataBusProxy::listen(8086);
+    DataBusClient::connect("127.0.0.1", 8086);
+
+    boost::asio::io_context ioc;
+    auto guard = boost::asio::make_work_guard(ioc);
+    AsyncBus bus(ioc);
+    bus.spawn(remote(bus));
+    bus.spawn(local(bus));
+
+    std::thread publisher([&bus]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        for (int i = 0; i < 5; i++) {
+            DataBus::publish<msg::Pose>("local_pose", makePose(i));
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        bus.spawn(stopLocal(bus));
+    });
+
+    std::thread stopper([&ioc]() {
+        std::this_thread::sleep_for(std::chrono::seconds(2));
+        ioc.stop();
+    });
+    ioc.run();
+    publisher.join();
+    stopper.join();
+    return 0;
+}
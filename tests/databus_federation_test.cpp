@@ -0,0 +1,56 @@
+#include <iostream>
+#include <chrono>
+#include "data_bus/data_bus.h"
+#include "data_bus/data_bus_proxy.h"
+
+#include "Pose.pb.h"
+
+using namespace data_bus;
+
+// Run one process per node on loopback, each links to the ports of the nodes started before it:
+//   databus_federation_test a 8085
+//   databus_federation_test b 8086 8085
+//   databus_federation_test c 8087 8085 8086
+// Every node prints the poses of all nodes once, the duplicates over the triangle are dropped.
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        std::cout << "usage: " << argv[0] << " <node_id> <port> [peer_port...]" << std::endl;
+        return 1;
+    }
+    std::string node_id = argv[1];
+    DataBusProxy::nodeId(node_id);
+    DataBusProxy::listen(static_cast<unsigned short>(std::stoi(argv[2])));
+
+    LinkOptions options;
+    options.codec = CodecType::ZLIB;
+    options.max_rate = 10;
+    for (int i = 3; i < argc; i++) {
+        DataBusProxy::peer("127.0.0.1", static_cast<unsigned short>(std::stoi(argv[i])), options);
+    }
+
+    DataBus::subscribe<msg::Pose>("chat", "federation_test", [node_id](ConstPtr<msg::Pose> pose) {
+        std::cout << node_id << " got: " << pose->name() << std::endl;
+    });
+    // the peers only forward topics somebody subscribed to
+    DataBusProxy::addInterest("chat");
+
+    std::thread([]() {
+        while (true) {
+            auto stats = DataBusProxy::getSessionStats();
+            for (auto &stat : stats) {
+                Logger::info("SessionStats", "{}", stat.toString());
+            }
+            Logger::info("SessionStats", "duplicates={}", DataBusProxy::getDuplicateCount());
+            std::this_thread::sleep_for(std::chrono::seconds(3));
+        }
+    }).detach();
+
+    int id = 0;
+    while (true) {
+        Ptr<msg::Pose> pose(new msg::Pose());
+        pose->set_id(id++);
+        pose->set_name(node_id + " pose " + std::to_string(pose->id()));
+        DataBus::publish<msg::Pose>("chat", pose);
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+    }
+}
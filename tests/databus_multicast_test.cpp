@@ -0,0 +1,49 @@
+#include <iostream>
+#include <chrono>
+#include "data_bus/data_bus.h"
+#include "data_bus/data_bus_proxy.h"
+
+#include "Pose.pb.h"
+
+using namespace data_bus;
+
+// Multicast on loopback, start any number of receivers and one sender:
+//   databus_multicast_test recv
+//   databus_multicast_test send
+// The poses are larger than a datagram to exercise fragmentation.
+int main(int argc, char **argv) {
+    std::string mode = argc > 1 ? argv[1] : "recv";
+    std::string group = "239.255.0.1";
+    unsigned short port = 30001;
+
+    if (mode == "send") {
+        MulticastOptions options;
+        options.interface = "127.0.0.1";
+        DataBusProxy::multicast("pose", group, port, options);
+    } else {
+        DataBusProxy::joinMulticast(group, port, "127.0.0.1");
+        DataBus::subscribe<msg::Pose>("pose", "multicast_test", [](ConstPtr<msg::Pose> pose) {
+            std::cout << "got pose: id=" << pose->id() << ", size=" << pose->ByteSizeLong() << std::endl;
+        });
+    }
+
+    std::thread([]() {
+        while (true) {
+            std::this_thread::sleep_for(std::chrono::seconds(3));
+            for (auto &stat : DataBusProxy::getMulticastStats()) {
+                Logger::info("MulticastStats", "{}", stat.toString());
+            }
+        }
+    }).detach();
+
+    int id = 0;
+    while (true) {
+        if (mode == "send") {
+            Ptr<msg::Pose> pose(new msg::Pose());
+            pose->set_id(id++);
+            pose->set_name(std::string(8000 + id % 100, 'p'));
+            DataBus::publish<msg::Pose>("pose", pose);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+}
@@ -0,0 +1,284 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include "data_bus/data_bus.h"
+#include "data_bus/data_bus_proxy.h"
+#include "data_bus/data_bus_client.h"
+
+#include "Pose.pb.h"
+
+using namespace data_bus;
+
+// End to end benchmark of DataBusProxy on loopback. This process runs the proxy and publishes, the
+// subscribers are DataBusClients in child processes, one connection each. Sweeps message size, publish
+// rate, subscriber count and compression, and appends one JSON object per case to the result file:
+//   databus_proxy_bench [result_file] [seconds_per_case] [port]
+// Latencies are the worst p50/p99/p999 over the subscribers. The proxy CPU includes building and
+// publishing the messages.
+
+static int64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static double cpuSec() {
+    struct rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+struct BenchCase {
+    std::size_t size;
+    // messages per second, 0 publishes as fast as possible
+    int rate;
+    int subscribers;
+    CodecType codec;
+};
+
+struct SubscriberResult {
+    int64_t received{0};
+    int64_t bytes{0};
+    int64_t lost{0};
+    double p50_us{0};
+    double p99_us{0};
+    double p999_us{0};
+    double cpu_sec{0};
+};
+
+// Child process: subscribe, report "BENCH ready" once the proxy acked, and the result after the end marker.
+// The subscriber name has to be unique on the topic, so every child gets its own.
+static int runSubscriber(unsigned short port, const std::string &topic, const std::string &name, CodecType codec) {
+    Logger::setLevel(Logger::WARN);
+    DataBusClient::connect("127.0.0.1", port);
+
+    std::mutex mutex;
+    std::condition_variable done_cond;
+    bool done = false;
+    std::vector<int64_t> latencies;
+    SubscriberResult result;
+    int last_id = -1;
+
+    SubscribeOptions options;
+    options.max_queue_size = 1000;
+    options.codec = codec;
+    DataBusClient::subscribe<msg::Pose>(topic, name, [&](ConstPtr<msg::Pose> pose) {
+        int64_t latency = nowNs() - pose->header().stamp();
+        std::lock_guard<std::mutex> locker(mutex);
+        if (pose->id() < 0) {
+            done = true;
+            done_cond.notify_one();
+            return;
+        }
+        latencies.push_back(latency);
+        result.received++;
+        result.bytes += pose->name().size();
+        if (pose->id() > last_id + 1) {
+            result.lost += pose->id() - last_id - 1;
+        }
+        last_id = std::max(last_id, pose->id());
+    }, options, [](bool success) {
+        std::cout << "BENCH ready " << success << std::endl;
+        if (!success) {
+            _exit(1);
+        }
+    });
+
+    std::unique_lock<std::mutex> locker(mutex);
+    done_cond.wait(locker, [&]() { return done; });
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&](double p) {
+        return latencies.empty() ? 0 : latencies[std::min(latencies.size() - 1,
+                                                          static_cast<std::size_t>(latencies.size() * p))] / 1e3;
+    };
+    std::cout << "BENCH result " << result.received << " " << result.bytes << " " << result.lost << " "
+              << percentile(0.5) << " " << percentile(0.99) << " " << percentile(0.999) << " " << cpuSec()
+              << std::endl;
+    _exit(0);
+}
+
+struct Child {
+    pid_t pid;
+    FILE *out;
+};
+
+static Child spawnSubscriber(unsigned short port, const std::string &topic, int index, CodecType codec) {
+    // the arguments are built before fork, the child of a threaded process shouldn't allocate
+    std::string port_arg = std::to_string(port);
+    std::string name_arg = "bench_" + std::to_string(index);
+    std::string codec_arg = std::to_string(static_cast<int>(codec));
+    int fds[2];
+    if (pipe(fds) != 0) {
+        throw std::runtime_error("pipe failed");
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        execl("/proc/self/exe", "databus_proxy_bench", "sub", port_arg.c_str(), topic.c_str(), name_arg.c_str(),
+              codec_arg.c_str(), static_cast<char *>(nullptr));
+        _exit(127);
+    }
+    close(fds[1]);
+    return {pid, fdopen(fds[0], "r")};
+}
+
+// the next "BENCH" line of the child, log lines are skipped
+static bool readLine(Child &child, std::string &line) {
+    char buf[4096];
+    while (fgets(buf, sizeof(buf), child.out)) {
+        line = buf;
+        if (line.compare(0, 6, "BENCH ") == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static Ptr<msg::Pose> makePose(int id, const std::string &payload) {
+    Ptr<msg::Pose> pose(new msg::Pose());
+    pose->set_id(id);
+    pose->set_name(payload);
+    pose->mutable_header()->set_stamp(nowNs());
+    return pose;
+}
+
+static std::string runCase(const BenchCase &c, unsigned short port, double seconds, int index) {
+    std::string topic = "bench/" + std::to_string(index);
+    std::vector<Child> children;
+    for (int i = 0; i < c.subscribers; i++) {
+        children.push_back(spawnSubscriber(port, topic, i, c.codec));
+    }
+    std::string line;
+    for (Child &child : children) {
+        readLine(child, line);
+    }
+
+    // a small alphabet, so the payload compresses about as well as typical sensor data
+    std::mt19937 random(index);
+    std::string payload(c.size, ' ');
+    for (char &ch : payload) {
+        ch = static_cast<char>('a' + random() % 16);
+    }
+
+    double cpu_start = cpuSec();
+    int64_t start = nowNs();
+    int64_t end = start + static_cast<int64_t>(seconds * 1e9);
+    int published = 0;
+    while (nowNs() < end) {
+        if (c.rate > 0) {
+            std::this_thread::sleep_until(std::chrono::steady_clock::time_point(
+                    std::chrono::nanoseconds(start + static_cast<int64_t>(published * 1e9 / c.rate))));
+        }
+        DataBus::publish<msg::Pose>(topic, makePose(published++, payload));
+    }
+    double elapsed = (nowNs() - start) / 1e9;
+
+    // the end marker is repeated until every subscriber reported, in case a full queue dropped it
+    std::atomic_bool reported{false};
+    std::thread marker([&]() {
+        while (!reported) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+            DataBus::publish<msg::Pose>(topic, makePose(-1, ""));
+        }
+    });
+    std::vector<SubscriberResult> results;
+    for (Child &child : children) {
+        SubscriberResult result;
+        if (readLine(child, line)) {
+            std::istringstream in(line.substr(std::string("BENCH result ").size()));
+            in >> result.received >> result.bytes >> result.lost >> result.p50_us >> result.p99_us
+               >> result.p999_us >> result.cpu_sec;
+        }
+        results.push_back(result);
+    }
+    reported = true;
+    marker.join();
+    double proxy_cpu = cpuSec() - cpu_start;
+    for (Child &child : children) {
+        fclose(child.out);
+        waitpid(child.pid, nullptr, 0);
+    }
+
+    SubscriberResult total;
+    for (SubscriberResult &result : results) {
+        total.received += result.received;
+        total.bytes += result.bytes;
+        total.lost += result.lost;
+        total.cpu_sec += result.cpu_sec;
+        total.p50_us = std::max(total.p50_us, result.p50_us);
+        total.p99_us = std::max(total.p99_us, result.p99_us);
+        total.p999_us = std::max(total.p999_us, result.p999_us);
+    }
+
+    std::ostringstream json;
+    json << "{\"wire_version\":" << WireFormat::VERSION
+         << ",\"size\":" << c.size
+         << ",\"rate\":" << c.rate
+         << ",\"subscribers\":" << c.subscribers
+         << ",\"codec\":\"" << (c.codec == CodecType::NONE ? "none" : CodecFactory::get(c.codec)->name()) << "\""
+         << ",\"published\":" << published
+         << ",\"received\":" << total.received
+         << ",\"lost\":" << total.lost
+         << ",\"msgs_per_s\":" << total.received / elapsed
+         << ",\"mb_per_s\":" << total.bytes / elapsed / 1024 / 1024
+         << ",\"proxy_cpu_us_per_msg\":" << (published > 0 ? proxy_cpu * 1e6 / published : 0)
+         << ",\"client_cpu_us_per_msg\":" << (total.received > 0 ? total.cpu_sec * 1e6 / total.received : 0)
+         << ",\"p50_us\":" << total.p50_us
+         << ",\"p99_us\":" << total.p99_us
+         << ",\"p999_us\":" << total.p999_us
+         << "}";
+    return json.str();
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1 && std::string(argv[1]) == "sub") {
+        return runSubscriber(static_cast<unsigned short>(std::stoi(argv[2])), argv[3], argv[4],
+                             static_cast<CodecType>(std::stoi(argv[5])));
+    }
+    std::string result_file = argc > 1 ? argv[1] : "proxy_bench.jsonl";
+    double seconds = argc > 2 ? std::stod(argv[2]) : 2;
+    unsigned short port = static_cast<unsigned short>(argc > 3 ? std::stoi(argv[3]) : 8099);
+
+    Logger::setLevel(Logger::WARN);
+    DataBusProxy::listen(port);
+    CodecType codec = CodecFactory::isSupported(CodecType::ZSTD) ? CodecType::ZSTD : CodecType::ZLIB;
+
+    std::vector<BenchCase> cases;
+    for (std::size_t size : {64, 1024, 64 * 1024, 1024 * 1024, 8 * 1024 * 1024}) {
+        for (int rate : {100, 1000, 0}) {
+            for (int subscribers : {1, 4}) {
+                for (CodecType c : {CodecType::NONE, codec}) {
+                    cases.push_back({size, rate, subscribers, c});
+                }
+            }
+        }
+    }
+
+    std::ofstream out(result_file, std::ios::app);
+    printf("%10s %6s %4s %6s %12s %10s %10s %10s %10s %10s\n", "size", "rate", "subs", "codec", "msgs/s", "MB/s",
+           "cpu us", "p50 us", "p99 us", "p999 us");
+    for (std::size_t i = 0; i < cases.size(); i++) {
+        const BenchCase &c = cases[i];
+        std::string json = runCase(c, port, seconds, static_cast<int>(i));
+        out << json << std::endl;
+
+        // the same numbers for reading along
+        auto field = [&json](const std::string &name) {
+            std::size_t pos = json.find("\"" + name + "\":");
+            return pos == std::string::npos ? 0 : std::stod(json.substr(pos + name.size() + 3));
+        };
+        printf("%10zu %6d %4d %6s %12.0f %10.1f %10.1f %10.0f %10.0f %10.0f\n", c.size, c.rate, c.subscribers,
+               c.codec == CodecType::NONE ? "none" : "on", field("msgs_per_s"), field("mb_per_s"),
+               field("proxy_cpu_us_per_msg"), field("p50_us"), field("p99_us"), field("p999_us"));
+        fflush(stdout);
+    }
+    out.close();
+    _exit(0);
+}
@@ -0,0 +1,68 @@
+#include <iostream>
+#include <chrono>
+#include "data_bus/data_bus.h"
+#include "data_bus/data_bus_client.h"
+#include "data_bus/data_bus_proxy.h"
+
+#include "Pose.pb.h"
+
+using namespace data_bus;
+
+Ptr<msg::Pose> makePose(int id) {
+    Ptr<msg::Pose> pose(new msg::Pose());
+    pose->set_id(id);
+    return pose;
+}
+
+int main() {
+    // services of the proxy process
+    DataBus::advertiseService<msg::Pose, msg::Pose>("next_pose", [](ConstPtr<msg::Pose> req) {
+        Ptr<msg::Pose> res(new msg::Pose());
+        res->set_id(req->id() + 1);
+        res->set_name("next of " + std::to_string(req->id()));
+        return res;
+    });
+    DataBus::advertiseService<msg::Pose, msg::Pose>("slow_pose", [](ConstPtr<msg::Pose> req) {
+        std::this_thread::sleep_for(std::chrono::seconds(2));
+        return Ptr<msg::Pose>(new msg::Pose(*req));
+    });
+
+    DataBusProxy::listen(8085);
+    DataBusClient::connect("127.0.0.1", 8085);
+
+    // in process
+    auto local = DataBus::call<msg::Pose, msg::Pose>("next_pose", makePose(1));
+    std::cout << "local: " << local.get()->name() << std::endl;
+
+    // many calls in flight on one connection
+    std::vector<ServiceFuture<msg::Pose>> futures;
+    for (int i = 0; i < 10; i++) {
+        futures.push_back(DataBusClient::call<msg::Pose, msg::Pose>("next_pose", makePose(i)));
+    }
+    for (auto &future : futures) {
+        std::cout << "remote: " << future.get()->name() << std::endl;
+    }
+
+    auto slow = DataBusClient::call<msg::Pose, msg::Pose>("slow_pose", makePose(1), 500);
+    try {
+        slow.get();
+    } catch (ServiceException &e) {
+        std::cout << "slow: " << e.what() << std::endl;
+    }
+
+    auto cancelled = DataBusClient::call<msg::Pose, msg::Pose>("slow_pose", makePose(2), 0);
+    cancelled.cancel();
+    try {
+        cancelled.get();
+    } catch (ServiceException &e) {
+        std::cout << "cancelled: " << e.what() << std::endl;
+    }
+
+    auto missing = DataBusClient::call<msg::Pose, msg::Pose>("no_such_service", makePose(1));
+    try {
+        missing.get();
+    } catch (ServiceException &e) {
+        std::cout << "missing: " << e.what() << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,62 @@
+#include <iostream>
+#include <thread>
+#include "data_bus/time_synchronizer.h"
+
+#include "Pose.pb.h"
+
+using namespace data_bus;
+
+const int64_t MS = 1000000;
+
+Ptr<msg::Pose> makePose(int id, int64_t stamp) {
+    Ptr<msg::Pose> pose(new msg::Pose());
+    pose->set_id(id);
+    pose->mutable_header()->set_stamp(stamp);
+    return pose;
+}
+
+// publish every period_ms for one second, with up to jitter_ms of delay in the stamp
+void publish(const std::string &topic, int period_ms, int jitter_ms) {
+    for (int i = 0; i * period_ms < 1000; i++) {
+        int64_t stamp = (i * period_ms + (jitter_ms > 0 ? rand() % jitter_ms : 0)) * MS;
+        DataBus::publish<msg::Pose>(topic, makePose(i, stamp));
+        std::this_thread::sleep_for(std::chrono::milliseconds(period_ms));
+    }
+}
+
+int main() {
+    // lidar 10Hz, imu 100Hz, odometry 50Hz, matched within 5ms
+    ApproximateTimeSynchronizer<msg::Pose, msg::Pose, msg::Pose> fusion(
+            5 * MS, [](ConstPtr<msg::Pose> lidar, ConstPtr<msg::Pose> imu, ConstPtr<msg::Pose> odom) {
+                std::cout << "fused lidar=" << lidar->header().stamp() / MS
+                          << " imu=" << imu->header().stamp() / MS
+                          << " odom=" << odom->header().stamp() / MS << std::endl;
+            }, 50);
+    fusion.subscribe("fusion", {{"lidar", "imu", "odom"}});
+
+    // the same stamps on both topics
+    TimeSynchronizer<msg::Pose, msg::Pose> stereo([](ConstPtr<msg::Pose> left, ConstPtr<msg::Pose> right) {
+        std::cout << "stereo " << left->header().stamp() / MS << " " << right->header().stamp() / MS << std::endl;
+    });
+    stereo.subscribe("stereo", {{"left", "right"}});
+
+    std::thread lidar(publish, "lidar", 100, 3);
+    std::thread imu(publish, "imu", 10, 0);
+    std::thread odom(publish, "odom", 20, 2);
+    std::thread left(publish, "left", 100, 0);
+    std::thread right(publish, "right", 50, 0);
+    lidar.join();
+    imu.join();
+    odom.join();
+    left.join();
+    right.join();
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    for (auto &stat : fusion.getSyncStats()) {
+        std::cout << stat.toString() << std::endl;
+    }
+    for (auto &stat : stereo.getSyncStats()) {
+        std::cout << stat.toString() << std::endl;
+    }
+    return 0;
+}
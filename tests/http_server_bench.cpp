@@ -0,0 +1,473 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <cmath>
+#include <atomic>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "http_server/http_server.h"
+
+using namespace http_server;
+
+// Load test of HttpServer on loopback. This process runs the server with a static file, a dynamic route and
+// websocket echo, and drives it with async beast clients. Sweeps the route, the connections, keep-alive and
+// the pipelining depth, and appends one JSON object per case to the result file:
+//   http_server_bench [result_file] [seconds_per_case] [port] [server_threads] [engines]
+//                     [connections keep_alive pipeline]
+// With engines set to 1 the server runs an engine per thread instead of one io_context. The last three run
+// that one configuration on every route instead of the sweep. Without keep-alive every request opens its own
+// connection and its latency includes the connect. With pipelining a connection writes that many requests,
+// or websocket messages, at once and then reads the responses, their latency is from the write. The CPU time
+// per request is that of the whole process, and of the server threads alone, which is the process less the
+// client threads.
+
+static int64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// RUSAGE_SELF for the process, RUSAGE_THREAD for the calling thread
+static double cpuSec(int who = RUSAGE_SELF) {
+    struct rusage usage{};
+    getrusage(who, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+// Latencies in buckets of a quarter octave from 1us up, percentiles are the upper bounds of their buckets.
+class Histogram {
+public:
+    enum {
+        PER_OCTAVE = 4,
+        BUCKETS = 30 * PER_OCTAVE
+    };
+
+    Histogram() : counts_(BUCKETS, 0) {
+    }
+
+    void add(int64_t latency_ns) {
+        double us = std::max(1.0, latency_ns / 1e3);
+        std::size_t bucket = static_cast<std::size_t>(std::log2(us) * PER_OCTAVE);
+        counts_[std::min<std::size_t>(bucket, BUCKETS - 1)]++;
+        total_++;
+    }
+
+    void merge(const Histogram &other) {
+        for (std::size_t i = 0; i < counts_.size(); i++) {
+            counts_[i] += other.counts_[i];
+        }
+        total_ += other.total_;
+    }
+
+    double percentile(double p) const {
+        int64_t rank = static_cast<int64_t>(total_ * p);
+        int64_t seen = 0;
+        for (std::size_t i = 0; i < counts_.size(); i++) {
+            seen += counts_[i];
+            if (seen > rank) {
+                return upper(i);
+            }
+        }
+        return 0;
+    }
+
+    // [[upper_us,count],...] of the buckets that aren't empty
+    std::string json() const {
+        std::ostringstream out;
+        out << "[";
+        bool first = true;
+        for (std::size_t i = 0; i < counts_.size(); i++) {
+            if (counts_[i] == 0) {
+                continue;
+            }
+            out << (first ? "" : ",") << "[" << upper(i) << "," << counts_[i] << "]";
+            first = false;
+        }
+        out << "]";
+        return out.str();
+    }
+
+    int64_t total() const {
+        return total_;
+    }
+
+private:
+    static double upper(std::size_t bucket) {
+        return std::round(std::pow(2.0, static_cast<double>(bucket + 1) / PER_OCTAVE));
+    }
+
+    std::vector<int64_t> counts_;
+    int64_t total_{0};
+};
+
+enum class Route {
+    STATIC,
+    DYNAMIC,
+    WEBSOCKET
+};
+
+static const char *routeName(Route route) {
+    switch (route) {
+        case Route::STATIC:
+            return "static";
+        case Route::DYNAMIC:
+            return "dynamic";
+        default:
+            return "websocket";
+    }
+}
+
+struct BenchCase {
+    Route route;
+    int connections;
+    bool keep_alive;
+    // requests written at once on a connection before reading their responses
+    int pipeline;
+};
+
+// the counters of a client connection, read after its io_context stopped
+struct ClientStats {
+    int64_t requests{0};
+    int64_t bytes{0};
+    int64_t errors{0};
+    Histogram latencies;
+};
+
+// An http client connection that sends batches of pipeline requests until the end of the case. Without
+// keep-alive it reconnects for every request.
+class HttpClient : public std::enable_shared_from_this<HttpClient> {
+public:
+    HttpClient(asio::io_context &ioc, tcp::endpoint endpoint, const BenchCase &c, std::string target,
+               int64_t end)
+            : stream_(ioc), endpoint_(endpoint), case_(c), end_(end) {
+        http::request<http::empty_body> req{HttpMethod::get, target, 11};
+        req.set(HttpHeader::host, "127.0.0.1");
+        req.keep_alive(c.keep_alive);
+        std::ostringstream out;
+        out << req;
+        for (int i = 0; i < c.pipeline; i++) {
+            requests_ += out.str();
+        }
+    }
+
+    void start() {
+        do_connect();
+    }
+
+    ClientStats stats;
+
+private:
+    void do_connect() {
+        if (nowNs() >= end_) {
+            return;
+        }
+        sent_ = nowNs();
+        auto self = shared_from_this();
+        stream_.async_connect(endpoint_, [this, self](boost::system::error_code ec) {
+            if (ec) {
+                stats.errors++;
+                return;
+            }
+            stream_.socket().set_option(tcp::no_delay(true));
+            do_write();
+        });
+    }
+
+    void do_write() {
+        if (nowNs() >= end_) {
+            return;
+        }
+        if (case_.keep_alive) {
+            sent_ = nowNs();
+        }
+        auto self = shared_from_this();
+        asio::async_write(stream_, asio::buffer(requests_), [this, self](boost::system::error_code ec, std::size_t) {
+            if (ec) {
+                stats.errors++;
+                return;
+            }
+            pending_ = case_.pipeline;
+            do_read();
+        });
+    }
+
+    void do_read() {
+        parser_.emplace();
+        parser_->body_limit((std::numeric_limits<std::uint64_t>::max) ());
+        auto self = shared_from_this();
+        http::async_read(stream_, buffer_, *parser_, [this, self](boost::system::error_code ec, std::size_t bytes) {
+            if (ec) {
+                stats.errors++;
+                return;
+            }
+            stats.latencies.add(nowNs() - sent_);
+            stats.requests++;
+            stats.bytes += bytes;
+            if (parser_->get().result() != HttpStatus::ok) {
+                stats.errors++;
+            }
+            if (--pending_ > 0) {
+                do_read();
+                return;
+            }
+            if (case_.keep_alive && parser_->keep_alive()) {
+                do_write();
+                return;
+            }
+            boost::system::error_code close_ec;
+            stream_.socket().shutdown(tcp::socket::shutdown_both, close_ec);
+            stream_.close();
+            buffer_.consume(buffer_.size());
+            do_connect();
+        });
+    }
+
+    beast::tcp_stream stream_;
+    tcp::endpoint endpoint_;
+    BenchCase case_;
+    int64_t end_;
+    std::string requests_;
+    beast::flat_buffer buffer_;
+    boost::optional<http::response_parser<http::string_body>> parser_;
+    int pending_{0};
+    int64_t sent_{0};
+};
+
+// A websocket client that sends batches of pipeline messages and reads their echoes until the end of the case.
+class WebsocketClient : public std::enable_shared_from_this<WebsocketClient> {
+public:
+    WebsocketClient(asio::io_context &ioc, tcp::endpoint endpoint, const BenchCase &c, std::size_t size,
+                    int64_t end)
+            : websocket_(ioc), endpoint_(endpoint), case_(c), message_(size, 'x'), end_(end) {
+        websocket_.binary(true);
+    }
+
+    void start() {
+        auto self = shared_from_this();
+        beast::get_lowest_layer(websocket_).async_connect(endpoint_, [this, self](boost::system::error_code ec) {
+            if (ec) {
+                stats.errors++;
+                return;
+            }
+            beast::get_lowest_layer(websocket_).socket().set_option(tcp::no_delay(true));
+            websocket_.async_handshake("127.0.0.1", "/ws", [this, self](boost::system::error_code ec) {
+                if (ec) {
+                    stats.errors++;
+                    return;
+                }
+                do_write();
+            });
+        });
+    }
+
+    ClientStats stats;
+
+private:
+    void do_write() {
+        if (nowNs() >= end_) {
+            auto self = shared_from_this();
+            websocket_.async_close(websocket::close_code::normal, [self](boost::system::error_code) {
+            });
+            return;
+        }
+        if (writes_ == 0) {
+            sent_ = nowNs();
+            writes_ = case_.pipeline;
+        }
+        auto self = shared_from_this();
+        websocket_.async_write(asio::buffer(message_), [this, self](boost::system::error_code ec, std::size_t) {
+            if (ec) {
+                stats.errors++;
+                return;
+            }
+            if (--writes_ > 0) {
+                do_write();
+                return;
+            }
+            pending_ = case_.pipeline;
+            do_read();
+        });
+    }
+
+    void do_read() {
+        auto self = shared_from_this();
+        websocket_.async_read(buffer_, [this, self](boost::system::error_code ec, std::size_t bytes) {
+            if (ec) {
+                stats.errors++;
+                return;
+            }
+            buffer_.consume(buffer_.size());
+            stats.latencies.add(nowNs() - sent_);
+            stats.requests++;
+            stats.bytes += bytes;
+            if (--pending_ > 0) {
+                do_read();
+                return;
+            }
+            do_write();
+        });
+    }
+
+    websocket::stream<beast::tcp_stream> websocket_;
+    tcp::endpoint endpoint_;
+    BenchCase case_;
+    std::string message_;
+    int64_t end_;
+    beast::flat_buffer buffer_;
+    int writes_{0};
+    int pending_{0};
+    int64_t sent_{0};
+};
+
+static const std::size_t STATIC_SIZE = 4096;
+static const std::size_t DYNAMIC_SIZE = 128;
+static const std::size_t WEBSOCKET_SIZE = 128;
+
+static std::string runCase(const BenchCase &c, unsigned short port, double seconds, int client_threads) {
+    asio::io_context ioc;
+    tcp::endpoint endpoint{asio::ip::make_address("127.0.0.1"), port};
+    int64_t start = nowNs();
+    int64_t end = start + static_cast<int64_t>(seconds * 1e9);
+
+    std::vector<std::shared_ptr<HttpClient>> http_clients;
+    std::vector<std::shared_ptr<WebsocketClient>> websocket_clients;
+    for (int i = 0; i < c.connections; i++) {
+        if (c.route == Route::WEBSOCKET) {
+            websocket_clients.push_back(std::make_shared<WebsocketClient>(ioc, endpoint, c, WEBSOCKET_SIZE, end));
+            websocket_clients.back()->start();
+        } else {
+            http_clients.push_back(std::make_shared<HttpClient>(
+                    ioc, endpoint, c, c.route == Route::STATIC ? "/bench.html" : "/dynamic", end));
+            http_clients.back()->start();
+        }
+    }
+
+    double cpu_start = cpuSec();
+    std::vector<std::thread> threads;
+    std::vector<double> client_cpu(client_threads);
+    for (int i = 0; i < client_threads; i++) {
+        threads.emplace_back([&ioc, &client_cpu, i]() {
+            double thread_start = cpuSec(RUSAGE_THREAD);
+            ioc.run();
+            client_cpu[i] = cpuSec(RUSAGE_THREAD) - thread_start;
+        });
+    }
+    for (std::thread &t : threads) {
+        t.join();
+    }
+    double elapsed = (nowNs() - start) / 1e9;
+    double cpu = cpuSec() - cpu_start;
+    double server_cpu = cpu;
+    for (double thread_cpu : client_cpu) {
+        server_cpu -= thread_cpu;
+    }
+
+    ClientStats total;
+    auto add = [&total](const ClientStats &stats) {
+        total.requests += stats.requests;
+        total.bytes += stats.bytes;
+        total.errors += stats.errors;
+        total.latencies.merge(stats.latencies);
+    };
+    for (auto &client : http_clients) {
+        add(client->stats);
+    }
+    for (auto &client : websocket_clients) {
+        add(client->stats);
+    }
+
+    std::ostringstream json;
+    json << "{\"route\":\"" << routeName(c.route) << "\""
+         << ",\"connections\":" << c.connections
+         << ",\"keep_alive\":" << (c.keep_alive ? "true" : "false")
+         << ",\"pipeline\":" << c.pipeline
+         << ",\"requests\":" << total.requests
+         << ",\"errors\":" << total.errors
+         << ",\"requests_per_s\":" << total.requests / elapsed
+         << ",\"mb_per_s\":" << total.bytes / elapsed / 1024 / 1024
+         << ",\"process_cpu_us_per_request\":" << (total.requests > 0 ? cpu * 1e6 / total.requests : 0)
+         << ",\"server_cpu_us_per_request\":" << (total.requests > 0 ? server_cpu * 1e6 / total.requests : 0)
+         << ",\"p50_us\":" << total.latencies.percentile(0.5)
+         << ",\"p99_us\":" << total.latencies.percentile(0.99)
+         << ",\"p999_us\":" << total.latencies.percentile(0.999)
+         << ",\"histogram\":" << total.latencies.json()
+         << "}";
+    return json.str();
+}
+
+int main(int argc, char **argv) {
+    std::string result_file = argc > 1 ? argv[1] : "http_bench.jsonl";
+    double seconds = argc > 2 ? std::stod(argv[2]) : 2;
+    unsigned short port = static_cast<unsigned short>(argc > 3 ? std::stoi(argv[3]) : 8098);
+    int cores = std::max(2, static_cast<int>(std::thread::hardware_concurrency()));
+    int server_threads = argc > 4 ? std::stoi(argv[4]) : cores / 2;
+    bool engines = argc > 5 && std::stoi(argv[5]) != 0;
+
+    Logger::setLevel(Logger::WARN);
+
+    // the static file is served from a webroot of its own
+    char webroot[] = "/tmp/http_server_bench.XXXXXX";
+    if (mkdtemp(webroot) == nullptr) {
+        std::cerr << "mkdtemp failed" << std::endl;
+        return 1;
+    }
+    std::ofstream(std::string(webroot) + "/bench.html") << std::string(STATIC_SIZE, 'x');
+
+    HttpServer server("127.0.0.1", port, server_threads);
+    if (engines) {
+        server.engines(server_threads);
+    }
+    server.webroot(webroot);
+    server.max_requests(0);
+    server.pipeline_limit(64);
+    std::string dynamic_body(DYNAMIC_SIZE, 'x');
+    server.on_http("/dynamic", HttpMethod::get, [&dynamic_body](HttpRequest &, HttpResponse &resp) {
+        resp.set(HttpHeader::content_type, "text/plain");
+        resp.body() = dynamic_body;
+    });
+    server.on_websocket([](std::vector<char> &data, WebsocketSession &session) {
+        session.send(std::make_shared<std::vector<char>>(data));
+    });
+    server.start();
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    std::vector<BenchCase> cases;
+    for (Route route : {Route::STATIC, Route::DYNAMIC, Route::WEBSOCKET}) {
+        if (argc > 8) {
+            cases.push_back({route, std::stoi(argv[6]), std::stoi(argv[7]) != 0, std::max(1, std::stoi(argv[8]))});
+            continue;
+        }
+        for (int connections : {1, 16, 64}) {
+            if (route != Route::WEBSOCKET) {
+                cases.push_back({route, connections, false, 1});
+            }
+            cases.push_back({route, connections, true, 1});
+            cases.push_back({route, connections, true, 16});
+        }
+    }
+
+    int client_threads = std::max(1, cores - server_threads);
+    std::ofstream out(result_file, std::ios::app);
+    printf("%10s %6s %6s %6s %12s %10s %10s %10s %10s %10s %10s %8s\n", "route", "conns", "alive", "depth",
+           "req/s", "MB/s", "proc us", "server us", "p50 us", "p99 us", "p999 us", "errors");
+    for (const BenchCase &c : cases) {
+        std::string json = runCase(c, port, seconds, client_threads);
+        out << json << std::endl;
+
+        // the same numbers for reading along
+        auto field = [&json](const std::string &name) {
+            std::size_t pos = json.find("\"" + name + "\":");
+            return pos == std::string::npos ? 0 : std::stod(json.substr(pos + name.size() + 3));
+        };
+        printf("%10s %6d %6s %6d %12.0f %10.1f %10.1f %10.1f %10.0f %10.0f %10.0f %8.0f\n", routeName(c.route),
+               c.connections, c.keep_alive ? "yes" : "no", c.pipeline, field("requests_per_s"), field("mb_per_s"),
+               field("process_cpu_us_per_request"), field("server_cpu_us_per_request"), field("p50_us"),
+               field("p99_us"), field("p999_us"), field("errors"));
+        fflush(stdout);
+    }
+    out.close();
+    std::remove((std::string(webroot) + "/bench.html").c_str());
+    rmdir(webroot);
+    _exit(0);
+}